@@ -0,0 +1,111 @@
+/**
+ * Wifi Manager - cost of the API requests per webserver backend
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Built once per webserver backend, the requests run through the stand-in of the
+ * server in test/host. Per endpoint it prints the requests per second of the host CPU,
+ * the heap allocations and allocated bytes per request and the most heap in use at the
+ * same time while the request is handled. The heap includes the request and response
+ * objects of the stand-in, it does not include the socket, the buffers and the task of
+ * the real server. The heap per open connection is not measured.
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_api.h"
+#include "host_bench.h"
+#include "host_test.h"
+
+#if IDF_WEBSERVER == true
+#define BENCH_BACKEND "idf"
+#elif ASYNC_WEBSERVER == true
+#define BENCH_BACKEND "async"
+#else
+#define BENCH_BACKEND "sync"
+#endif
+
+class HttpBenchManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    void logMessage(String msg) override {}
+};
+
+static const char * networks[WIFIMANAGER_MAX_APS] = { "office", "office-guest", "lab", "warehouse" };
+
+int main() {
+  HostSim sim;
+  sim.radio.scanDurationMs = 0;
+  Serial.muted = true;
+
+  for (uint8_t i = 0; i < 20; i++) {
+    simAccessPoint_t ap;
+    ap.ssid = i < WIFIMANAGER_MAX_APS ? networks[i] : "neighbour-network-" + std::to_string(i);
+    ap.pass = "secret";
+    ap.rssi = -40 - i * 2;
+    ap.channel = 1 + i % 13;
+    ap.bssid[5] = i;
+    sim.radio.addAp(ap);
+  }
+
+  HttpBenchManager wifi("bench", &sim.hal);
+  for (uint8_t i = 0; i < WIFIMANAGER_MAX_APS - 1; i++) wifi.addWifi(networks[i], "secret", false);
+  wifi.tryConnect();
+
+  // the body of a request is received like from a single TCP segment
+  ApiClient client;
+  client.bodyChunk = 1460;
+  client.recvTimeouts = false;
+  client.attach(wifi);
+  // the first request starts the scan, the following ones serialize the results
+  client.get("/api/wifi/scan");
+  sim.clock.delay(1);
+
+  const std::string add = std::string("{\"apName\":\"") + networks[WIFIMANAGER_MAX_APS - 1] + "\",\"apPass\":\"secret\",\"priority\":3}";
+  const std::string del = std::string("{\"apName\":\"") + networks[WIFIMANAGER_MAX_APS - 1] + "\"}";
+  const struct {
+    const char * name;
+    std::function<hostHttpResponse_t()> request;
+  } endpoints[] = {
+    { "status", [&]() { return client.get("/api/wifi/status"); } },
+    { "configlist", [&]() { return client.get("/api/wifi/configlist"); } },
+    { "scan", [&]() { return client.get("/api/wifi/scan"); } },
+    { "metrics", [&]() { return client.get("/api/wifi/metrics"); } },
+    { "add_delete", [&]() {
+      hostHttpResponse_t response = client.post("/api/wifi/add", add);
+      if (response.code != 200) return response;
+      return client.del("/api/wifi/apName", del);
+    } },
+  };
+  const uint32_t iterations = hostBenchIterations(20000);
+
+  for (auto & endpoint : endpoints) {
+    // once outside of the measurement, for the allocations that are kept
+    hostHttpResponse_t response = endpoint.request();
+    EXPECT(response.code == 200);
+
+    hostBenchHeap_t heap;
+    uint64_t allocs = 0;
+    uint64_t bytes = 0;
+    uint64_t peak = 0;
+    uint64_t nanos = 0;
+    size_t responseBytes = response.body.size();
+    for (uint32_t i = 0; i < iterations; i++) {
+      heap.start();
+      uint64_t start = hostBenchNanos();
+      response = endpoint.request();
+      nanos += hostBenchNanos() - start;
+      allocs += heap.allocations();
+      bytes += heap.allocatedBytes();
+      if (heap.peakBytes() > peak) peak = heap.peakBytes();
+      response = hostHttpResponse_t();
+    }
+
+    printf("bench=http backend=%s endpoint=%s response_bytes=%zu req_per_s=%.0f heap_allocs=%.1f alloc_bytes=%.0f peak_heap_bytes=%llu\n",
+      BENCH_BACKEND, endpoint.name, responseBytes, nanos > 0 ? 1e9 * iterations / nanos : 0.0,
+      (double)allocs / iterations, (double)bytes / iterations, (unsigned long long)peak);
+  }
+  wifi.detachWebServer();
+  return TEST_RESULT();
+}
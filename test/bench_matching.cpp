@@ -0,0 +1,106 @@
+/**
+ * Wifi Manager - benchmark of matching scan results against the stored networks
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Scans of 8 to 512 records, a quarter of them belong to the stored networks, are
+ * matched by collectCandidates() through the hashed SSID index. As reference, the same
+ * records are matched by creating a String per record and comparing it to every
+ * stored SSID. The cost per record should stay flat with the scan size.
+ * collectCandidates() also builds and ranks the candidates, the reference only matches.
+ * The host String keeps short SSIDs without a heap allocation, so the reference is
+ * cheaper here than with the Arduino String on the device.
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_bench.h"
+#include "host_test.h"
+
+// Exposes the candidate selection of the WifiManager
+class BenchManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::collectCandidates;
+
+    void logMessage(String msg) override {}
+};
+
+static const char * networks[WIFIMANAGER_MAX_APS] = { "office", "office-guest", "lab", "warehouse" };
+
+// Matching without index, a String per record compared to every stored SSID
+static uint16_t matchByString(WifiManagerRadio & radio, int16_t scanResult, const String * stored) {
+  uint16_t matches = 0;
+  for (int16_t x = 0; x < scanResult; x++) {
+    wifiScanRecord_t record;
+    if (!radio.scanRecord(x, record)) continue;
+    String ssid((const char *)record.ssid);
+    for (uint8_t i = 0; i < WIFIMANAGER_MAX_APS; i++) {
+      if (stored[i] == ssid) matches++;
+    }
+  }
+  return matches;
+}
+
+int main() {
+  const uint16_t sizes[] = { 8, 16, 32, 64, 128, 256, 512 };
+  String stored[WIFIMANAGER_MAX_APS];
+  for (uint8_t i = 0; i < WIFIMANAGER_MAX_APS; i++) stored[i] = networks[i];
+
+  for (uint16_t size : sizes) {
+    HostSim sim;
+    sim.radio.scanDurationMs = 0;
+
+    uint32_t seed = size;
+    uint16_t matching = 0;
+    for (uint16_t i = 0; i < size; i++) {
+      seed = seed * 1103515245 + 12345;
+      simAccessPoint_t ap;
+      bool known = i % 4 == 0;
+      ap.ssid = known ? networks[(i / 4) % WIFIMANAGER_MAX_APS] : "neighbour-network-" + std::to_string(i);
+      ap.pass = "secret";
+      ap.rssi = -30 - (seed >> 16) % 60;
+      ap.bssid[4] = i >> 8;
+      ap.bssid[5] = i;
+      sim.radio.addAp(ap);
+      if (known) matching++;
+    }
+
+    BenchManager wifi("bench", &sim.hal);
+    for (uint8_t i = 0; i < WIFIMANAGER_MAX_APS; i++) wifi.addWifi(networks[i], "secret", false);
+
+    const uint32_t iterations = hostBenchIterations(2000000 / size);
+    wifiCandidate_t candidates[WIFIMANAGER_MAX_CANDIDATES];
+    uint64_t indexNanos = 0;
+    uint64_t stringNanos = 0;
+    uint16_t stringMatches = 0;
+    hostBenchHeap_t heap;
+    uint64_t indexAllocs = 0, stringAllocs = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+      int16_t scanResult = sim.radio.scan(false);
+
+      heap.start();
+      uint64_t start = hostBenchNanos();
+      stringMatches = matchByString(sim.radio, scanResult, stored);
+      stringNanos += hostBenchNanos() - start;
+      stringAllocs += heap.allocations();
+
+      heap.start();
+      start = hostBenchNanos();
+      wifi.collectCandidates(scanResult, 0, candidates);
+      indexNanos += hostBenchNanos() - start;
+      indexAllocs += heap.allocations();
+    }
+    EXPECT(stringMatches == matching);
+
+    for (int m = 0; m < 2; m++) {
+      uint64_t nanos = m == 0 ? indexNanos : stringNanos;
+      uint64_t allocs = m == 0 ? indexAllocs : stringAllocs;
+      printf("bench=matching matcher=%s records=%u matching=%u stored=%u decision_ns=%.0f record_ns=%.1f heap_allocs=%.2f\n",
+        m == 0 ? "index" : "string", size, matching, WIFIMANAGER_MAX_APS,
+        (double)nanos / iterations, (double)nanos / iterations / size, (double)allocs / iterations);
+    }
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,128 @@
+/**
+ * Wifi Manager - request latency of the power policies
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * An hour of virtual time with sessions of HTTP requests separated by idle periods, the
+ * background task runs loop() every 10 s. In modem sleep the AP buffers an inbound
+ * request until the radio wakes up for the next DTIM beacon or listen interval, the
+ * simulated radio models this delay. Per policy it prints the p50/p95/p99 delay of the
+ * requests, the share of time without modem sleep and the number of power save changes.
+ * The share without modem sleep stands in for the power draw, the current itself has to
+ * be measured on a device.
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_bench.h"
+#include "host_test.h"
+#include <algorithm>
+#include <vector>
+
+#define POWER_HORIZON_MILLIS 3600000ULL // Virtual time per run
+#define POWER_LOOP_MILLIS 10000         // Period of loop() in the background task
+#define POWER_SERVICE_MILLIS 5          // Time to answer a request once it is received
+
+class PowerManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    void logMessage(String msg) override {}
+};
+
+struct powerResult_t {
+  std::vector<uint64_t> latency;
+  uint64_t awakeMillis = 0;
+  uint64_t totalMillis = 0;
+  uint32_t changes = 0;
+};
+
+// Traffic and WifiManager of a single run
+class PowerRun : public HostSim {
+  protected:
+    uint32_t seed;
+
+  public:
+    PowerManager wifi{"power", &hal};
+    powerResult_t & result;
+
+    PowerRun(uint32_t seed, powerResult_t & result) : seed(seed), result(result) {}
+
+    uint32_t random(uint32_t min, uint32_t max) {
+      seed = seed * 1103515245 + 12345;
+      return min + (seed >> 8) % (max - min + 1);
+    }
+
+    // Like the background task
+    void loop() {
+      wifi.loop();
+      clock.after(POWER_LOOP_MILLIS, [this]() { loop(); });
+    }
+
+    // A request is received at the next wake up of the radio, the API endpoint reports the activity
+    void request(uint8_t remaining) {
+      result.latency.push_back(radio.inboundDelayMs() + POWER_SERVICE_MILLIS);
+      wifi.notifyActivity();
+      if (remaining > 0) clock.after(random(100, 3000), [this, remaining]() { request(remaining - 1); });
+      else clock.after(random(20000, 300000), [this]() { request(random(2, 10)); });
+    }
+
+    void run(wifiPowerPolicy_t policy) {
+      simAccessPoint_t ap;
+      ap.ssid = "office";
+      ap.pass = "secret";
+      radio.addAp(ap);
+      wifi.addWifi("office", "secret", false);
+      wifi.setPowerPolicy(policy);
+      wifi.tryConnect();
+
+      uint64_t start = clock.millis();
+      uint64_t awake = radio.powerSaveMillis(WIFI_POWER_SAVE_NONE);
+      uint32_t changes = radio.powerSaveChanges;
+      clock.after(POWER_LOOP_MILLIS, [this]() { loop(); });
+      clock.after(random(1000, 60000), [this]() { request(random(2, 10)); });
+      clock.delay(POWER_HORIZON_MILLIS);
+
+      result.awakeMillis += radio.powerSaveMillis(WIFI_POWER_SAVE_NONE) - awake;
+      result.totalMillis += clock.millis() - start;
+      result.changes += radio.powerSaveChanges - changes;
+    }
+};
+
+static uint64_t percentile(std::vector<uint64_t> & values, uint8_t p) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  size_t rank = (values.size() * p + 99) / 100;
+  return values[rank > 0 ? rank - 1 : 0];
+}
+
+int main() {
+  const struct {
+    const char * name;
+    wifiPowerPolicy_t policy;
+  } policies[] = {
+    { "lowLatency", WIFI_POWER_LOW_LATENCY },
+    { "balanced", WIFI_POWER_BALANCED },
+    { "maxSavings", WIFI_POWER_MAX_SAVINGS },
+    { "adaptive", WIFI_POWER_ADAPTIVE },
+  };
+  const uint32_t runs = hostBenchIterations(20);
+
+  for (auto & entry : policies) {
+    powerResult_t result;
+    for (uint32_t i = 0; i < runs; i++) {
+      PowerRun run(i + 1, result);
+      run.run(entry.policy);
+    }
+    EXPECT(!result.latency.empty());
+
+    size_t requests = result.latency.size();
+    uint64_t p50 = percentile(result.latency, 50);
+    uint64_t p95 = percentile(result.latency, 95);
+    uint64_t p99 = percentile(result.latency, 99);
+    printf("bench=power policy=%s runs=%u requests=%zu p50_ms=%llu p95_ms=%llu p99_ms=%llu awake_pct=%.1f ps_changes_per_h=%.1f\n",
+      entry.name, runs, requests, (unsigned long long)p50, (unsigned long long)p95, (unsigned long long)p99,
+      100.0 * result.awakeMillis / result.totalMillis, (double)result.changes / runs);
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,238 @@
+/**
+ * Wifi Manager - time to IP in simulated RF scenarios
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Runs the connection logic in virtual time, loop() is called every 10 s like the
+ * background task does. Each scenario is repeated with random join and DHCP latencies
+ * and signal strengths. Per scenario it prints the p50/p95/p99 time to IP, measured from
+ * the start of the scenario or the event it is about, the mean number of scans and the
+ * mean radio on time (scanning and connecting) until the IP was received.
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_bench.h"
+#include "host_test.h"
+#include <algorithm>
+#include <vector>
+
+#define SCENARIO_HORIZON_MILLIS 600000ULL // Give up if there is no IP within 10 minutes
+#define SCENARIO_LOOP_MILLIS 10000        // Period of loop() in the background task
+
+class ScenarioManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    void logMessage(String msg) override {}
+};
+
+struct scenarioRun_t {
+  bool connected = false;
+  uint64_t timeToIpMillis = 0;
+  uint32_t scans = 0;
+  uint64_t radioMillis = 0;
+};
+
+// RF environment and WifiManager of a single run
+class Scenario : public HostSim {
+  protected:
+    uint32_t seed;
+
+  public:
+    ScenarioManager wifi{"scenario", &hal};
+
+    Scenario(uint32_t seed) : seed(seed) {}
+
+    uint32_t random(uint32_t min, uint32_t max) {
+      seed = seed * 1103515245 + 12345;
+      return min + (seed >> 8) % (max - min + 1);
+    }
+
+    size_t addAp(const char * ssid, const char * pass, int8_t rssi, uint8_t id) {
+      simAccessPoint_t ap;
+      ap.ssid = ssid;
+      ap.pass = pass;
+      ap.rssi = rssi + (int8_t)random(0, 8) - 4;
+      ap.channel = 1 + random(0, 12);
+      ap.bssid[4] = id >> 8;
+      ap.bssid[5] = id;
+      ap.joinLatencyMs = random(300, 1500);
+      ap.dhcpLatencyMs = random(100, 2000);
+      return radio.addAp(ap);
+    }
+
+    // Boot the WifiManager like a sketch does with startBackgroundTask()
+    void boot() {
+      wifi.startBackgroundTask();
+    }
+
+    // Let the background task run until the IP is received, measured from now
+    scenarioRun_t measure() {
+      scenarioRun_t run;
+      uint64_t start = clock.millis();
+      uint32_t scans = radio.scans;
+      wifi.resetMetrics();
+      while (clock.millis() - start < SCENARIO_HORIZON_MILLIS) {
+        if (wifi.getLinkState().gotIp) {
+          run.connected = true;
+          break;
+        }
+        clock.delay(SCENARIO_LOOP_MILLIS);
+        wifi.loop();
+      }
+      run.timeToIpMillis = clock.millis() - start;
+      run.scans = radio.scans - scans;
+      run.radioMillis = wifi.getMetrics().radioActiveMillis;
+      return run;
+    }
+
+    // Boot and measure the first connection
+    scenarioRun_t bootAndMeasure() {
+      scenarioRun_t run;
+      uint32_t scans = radio.scans;
+      boot();
+      if (wifi.getLinkState().gotIp) {
+        run.connected = true;
+        run.timeToIpMillis = clock.millis();
+        run.scans = radio.scans - scans;
+        run.radioMillis = wifi.getMetrics().radioActiveMillis;
+        return run;
+      }
+      uint64_t bootMillis = clock.millis();
+      uint64_t bootRadio = wifi.getMetrics().radioActiveMillis;
+      run = measure();
+      run.timeToIpMillis += bootMillis;
+      run.radioMillis += bootRadio;
+      run.scans = radio.scans - scans;
+      return run;
+    }
+};
+
+// The only configured network is in range, the scan is skipped
+static scenarioRun_t singleKnownAp(Scenario & s) {
+  s.addAp("office", "secret", -55, 1);
+  s.wifi.addWifi("office", "secret");
+  return s.bootAndMeasure();
+}
+
+// All slots are used, each network has several BSSIDs
+static scenarioRun_t manyKnownAps(Scenario & s) {
+  const char * networks[WIFIMANAGER_MAX_APS] = { "office", "lab", "warehouse", "guest" };
+  for (uint8_t i = 0; i < WIFIMANAGER_MAX_APS; i++) {
+    for (uint8_t b = 0; b < 3; b++) s.addAp(networks[i], "secret", -45 - (int8_t)s.random(0, 40), i * 3 + b);
+    s.wifi.addWifi(networks[i], "secret", true, s.random(0, 2));
+  }
+  return s.bootAndMeasure();
+}
+
+// Two configured networks among 80 foreign ones, one of them is in range
+static scenarioRun_t denseEnvironment(Scenario & s) {
+  for (uint8_t i = 0; i < 80; i++) {
+    std::string name = "neighbour-" + std::to_string(i);
+    s.addAp(name.c_str(), "other", -50 - (int8_t)s.random(0, 40), 100 + i);
+  }
+  s.addAp("office", "secret", -72, 1);
+  s.addAp("office", "secret", -80, 2);
+  s.wifi.addWifi("office", "secret");
+  s.wifi.addWifi("home", "secret");
+  return s.bootAndMeasure();
+}
+
+// The stored password of the strongest network is outdated, a weaker one works
+static scenarioRun_t wrongPasswordOnStrongest(Scenario & s) {
+  s.addAp("lab", "changed", -40, 1);
+  s.addAp("office", "secret", -70, 2);
+  s.wifi.addWifi("lab", "secret");
+  s.wifi.addWifi("office", "secret");
+  return s.bootAndMeasure();
+}
+
+// Connected, then the AP reboots and is back after 30 to 90 s, measured from the reboot
+static scenarioRun_t apReboot(Scenario & s) {
+  size_t ap = s.addAp("office", "secret", -60, 1);
+  s.wifi.addWifi("office", "secret");
+  s.wifi.addWifi("home", "secret");
+  s.boot();
+  s.clock.delay(s.random(60000, 600000));
+  s.radio.setOnline(ap, false);
+  s.clock.after(s.random(30000, 90000), [&s, ap]() { s.radio.setOnline(ap, true); });
+  return s.measure();
+}
+
+// The network in range does not broadcast its SSID, the other configured one is away
+static scenarioRun_t hiddenSsid(Scenario & s) {
+  size_t ap = s.addAp("office", "secret", -55, 1);
+  s.radio.accessPoints[ap].hidden = true;
+  s.wifi.addWifi("office", "secret");
+  s.wifi.addWifi("home", "secret");
+  return s.bootAndMeasure();
+}
+
+// The AP was down at boot, a phone joined the configuration portal before it came back
+static scenarioRun_t portalActive(Scenario & s) {
+  size_t ap = s.addAp("office", "secret", -60, 1);
+  s.wifi.addWifi("office", "secret");
+  s.wifi.addWifi("home", "secret");
+  s.radio.setOnline(ap, false);
+  s.boot();
+  s.radio.softApStations = 1;
+  s.clock.delay(s.random(5000, 60000));
+  s.radio.setOnline(ap, true);
+  s.clock.after(s.random(10000, 180000), [&s]() { s.radio.softApStations = 0; });
+  return s.measure();
+}
+
+struct scenarioInfo_t {
+  const char * name;
+  scenarioRun_t (*run)(Scenario & s);
+};
+
+static uint64_t percentile(std::vector<uint64_t> & values, uint8_t p) {
+  if (values.empty()) return 0;
+  std::sort(values.begin(), values.end());
+  size_t rank = (values.size() * p + 99) / 100;
+  return values[rank > 0 ? rank - 1 : 0];
+}
+
+int main() {
+  const scenarioInfo_t scenarios[] = {
+    { "single_known_ap", singleKnownAp },
+    { "many_known_aps", manyKnownAps },
+    { "dense_environment", denseEnvironment },
+    { "wrong_password_strongest", wrongPasswordOnStrongest },
+    { "ap_reboot", apReboot },
+    { "hidden_ssid", hiddenSsid },
+    { "portal_active", portalActive },
+  };
+  const uint32_t runs = hostBenchIterations(200);
+
+  for (const scenarioInfo_t & scenario : scenarios) {
+    std::vector<uint64_t> timeToIp;
+    uint64_t scans = 0;
+    uint64_t radioMillis = 0;
+    for (uint32_t i = 0; i < runs; i++) {
+      Scenario s(i + 1);
+      scenarioRun_t run = scenario.run(s);
+      if (!run.connected) continue;
+      timeToIp.push_back(run.timeToIpMillis);
+      scans += run.scans;
+      radioMillis += run.radioMillis;
+    }
+    size_t connected = timeToIp.size();
+    EXPECT(connected > 0 || strcmp(scenario.name, "hidden_ssid") == 0);
+
+    printf("scenario=%s runs=%u connected=%zu", scenario.name, runs, connected);
+    if (connected == 0) {
+      printf(" p50_ms=-1 p95_ms=-1 p99_ms=-1 scans=-1 radio_on_ms=-1\n");
+      continue;
+    }
+    uint64_t p50 = percentile(timeToIp, 50);
+    uint64_t p95 = percentile(timeToIp, 95);
+    uint64_t p99 = percentile(timeToIp, 99);
+    printf(" p50_ms=%llu p95_ms=%llu p99_ms=%llu scans=%.2f radio_on_ms=%.0f\n",
+      (unsigned long long)p50, (unsigned long long)p95, (unsigned long long)p99,
+      (double)scans / connected, (double)radioMillis / connected);
+  }
+  return TEST_RESULT();
+}
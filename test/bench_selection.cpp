@@ -0,0 +1,109 @@
+/**
+ * Wifi Manager - benchmark of the network selection strategies
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * A scan of 128 synthetic BSSIDs, 96 of them belong to the stored networks, is matched
+ * and ranked by each strategy. Per decision it reports the time of the whole decision
+ * (collectCandidates()), the time of rank() alone, the heap allocations and the size
+ * of the candidate list on the stack.
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_bench.h"
+#include "host_test.h"
+
+#define BENCH_BSSIDS 128
+#define BENCH_BSSIDS_PER_NETWORK 24
+
+// Exposes the candidate selection of the WifiManager
+class BenchManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::collectCandidates;
+
+    void logMessage(String msg) override {}
+
+    // Recent connection statistics as learned by tryConnect()
+    void setStatistics(uint8_t apId, uint8_t attempts, uint8_t success) {
+      apList[apId].connectAttempts = attempts;
+      apList[apId].connectSuccess = success;
+    }
+};
+
+struct BenchStrategy {
+  const char * name;
+  WifiSelectionStrategy * strategy;
+};
+
+int main() {
+  HostSim sim;
+  sim.radio.scanDurationMs = 0;
+
+  const char * networks[WIFIMANAGER_MAX_APS] = { "office", "office-guest", "lab", "warehouse" };
+  uint32_t seed = 1;
+  for (uint16_t i = 0; i < BENCH_BSSIDS; i++) {
+    seed = seed * 1103515245 + 12345;
+    simAccessPoint_t ap;
+    uint16_t network = i / BENCH_BSSIDS_PER_NETWORK;
+    ap.ssid = network < WIFIMANAGER_MAX_APS ? networks[network] : "foreign-" + std::to_string(i);
+    ap.pass = "secret";
+    ap.rssi = -30 - (seed >> 16) % 60;
+    ap.channel = 1 + (seed >> 8) % 13;
+    ap.bssid[4] = i >> 8;
+    ap.bssid[5] = i;
+    sim.radio.addAp(ap);
+  }
+
+  BenchManager wifi("bench", &sim.hal);
+  for (uint8_t i = 0; i < WIFIMANAGER_MAX_APS; i++) {
+    wifi.addWifi(networks[i], "secret", false, i % 2 ? 5 : 0);
+    wifi.setStatistics(i, 10, 10 - 2 * i);
+  }
+
+  WifiRssiSelection rssi;
+  WifiPrioritySelection priority;
+  WifiSuccessRateSelection successRate;
+  BenchStrategy strategies[] = { { "rssi", &rssi }, { "priority", &priority }, { "successRate", &successRate } };
+
+  const uint32_t iterations = hostBenchIterations(20000);
+  for (auto & entry : strategies) {
+    wifi.setSelectionStrategy(entry.strategy);
+
+    wifiCandidate_t candidates[WIFIMANAGER_MAX_CANDIDATES];
+    uint8_t count = 0;
+    uint64_t decisionNanos = 0;
+    hostBenchHeap_t heap;
+    uint64_t allocs = 0, bytes = 0;
+    for (uint32_t i = 0; i < iterations; i++) {
+      int16_t scanResult = sim.radio.scan(false);
+      heap.start();
+      uint64_t start = hostBenchNanos();
+      count = wifi.collectCandidates(scanResult, 0, candidates);
+      decisionNanos += hostBenchNanos() - start;
+      allocs += heap.allocations();
+      bytes += heap.allocatedBytes();
+    }
+    EXPECT(count == WIFIMANAGER_MAX_CANDIDATES);
+
+    // rank() alone on the kept candidates, in their order as collected
+    wifiCandidate_t collected[WIFIMANAGER_MAX_CANDIDATES];
+    memcpy(collected, candidates, sizeof(collected));
+    uint64_t start = hostBenchNanos();
+    for (uint32_t i = 0; i < iterations; i++) {
+      memcpy(candidates, collected, sizeof(candidates));
+      count = entry.strategy->rank(candidates, WIFIMANAGER_MAX_CANDIDATES);
+    }
+    uint64_t rankNanos = hostBenchNanos() - start;
+
+    printf("bench=selection strategy=%s bssids=%u matching=%u candidates=%u decision_ns=%.0f rank_ns=%.0f"
+      " heap_allocs=%.2f heap_bytes=%.0f stack_bytes=%zu best_rssi=%d\n",
+      entry.name, BENCH_BSSIDS, WIFIMANAGER_MAX_APS * BENCH_BSSIDS_PER_NETWORK, count,
+      (double)decisionNanos / iterations, (double)rankNanos / iterations,
+      (double)allocs / iterations, (double)bytes / iterations,
+      sizeof(candidates) + WIFIMANAGER_MAX_CANDIDATES * sizeof(int32_t), candidates[0].rssi);
+  }
+  return TEST_RESULT();
+}
@@ -0,0 +1,196 @@
+/**
+ * Wifi Manager - minimal Arduino core for host builds
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Only what the WifiManager uses: String, IPAddress, Print, Serial and ESP.
+**/
+#ifndef WIFIMANAGER_HOST_ARDUINO_h
+#define WIFIMANAGER_HOST_ARDUINO_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <limits.h>
+#include <functional>
+#include <memory>
+#include <string>
+
+#define F(string_literal) (string_literal)
+#define PROGMEM
+
+// Version of the emulated arduino-esp32 core, set ESP_ARDUINO_VERSION_MINOR to build against an older one
+#ifndef ESP_ARDUINO_VERSION_MAJOR
+#define ESP_ARDUINO_VERSION_MAJOR 3
+#endif
+#ifndef ESP_ARDUINO_VERSION_MINOR
+#define ESP_ARDUINO_VERSION_MINOR 1
+#endif
+#ifndef ESP_ARDUINO_VERSION_PATCH
+#define ESP_ARDUINO_VERSION_PATCH 0
+#endif
+#define ESP_ARDUINO_VERSION_VAL(major, minor, patch) ((major << 16) | (minor << 8) | (patch))
+#define ESP_ARDUINO_VERSION ESP_ARDUINO_VERSION_VAL(ESP_ARDUINO_VERSION_MAJOR, ESP_ARDUINO_VERSION_MINOR, ESP_ARDUINO_VERSION_PATCH)
+
+class String {
+  protected:
+    std::string s;
+
+  public:
+    String() {}
+    String(const char * c) : s(c ? c : "") {}
+    String(const std::string & c) : s(c) {}
+    String(char c) : s(1, c) {}
+    String(int v) : s(std::to_string(v)) {}
+    String(unsigned int v) : s(std::to_string(v)) {}
+    String(long v) : s(std::to_string(v)) {}
+    String(unsigned long v) : s(std::to_string(v)) {}
+    String(long long v) : s(std::to_string(v)) {}
+    String(unsigned long long v) : s(std::to_string(v)) {}
+    String(double v, unsigned int decimals = 2) {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%.*f", (int)decimals, v);
+      s = buf;
+    }
+
+    unsigned int length() const { return s.size(); }
+    const char * c_str() const { return s.c_str(); }
+    bool isEmpty() const { return s.empty(); }
+    bool reserve(unsigned int size) { s.reserve(size); return true; }
+    void clear() { s.clear(); }
+    char charAt(unsigned int i) const { return i < s.size() ? s[i] : 0; }
+    char operator[](unsigned int i) const { return charAt(i); }
+
+    bool concat(const String & o) { s += o.s; return true; }
+    String & operator+=(const String & o) { s += o.s; return *this; }
+    String & operator+=(const char * o) { s += o ? o : ""; return *this; }
+    String & operator+=(char c) { s += c; return *this; }
+    String & operator+=(int v) { s += std::to_string(v); return *this; }
+    String & operator+=(unsigned int v) { s += std::to_string(v); return *this; }
+    String & operator+=(long v) { s += std::to_string(v); return *this; }
+    String & operator+=(unsigned long v) { s += std::to_string(v); return *this; }
+    friend String operator+(const String & a, const String & b) { return String(a.s + b.s); }
+    friend String operator+(const String & a, const char * b) { return String(a.s + (b ? b : "")); }
+    friend String operator+(const char * a, const String & b) { return String(std::string(a ? a : "") + b.s); }
+
+    bool equals(const String & o) const { return s == o.s; }
+    bool operator==(const String & o) const { return s == o.s; }
+    bool operator!=(const String & o) const { return s != o.s; }
+    bool operator==(const char * o) const { return s == (o ? o : ""); }
+    bool operator!=(const char * o) const { return !(*this == o); }
+    bool operator<(const String & o) const { return s < o.s; }
+    bool startsWith(const String & p) const { return s.compare(0, p.s.size(), p.s) == 0; }
+    bool endsWith(const String & p) const { return s.size() >= p.s.size() && s.compare(s.size() - p.s.size(), p.s.size(), p.s) == 0; }
+
+    int indexOf(char c, unsigned int from = 0) const {
+      size_t pos = s.find(c, from);
+      return pos == std::string::npos ? -1 : (int)pos;
+    }
+    int indexOf(const String & o, unsigned int from = 0) const {
+      size_t pos = s.find(o.s, from);
+      return pos == std::string::npos ? -1 : (int)pos;
+    }
+    String substring(unsigned int from) const { return from < s.size() ? String(s.substr(from)) : String(); }
+    String substring(unsigned int from, unsigned int to) const {
+      if (from > to) std::swap(from, to);
+      return from < s.size() ? String(s.substr(from, to - from)) : String();
+    }
+    long toInt() const { return atol(s.c_str()); }
+    float toFloat() const { return atof(s.c_str()); }
+    void trim() {
+      size_t begin = s.find_first_not_of(" \t\r\n");
+      size_t end = s.find_last_not_of(" \t\r\n");
+      s = begin == std::string::npos ? std::string() : s.substr(begin, end - begin + 1);
+    }
+    void toLowerCase() { for (auto & c : s) c = tolower(c); }
+};
+
+class Print {
+  public:
+    virtual ~Print() {}
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t * buffer, size_t size) {
+      for (size_t i = 0; i < size; i++) write(buffer[i]);
+      return size;
+    }
+    size_t write(const char * str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+    virtual void flush() {}
+
+    size_t print(const char * str) { return write(str); }
+    size_t print(const String & str) { return write((const uint8_t *)str.c_str(), str.length()); }
+    size_t print(char c) { return write((uint8_t)c); }
+    size_t print(long v) { return print(String(v)); }
+    size_t print(int v) { return print(String(v)); }
+    size_t print(unsigned long v) { return print(String(v)); }
+    size_t print(unsigned int v) { return print(String(v)); }
+    template<typename T> size_t println(const T & v) { return print(v) + print("\n"); }
+    size_t println() { return print("\n"); }
+};
+
+// IPv4 address, stored in network byte order like the Arduino core
+class IPAddress {
+  protected:
+    uint32_t address = 0;
+
+  public:
+    IPAddress() {}
+    IPAddress(uint32_t address) : address(address) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address(a | b << 8 | c << 16 | (uint32_t)d << 24) {}
+
+    operator uint32_t() const { return address; }
+    uint8_t operator[](int i) const { return address >> (8 * i); }
+
+    String toString() const {
+      char buf[16];
+      snprintf(buf, sizeof(buf), "%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+      return String(buf);
+    }
+
+    bool fromString(const char * str) {
+      unsigned int part[4];
+      char end;
+      if (sscanf(str, "%u.%u.%u.%u%c", &part[0], &part[1], &part[2], &part[3], &end) != 4) return false;
+      for (auto p : part) if (p > 255) return false;
+      address = IPAddress(part[0], part[1], part[2], part[3]);
+      return true;
+    }
+    bool fromString(const String & str) { return fromString(str.c_str()); }
+};
+
+// Logging sink, writes to stdout unless redirected or muted
+class HardwareSerial : public Print {
+  public:
+    std::function<void(const char * data, size_t len)> sink;  // Replaces stdout if set
+    bool muted = false;
+
+    void begin(unsigned long) {}
+    using Print::write;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t * buffer, size_t size) override {
+      if (muted) return size;
+      if (sink) sink((const char *)buffer, size);
+      else fwrite(buffer, 1, size, stdout);
+      return size;
+    }
+};
+extern HardwareSerial Serial;
+
+// Chip information of the host
+class EspClass {
+  public:
+    const char * getChipModel() { return "host"; }
+    uint8_t getChipRevision() { return 0; }
+    uint8_t getChipCores() { return 1; }
+    uint32_t getHeapSize() { return 0; }
+    uint32_t getFreeHeap() { return 0; }
+};
+extern EspClass ESP;
+
+inline void yield() {}
+
+#endif
@@ -0,0 +1,428 @@
+/**
+ * Wifi Manager - minimal ArduinoJson for host builds
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Implements the subset of the ArduinoJson 7 API used by the WifiManager: documents
+ * with nested objects and arrays, is<T>(), as<T>(), isNull(), to<T>(), add<T>(),
+ * serializeJson(), measureJson() and deserializeJson().
+**/
+#ifndef WIFIMANAGER_HOST_ARDUINOJSON_h
+#define WIFIMANAGER_HOST_ARDUINOJSON_h
+
+#include "Arduino.h"
+#include <math.h>
+#include <limits>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace hostjson {
+
+struct Value {
+  enum Type { NUL, BOOL, INT, FLOAT, STRING, ARRAY, OBJECT } type = NUL;
+  bool b = false;
+  int64_t i = 0;
+  double f = 0;
+  std::string s;
+  std::vector<std::unique_ptr<Value>> items;                          // ARRAY
+  std::vector<std::pair<std::string, std::unique_ptr<Value>>> members; // OBJECT, in insertion order
+
+  void reset(Type t) {
+    type = t;
+    items.clear();
+    members.clear();
+  }
+
+  Value * member(const std::string & key) {
+    for (auto & m : members) if (m.first == key) return m.second.get();
+    return nullptr;
+  }
+
+  Value * memberOrAdd(const std::string & key) {
+    if (type != OBJECT) reset(OBJECT);
+    Value * v = member(key);
+    if (v) return v;
+    members.emplace_back(key, std::unique_ptr<Value>(new Value()));
+    return members.back().second.get();
+  }
+};
+
+inline void writeString(std::string & out, const std::string & s) {
+  out += '"';
+  for (unsigned char c : s) {
+    switch (c) {
+      case '"':  out += "\\\""; break;
+      case '\\': out += "\\\\"; break;
+      case '\n': out += "\\n"; break;
+      case '\r': out += "\\r"; break;
+      case '\t': out += "\\t"; break;
+      default:
+        if (c < 0x20) {
+          char buf[8];
+          snprintf(buf, sizeof(buf), "\\u%04x", c);
+          out += buf;
+        } else out += (char)c;
+    }
+  }
+  out += '"';
+}
+
+inline void write(std::string & out, const Value * v) {
+  if (v == nullptr) { out += "null"; return; }
+  switch (v->type) {
+    case Value::NUL: out += "null"; break;
+    case Value::BOOL: out += v->b ? "true" : "false"; break;
+    case Value::INT: out += std::to_string(v->i); break;
+    case Value::FLOAT: {
+      char buf[32];
+      snprintf(buf, sizeof(buf), "%.9g", v->f);
+      out += buf;
+      break;
+    }
+    case Value::STRING: writeString(out, v->s); break;
+    case Value::ARRAY:
+      out += '[';
+      for (size_t n = 0; n < v->items.size(); n++) {
+        if (n) out += ',';
+        write(out, v->items[n].get());
+      }
+      out += ']';
+      break;
+    case Value::OBJECT:
+      out += '{';
+      for (size_t n = 0; n < v->members.size(); n++) {
+        if (n) out += ',';
+        writeString(out, v->members[n].first);
+        out += ':';
+        write(out, v->members[n].second.get());
+      }
+      out += '}';
+      break;
+  }
+}
+
+class Parser {
+  protected:
+    const char * p;
+    const char * end;
+
+    void ws() { while (p < end && isspace((unsigned char)*p)) p++; }
+    bool literal(const char * word) {
+      size_t n = strlen(word);
+      if ((size_t)(end - p) < n || memcmp(p, word, n) != 0) return false;
+      p += n;
+      return true;
+    }
+
+    bool string(std::string & out) {
+      if (p >= end || *p != '"') return false;
+      p++;
+      while (p < end && *p != '"') {
+        char c = *p++;
+        if (c != '\\') { out += c; continue; }
+        if (p >= end) return false;
+        c = *p++;
+        switch (c) {
+          case 'n': out += '\n'; break;
+          case 'r': out += '\r'; break;
+          case 't': out += '\t'; break;
+          case 'b': out += '\b'; break;
+          case 'f': out += '\f'; break;
+          case 'u': {
+            if (end - p < 4) return false;
+            unsigned code = strtoul(std::string(p, 4).c_str(), nullptr, 16);
+            p += 4;
+            if (code < 0x80) out += (char)code;
+            else if (code < 0x800) { out += (char)(0xC0 | code >> 6); out += (char)(0x80 | (code & 0x3F)); }
+            else { out += (char)(0xE0 | code >> 12); out += (char)(0x80 | (code >> 6 & 0x3F)); out += (char)(0x80 | (code & 0x3F)); }
+            break;
+          }
+          default: out += c;
+        }
+      }
+      if (p >= end) return false;
+      p++;
+      return true;
+    }
+
+  public:
+    Parser(const char * input, size_t len) : p(input), end(input + len) {}
+
+    bool value(Value & v, int depth = 0) {
+      if (depth > 10) return false;
+      ws();
+      if (p >= end) return false;
+      if (*p == '{') {
+        p++;
+        v.reset(Value::OBJECT);
+        ws();
+        if (p < end && *p == '}') { p++; return true; }
+        while (true) {
+          ws();
+          std::string key;
+          if (!string(key)) return false;
+          ws();
+          if (p >= end || *p++ != ':') return false;
+          if (!value(*v.memberOrAdd(key), depth + 1)) return false;
+          ws();
+          if (p < end && *p == ',') { p++; continue; }
+          if (p < end && *p == '}') { p++; return true; }
+          return false;
+        }
+      }
+      if (*p == '[') {
+        p++;
+        v.reset(Value::ARRAY);
+        ws();
+        if (p < end && *p == ']') { p++; return true; }
+        while (true) {
+          v.items.emplace_back(new Value());
+          if (!value(*v.items.back(), depth + 1)) return false;
+          ws();
+          if (p < end && *p == ',') { p++; continue; }
+          if (p < end && *p == ']') { p++; return true; }
+          return false;
+        }
+      }
+      if (*p == '"') {
+        v.reset(Value::STRING);
+        return string(v.s);
+      }
+      if (literal("true")) { v.reset(Value::BOOL); v.b = true; return true; }
+      if (literal("false")) { v.reset(Value::BOOL); v.b = false; return true; }
+      if (literal("null")) { v.reset(Value::NUL); return true; }
+      const char * start = p;
+      bool isFloat = false;
+      if (p < end && (*p == '-' || *p == '+')) p++;
+      while (p < end && (isdigit((unsigned char)*p) || *p == '.' || *p == 'e' || *p == 'E' || *p == '-' || *p == '+')) {
+        if (!isdigit((unsigned char)*p)) isFloat = true;
+        p++;
+      }
+      if (p == start) return false;
+      std::string number(start, p - start);
+      if (isFloat) { v.reset(Value::FLOAT); v.f = atof(number.c_str()); }
+      else { v.reset(Value::INT); v.i = strtoll(number.c_str(), nullptr, 10); }
+      return true;
+    }
+
+    bool done() { ws(); return p >= end; }
+};
+
+} // namespace hostjson
+
+class JsonObject;
+class JsonArray;
+
+// Reference to a value, missing members are only created when written
+class JsonVariant {
+  protected:
+    hostjson::Value * base = nullptr;
+    std::vector<std::string> path;
+
+    hostjson::Value * resolve() const {
+      hostjson::Value * v = base;
+      for (const auto & key : path) {
+        if (v == nullptr || v->type != hostjson::Value::OBJECT) return nullptr;
+        v = v->member(key);
+      }
+      return v;
+    }
+
+    hostjson::Value * create() const {
+      hostjson::Value * v = base;
+      for (const auto & key : path) v = v->memberOrAdd(key);
+      return v;
+    }
+
+  public:
+    JsonVariant() {}
+    JsonVariant(hostjson::Value * base) : base(base) {}
+    JsonVariant(hostjson::Value * base, std::vector<std::string> path) : base(base), path(std::move(path)) {}
+
+    JsonVariant operator[](const char * key) const {
+      std::vector<std::string> p = path;
+      p.push_back(key);
+      return JsonVariant(base, p);
+    }
+    JsonVariant operator[](const String & key) const { return (*this)[key.c_str()]; }
+
+    bool isNull() const {
+      hostjson::Value * v = resolve();
+      return v == nullptr || v->type == hostjson::Value::NUL;
+    }
+
+    template<typename T> bool is() const {
+      hostjson::Value * v = resolve();
+      if (v == nullptr) return false;
+      if constexpr (std::is_same<T, String>::value || std::is_same<T, const char *>::value) return v->type == hostjson::Value::STRING;
+      if constexpr (std::is_same<T, bool>::value) return v->type == hostjson::Value::BOOL;
+      if constexpr (std::is_integral<T>::value) {
+        return v->type == hostjson::Value::INT
+          && v->i >= (int64_t)std::numeric_limits<T>::min()
+          && (v->i < 0 || (uint64_t)v->i <= (uint64_t)std::numeric_limits<T>::max());
+      }
+      if constexpr (std::is_floating_point<T>::value) return v->type == hostjson::Value::INT || v->type == hostjson::Value::FLOAT;
+      if constexpr (std::is_same<T, JsonObject>::value) return v->type == hostjson::Value::OBJECT;
+      if constexpr (std::is_same<T, JsonArray>::value) return v->type == hostjson::Value::ARRAY;
+      return false;
+    }
+
+    template<typename T> typename std::enable_if<std::is_same<T, String>::value, T>::type as() const {
+      hostjson::Value * v = resolve();
+      if (v == nullptr) return String();
+      if (v->type == hostjson::Value::STRING) return String(v->s);
+      std::string out;
+      hostjson::write(out, v);
+      return String(out);
+    }
+
+    template<typename T> typename std::enable_if<std::is_arithmetic<T>::value, T>::type as() const {
+      hostjson::Value * v = resolve();
+      if (v == nullptr) return T();
+      if (v->type == hostjson::Value::INT) return (T)v->i;
+      if (v->type == hostjson::Value::FLOAT) return (T)v->f;
+      if (v->type == hostjson::Value::BOOL) return (T)v->b;
+      return T();
+    }
+
+    template<typename T> T to() const {
+      hostjson::Value * v = create();
+      v->reset(std::is_same<T, JsonArray>::value ? hostjson::Value::ARRAY : hostjson::Value::OBJECT);
+      return T(v);
+    }
+
+    template<typename T> T add() const {
+      hostjson::Value * v = create();
+      if (v->type != hostjson::Value::ARRAY) v->reset(hostjson::Value::ARRAY);
+      v->items.emplace_back(new hostjson::Value());
+      hostjson::Value * item = v->items.back().get();
+      if (std::is_same<T, JsonObject>::value) item->reset(hostjson::Value::OBJECT);
+      if (std::is_same<T, JsonArray>::value) item->reset(hostjson::Value::ARRAY);
+      return T(item);
+    }
+
+    size_t size() const {
+      hostjson::Value * v = resolve();
+      if (v == nullptr) return 0;
+      return v->type == hostjson::Value::ARRAY ? v->items.size() : v->type == hostjson::Value::OBJECT ? v->members.size() : 0;
+    }
+
+    const JsonVariant & operator=(const char * value) const {
+      hostjson::Value * v = create();
+      v->reset(value ? hostjson::Value::STRING : hostjson::Value::NUL);
+      if (value) v->s = value;
+      return *this;
+    }
+    const JsonVariant & operator=(char * value) const { return *this = (const char *)value; }
+    const JsonVariant & operator=(const String & value) const { return *this = value.c_str(); }
+    const JsonVariant & operator=(bool value) const {
+      hostjson::Value * v = create();
+      v->reset(hostjson::Value::BOOL);
+      v->b = value;
+      return *this;
+    }
+    template<typename T>
+    typename std::enable_if<std::is_arithmetic<T>::value && !std::is_same<T, bool>::value, const JsonVariant &>::type
+    operator=(T value) const {
+      hostjson::Value * v = create();
+      if constexpr (std::is_floating_point<T>::value) {
+        v->reset(hostjson::Value::FLOAT);
+        v->f = value;
+      } else {
+        v->reset(hostjson::Value::INT);
+        v->i = (int64_t)value;
+      }
+      return *this;
+    }
+
+    hostjson::Value * value() const { return resolve(); }
+};
+
+class JsonObject : public JsonVariant {
+  public:
+    JsonObject() {}
+    JsonObject(hostjson::Value * v) : JsonVariant(v) {}
+    using JsonVariant::operator=;
+};
+
+class JsonArray : public JsonVariant {
+  public:
+    JsonArray() {}
+    JsonArray(hostjson::Value * v) : JsonVariant(v) {}
+};
+
+class JsonDocument : public JsonVariant {
+  protected:
+    std::unique_ptr<hostjson::Value> root;
+
+  public:
+    JsonDocument() : root(new hostjson::Value()) { base = root.get(); }
+    JsonDocument(const JsonDocument &) = delete;
+    JsonDocument & operator=(const JsonDocument &) = delete;
+
+    void clear() { root->reset(hostjson::Value::NUL); }
+};
+
+class DeserializationError {
+  public:
+    enum Code { Ok, EmptyInput, InvalidInput };
+
+  protected:
+    Code value;
+
+  public:
+    DeserializationError(Code value = Ok) : value(value) {}
+    Code code() const { return value; }
+    explicit operator bool() const { return value != Ok; }
+    const char * c_str() const {
+      return value == Ok ? "Ok" : value == EmptyInput ? "EmptyInput" : "InvalidInput";
+    }
+};
+
+inline DeserializationError deserializeJson(JsonDocument & doc, const char * input, size_t len) {
+  doc.clear();
+  if (input == nullptr || len == 0) return DeserializationError::EmptyInput;
+  hostjson::Parser parser(input, len);
+  if (!parser.value(*doc.value()) || !parser.done()) {
+    doc.clear();
+    return DeserializationError::InvalidInput;
+  }
+  return DeserializationError::Ok;
+}
+inline DeserializationError deserializeJson(JsonDocument & doc, const char * input) {
+  return deserializeJson(doc, input, input ? strlen(input) : 0);
+}
+inline DeserializationError deserializeJson(JsonDocument & doc, const String & input) {
+  return deserializeJson(doc, input.c_str(), input.length());
+}
+
+inline size_t measureJson(const JsonVariant & doc) {
+  std::string out;
+  hostjson::write(out, doc.value());
+  return out.size();
+}
+inline size_t serializeJson(const JsonVariant & doc, String & output) {
+  std::string out;
+  hostjson::write(out, doc.value());
+  output = String(out);
+  return out.size();
+}
+inline size_t serializeJson(const JsonVariant & doc, Print & output) {
+  std::string out;
+  hostjson::write(out, doc.value());
+  return output.write((const uint8_t *)out.data(), out.size());
+}
+inline size_t serializeJson(const JsonVariant & doc, char * output, size_t size) {
+  std::string out;
+  hostjson::write(out, doc.value());
+  if (size == 0) return 0;
+  size_t n = out.size() < size - 1 ? out.size() : size - 1;
+  memcpy(output, out.data(), n);
+  output[n] = 0;
+  return n;
+}
+
+#endif
@@ -0,0 +1,197 @@
+/**
+ * Wifi Manager - stand-in of the ESPAsyncWebServer for host builds
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * There is no socket, request() runs a request through the handlers like the
+ * AsyncTCP callbacks do: the body arrives in chunks, then the response is drained.
+**/
+#ifndef WIFIMANAGER_HOST_ESPASYNCWEBSERVER_h
+#define WIFIMANAGER_HOST_ESPASYNCWEBSERVER_h
+
+#include "Arduino.h"
+#include "host_http.h"
+#include <algorithm>
+#include <vector>
+
+typedef enum {
+  HTTP_GET = 0b00000001,
+  HTTP_POST = 0b00000010,
+  HTTP_DELETE = 0b00000100,
+  HTTP_PUT = 0b00001000,
+  HTTP_PATCH = 0b00010000,
+  HTTP_HEAD = 0b00100000,
+  HTTP_OPTIONS = 0b01000000,
+  HTTP_ANY = 0b01111111,
+} WebRequestMethod;
+typedef uint8_t WebRequestMethodComposite;
+
+typedef std::function<size_t(uint8_t * buffer, size_t maxLen, size_t index)> AwsResponseFiller;
+
+class AsyncWebServerResponse {
+  public:
+    int code = 200;
+    String contentType;
+    String content;
+    AwsResponseFiller filler;           // Set for chunked responses
+
+    virtual ~AsyncWebServerResponse() {}
+    void setCode(int value) { code = value; }
+    void setContentLength(size_t len) {}
+    void addHeader(const String & name, const String & value) {}
+};
+
+class AsyncResponseStream : public AsyncWebServerResponse, public Print {
+  public:
+    using Print::write;
+    size_t write(uint8_t c) override { return write(&c, 1); }
+    size_t write(const uint8_t * buffer, size_t size) override {
+      content += String(std::string((const char *)buffer, size));
+      return size;
+    }
+};
+
+class AsyncWebParameter {
+  protected:
+    String paramName;
+    String paramValue;
+
+  public:
+    AsyncWebParameter(const String & name, const String & value) : paramName(name), paramValue(value) {}
+    const String & name() const { return paramName; }
+    const String & value() const { return paramValue; }
+};
+
+class AsyncWebServerRequest {
+  protected:
+    String requestUrl;
+    WebRequestMethodComposite requestMethod;
+    std::vector<AsyncWebParameter> params;
+
+  public:
+    void * _tempObject = nullptr;
+    AsyncWebServerResponse * response = nullptr;
+
+    AsyncWebServerRequest(WebRequestMethodComposite method, const String & url, const hostHttpParams_t & args)
+      : requestUrl(url), requestMethod(method) {
+      for (auto & a : args) params.emplace_back(String(a.first), String(a.second));
+    }
+    ~AsyncWebServerRequest() {
+      free(_tempObject);
+      delete response;
+    }
+
+    const String & url() const { return requestUrl; }
+    WebRequestMethodComposite method() const { return requestMethod; }
+
+    bool hasParam(const String & name, bool post = false, bool file = false) const {
+      return getParam(name, post, file) != nullptr;
+    }
+    const AsyncWebParameter * getParam(const String & name, bool post = false, bool file = false) const {
+      for (auto & p : params) if (p.name() == name) return &p;
+      return nullptr;
+    }
+
+    void send(AsyncWebServerResponse * value) {
+      delete response;
+      response = value;
+    }
+    void send(int code, const String & type = String(), const String & content = String()) {
+      AsyncWebServerResponse * r = new AsyncWebServerResponse();
+      r->code = code;
+      r->contentType = type;
+      r->content = content;
+      send(r);
+    }
+    AsyncWebServerResponse * beginChunkedResponse(const String & type, AwsResponseFiller filler) {
+      AsyncWebServerResponse * r = new AsyncWebServerResponse();
+      r->contentType = type;
+      r->filler = filler;
+      return r;
+    }
+    AsyncResponseStream * beginResponseStream(const String & type, size_t bufferSize = 1460) {
+      AsyncResponseStream * r = new AsyncResponseStream();
+      r->contentType = type;
+      return r;
+    }
+};
+
+typedef std::function<void(AsyncWebServerRequest * request)> ArRequestHandlerFunction;
+
+class AsyncWebHandler {
+  public:
+    virtual ~AsyncWebHandler() {}
+    virtual bool canHandle(AsyncWebServerRequest * request) { return false; }
+    virtual void handleRequest(AsyncWebServerRequest * request) {}
+    virtual void handleUpload(AsyncWebServerRequest * request, const String & filename, size_t index, uint8_t * data, size_t len, bool final) {}
+    virtual void handleBody(AsyncWebServerRequest * request, uint8_t * data, size_t len, size_t index, size_t total) {}
+    virtual bool isRequestHandlerTrivial() { return true; }
+};
+
+class AsyncWebServer {
+  protected:
+    std::vector<AsyncWebHandler *> handlers;
+    ArRequestHandlerFunction notFound;
+
+  public:
+    AsyncWebServer(uint16_t port) {}
+
+    void begin() {}
+    AsyncWebHandler & addHandler(AsyncWebHandler * handler) {
+      handlers.push_back(handler);
+      return *handler;
+    }
+    bool removeHandler(AsyncWebHandler * handler) {
+      auto it = std::find(handlers.begin(), handlers.end(), handler);
+      if (it == handlers.end()) return false;
+      handlers.erase(it);
+      return true;
+    }
+    void onNotFound(ArRequestHandlerFunction fn) { notFound = fn; }
+    size_t handlerCount() const { return handlers.size(); }
+
+    // Run a request, the body is passed to the handler in pieces of chunkSize bytes
+    hostHttpResponse_t request(WebRequestMethodComposite method, const String & url,
+        const hostHttpParams_t & args = hostHttpParams_t(), const std::string & body = std::string(), size_t chunkSize = 512) {
+      AsyncWebServerRequest request(method, url, args);
+      AsyncWebHandler * handler = nullptr;
+      for (AsyncWebHandler * h : handlers) {
+        if (h->canHandle(&request)) {
+          handler = h;
+          break;
+        }
+      }
+      if (handler) {
+        if (!handler->isRequestHandlerTrivial()) {
+          for (size_t index = 0; index < body.size(); index += chunkSize) {
+            size_t len = std::min(chunkSize, body.size() - index);
+            handler->handleBody(&request, (uint8_t *)body.data() + index, len, index, body.size());
+          }
+        }
+        handler->handleRequest(&request);
+      } else if (notFound) notFound(&request);
+
+      hostHttpResponse_t result;
+      AsyncWebServerResponse * r = request.response;
+      if (r == nullptr) return result;
+      result.code = r->code;
+      result.type = r->contentType.c_str();
+      result.body = r->content.c_str();
+      if (r->filler) {
+        result.chunked = true;
+        uint8_t buffer[1460];
+        size_t len;
+        size_t index = 0;
+        while ((len = r->filler(buffer, sizeof(buffer), index)) > 0) {
+          result.body.append((const char *)buffer, len);
+          result.chunks++;
+          index += len;
+        }
+      }
+      return result;
+    }
+};
+
+#endif
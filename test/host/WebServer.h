@@ -0,0 +1,135 @@
+/**
+ * Wifi Manager - stand-in of the Arduino WebServer for host builds
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Follows the arduino-esp32 3.x API, removeHandler() only from 3.1.0 on. There is no socket, request() runs a request
+ * through the registered handlers like handleClient() does and returns the response.
+**/
+#ifndef WIFIMANAGER_HOST_WEBSERVER_h
+#define WIFIMANAGER_HOST_WEBSERVER_h
+
+#include "Arduino.h"
+#include "host_http.h"
+#include <algorithm>
+// Values match the http_parser methods used by arduino-esp32 3.x
+enum HTTPMethod { HTTP_DELETE = 0, HTTP_GET = 1, HTTP_HEAD = 2, HTTP_POST = 3, HTTP_PUT = 4, HTTP_PATCH = 28, HTTP_ANY = 255 };
+
+#define CONTENT_LENGTH_UNKNOWN ((size_t)-1)
+
+class WebServer;
+
+class RequestHandler {
+  public:
+    virtual ~RequestHandler() {}
+    virtual bool canHandle(HTTPMethod method, const String & uri) { return false; }
+    virtual bool handle(WebServer & server, HTTPMethod method, const String & uri) { return false; }
+};
+
+class WebServer {
+  public:
+    typedef std::function<void(void)> THandlerFunction;
+
+  protected:
+    // Route registered by on()
+    class FunctionHandler : public RequestHandler {
+      protected:
+        String uri;
+        HTTPMethod method;
+        THandlerFunction fn;
+
+      public:
+        FunctionHandler(const String & uri, HTTPMethod method, THandlerFunction fn) : uri(uri), method(method), fn(fn) {}
+        bool canHandle(HTTPMethod requestMethod, const String & requestUri) override {
+          return (method == HTTP_ANY || method == requestMethod) && uri == requestUri;
+        }
+        bool handle(WebServer & server, HTTPMethod requestMethod, const String & requestUri) override {
+          fn();
+          return true;
+        }
+    };
+
+    std::vector<RequestHandler *> handlers;
+    std::vector<std::unique_ptr<RequestHandler>> ownHandlers;
+    THandlerFunction notFound;
+
+    String currentUri;
+    HTTPMethod currentMethod = HTTP_GET;
+    hostHttpParams_t currentArgs;
+    hostHttpResponse_t response;
+    bool contentLengthUnknown = false;
+
+  public:
+    WebServer(int port = 80) {}
+
+    void begin() {}
+    void handleClient() {}
+
+    void on(const String & uri, HTTPMethod method, THandlerFunction fn) {
+      ownHandlers.emplace_back(new FunctionHandler(uri, method, fn));
+      handlers.push_back(ownHandlers.back().get());
+    }
+    void addHandler(RequestHandler * handler) { handlers.push_back(handler); }
+#if ESP_ARDUINO_VERSION >= ESP_ARDUINO_VERSION_VAL(3, 1, 0)
+    bool removeHandler(RequestHandler * handler) {
+      auto it = std::find(handlers.begin(), handlers.end(), handler);
+      if (it == handlers.end()) return false;
+      handlers.erase(it);
+      return true;
+    }
+#endif
+    void onNotFound(THandlerFunction fn) { notFound = fn; }
+    size_t handlerCount() const { return handlers.size(); }
+
+    String uri() { return currentUri; }
+    HTTPMethod method() { return currentMethod; }
+    int args() { return currentArgs.size(); }
+    String arg(int i) { return i < (int)currentArgs.size() ? String(currentArgs[i].second) : String(); }
+    String argName(int i) { return i < (int)currentArgs.size() ? String(currentArgs[i].first) : String(); }
+    String arg(const String & name) {
+      for (auto & a : currentArgs) if (name == a.first.c_str()) return String(a.second);
+      return String();
+    }
+    bool hasArg(const String & name) {
+      for (auto & a : currentArgs) if (name == a.first.c_str()) return true;
+      return false;
+    }
+    static String urlDecode(const String & text) { return text; }
+
+    void setContentLength(size_t len) { contentLengthUnknown = len == CONTENT_LENGTH_UNKNOWN; }
+    void sendHeader(const String & name, const String & value, bool first = false) {}
+    void send(int code, const char * type = nullptr, const String & content = String()) {
+      response.code = code;
+      response.type = type ? type : "";
+      response.chunked = contentLengthUnknown;
+      response.body.append(content.c_str(), content.length());
+    }
+    void send(int code, const String & type, const String & content) { send(code, type.c_str(), content); }
+    void sendContent(const char * content, size_t len) {
+      if (len > 0) response.chunks++;
+      response.body.append(content, len);
+    }
+    void sendContent(const String & content) { sendContent(content.c_str(), content.length()); }
+
+    // Run a request like handleClient(), a JSON body is passed as the argument "plain"
+    hostHttpResponse_t request(HTTPMethod method, const String & uri, const hostHttpParams_t & args = hostHttpParams_t()) {
+      currentMethod = method;
+      currentUri = uri;
+      currentArgs = args;
+      response = hostHttpResponse_t();
+      contentLengthUnknown = false;
+      bool handled = false;
+      for (RequestHandler * handler : handlers) {
+        if (handler->canHandle(method, uri) && handler->handle(*this, method, uri)) {
+          handled = true;
+          break;
+        }
+      }
+      if (!handled && notFound) notFound();
+      return response;
+    }
+};
+
+#endif
@@ -0,0 +1,168 @@
+/**
+ * Wifi Manager - stand-in of the ESP-IDF esp_http_server for host builds
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * A server is a HostHttpd, httpd_handle_t points to it. request() runs a request
+ * through the registered URI handlers like the httpd task does.
+**/
+#ifndef WIFIMANAGER_HOST_ESP_HTTP_SERVER_h
+#define WIFIMANAGER_HOST_ESP_HTTP_SERVER_h
+
+#include "host_http.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <algorithm>
+#include <string>
+#include <vector>
+
+typedef int esp_err_t;
+#define ESP_OK 0
+#define ESP_FAIL -1
+#define ESP_ERR_NOT_FOUND 0x105
+#define ESP_ERR_HTTPD_HANDLERS_FULL 0xb001
+#define HTTPD_SOCK_ERR_TIMEOUT -3
+#define HTTPD_RESP_USE_STRLEN -1
+
+enum http_method { HTTP_DELETE = 0, HTTP_GET = 1, HTTP_HEAD = 2, HTTP_POST = 3, HTTP_PUT = 4 };
+typedef enum http_method httpd_method_t;
+typedef void * httpd_handle_t;
+
+typedef struct httpd_req {
+  httpd_handle_t handle;
+  int method;
+  const char uri[513];
+  size_t content_len;
+  void * aux;
+  void * user_ctx;
+  void * sess_ctx;
+} httpd_req_t;
+
+typedef struct httpd_uri {
+  const char * uri;
+  httpd_method_t method;
+  esp_err_t (*handler)(httpd_req_t * r);
+  void * user_ctx;
+} httpd_uri_t;
+
+// State of a server and of the request it is running
+struct HostHttpd {
+  struct Handler {
+    std::string uri;
+    httpd_uri_t info;
+  };
+
+  size_t maxUriHandlers = 8;          // Default of HTTPD_DEFAULT_CONFIG()
+  size_t recvChunk = 0;               // Max bytes per httpd_req_recv(), 0 for unlimited
+  bool recvTimeouts = false;          // Every other httpd_req_recv() times out
+  std::vector<Handler> handlers;
+
+  std::string query;
+  std::string body;
+  size_t bodyPos = 0;
+  size_t recvCalls = 0;
+  hostHttpResponse_t response;
+
+  HostHttpd(size_t maxUriHandlers = 8) : maxUriHandlers(maxUriHandlers) {}
+  httpd_handle_t handle() { return this; }
+
+  hostHttpResponse_t request(httpd_method_t method, const std::string & uri, const std::string & q = std::string(), const std::string & b = std::string()) {
+    query = q;
+    body = b;
+    bodyPos = 0;
+    response = hostHttpResponse_t();
+    response.code = 200;
+    for (auto & h : handlers) {
+      if (h.uri != uri || h.info.method != method) continue;
+      httpd_req_t req = {};
+      req.handle = this;
+      req.method = method;
+      req.content_len = body.size();
+      req.user_ctx = h.info.user_ctx;
+      if (h.info.handler(&req) != ESP_OK) response.code = 500;
+      return response;
+    }
+    response.code = 404;
+    return response;
+  }
+};
+
+inline esp_err_t httpd_register_uri_handler(httpd_handle_t handle, const httpd_uri_t * uri_handler) {
+  HostHttpd * server = (HostHttpd *)handle;
+  if (server->handlers.size() >= server->maxUriHandlers) return ESP_ERR_HTTPD_HANDLERS_FULL;
+  server->handlers.push_back({ uri_handler->uri, *uri_handler });
+  return ESP_OK;
+}
+
+inline esp_err_t httpd_unregister_uri_handler(httpd_handle_t handle, const char * uri, httpd_method_t method) {
+  HostHttpd * server = (HostHttpd *)handle;
+  auto & handlers = server->handlers;
+  auto it = std::find_if(handlers.begin(), handlers.end(), [&](const HostHttpd::Handler & h) {
+    return h.uri == uri && h.info.method == method;
+  });
+  if (it == handlers.end()) return ESP_ERR_NOT_FOUND;
+  handlers.erase(it);
+  return ESP_OK;
+}
+
+inline size_t httpd_req_get_url_query_len(httpd_req_t * r) {
+  return ((HostHttpd *)r->handle)->query.size();
+}
+
+inline esp_err_t httpd_req_get_url_query_str(httpd_req_t * r, char * buf, size_t buf_len) {
+  const std::string & query = ((HostHttpd *)r->handle)->query;
+  if (query.empty()) return ESP_ERR_NOT_FOUND;
+  snprintf(buf, buf_len, "%s", query.c_str());
+  return ESP_OK;
+}
+
+// Values are returned undecoded like the ESP-IDF does
+inline esp_err_t httpd_query_key_value(const char * qry, const char * key, char * val, size_t val_size) {
+  std::string query = std::string("&") + qry + "&";
+  size_t pos = query.find(std::string("&") + key + "=");
+  if (pos == std::string::npos) return ESP_ERR_NOT_FOUND;
+  pos += strlen(key) + 2;
+  snprintf(val, val_size, "%s", query.substr(pos, query.find('&', pos) - pos).c_str());
+  return ESP_OK;
+}
+
+inline int httpd_req_recv(httpd_req_t * r, char * buf, size_t buf_len) {
+  HostHttpd * server = (HostHttpd *)r->handle;
+  if (server->recvTimeouts && server->recvCalls++ % 2 == 0) return HTTPD_SOCK_ERR_TIMEOUT;
+  size_t len = std::min(buf_len, server->body.size() - server->bodyPos);
+  if (server->recvChunk > 0) len = std::min(len, server->recvChunk);
+  memcpy(buf, server->body.data() + server->bodyPos, len);
+  server->bodyPos += len;
+  return len;
+}
+
+inline esp_err_t httpd_resp_set_status(httpd_req_t * r, const char * status) {
+  ((HostHttpd *)r->handle)->response.code = atoi(status);
+  return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_set_type(httpd_req_t * r, const char * type) {
+  ((HostHttpd *)r->handle)->response.type = type;
+  return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_send(httpd_req_t * r, const char * buf, ssize_t buf_len) {
+  HostHttpd * server = (HostHttpd *)r->handle;
+  server->response.body.append(buf, buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : buf_len);
+  return ESP_OK;
+}
+
+inline esp_err_t httpd_resp_send_chunk(httpd_req_t * r, const char * buf, ssize_t buf_len) {
+  HostHttpd * server = (HostHttpd *)r->handle;
+  server->response.chunked = true;
+  if (buf == nullptr || buf_len == 0) return ESP_OK;
+  size_t len = buf_len == HTTPD_RESP_USE_STRLEN ? strlen(buf) : buf_len;
+  server->response.body.append(buf, len);
+  server->response.chunks++;
+  return ESP_OK;
+}
+
+#endif
@@ -0,0 +1,11 @@
+/**
+ * Wifi Manager - globals of the Arduino core for host builds
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#include "Arduino.h"
+
+HardwareSerial Serial;
+EspClass ESP;
@@ -0,0 +1,71 @@
+/**
+ * Wifi Manager - API requests through the webserver stand-in of the backend
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Used by the tests and benchmarks that are built once per webserver backend.
+**/
+#ifndef WIFIMANAGER_HOST_API_h
+#define WIFIMANAGER_HOST_API_h
+
+#include "wifimanager.h"
+#include "host_http.h"
+#include <string>
+
+// Sends requests in the form of the configured webserver, the sync WebServer gets the body in one piece
+class ApiClient {
+  public:
+    size_t bodyChunk = 7;               // Max bytes of the request body per piece
+    bool recvTimeouts = true;           // esp_http_server only, every other receive times out
+
+#if IDF_WEBSERVER == true
+    HostHttpd server{WIFI_API_ROUTES};
+
+    void attach(WIFIMANAGER & wifi) { wifi.attachWebServer(server.handle()); }
+
+    hostHttpResponse_t get(const std::string & uri, const std::string & query = std::string()) {
+      return server.request(HTTP_GET, uri, query);
+    }
+    hostHttpResponse_t send(httpd_method_t method, const std::string & uri, const std::string & body) {
+      server.recvChunk = bodyChunk;
+      server.recvTimeouts = recvTimeouts;
+      return server.request(method, uri, std::string(), body);
+    }
+    hostHttpResponse_t post(const std::string & uri, const std::string & body) { return send(HTTP_POST, uri, body); }
+    hostHttpResponse_t del(const std::string & uri, const std::string & body) { return send(HTTP_DELETE, uri, body); }
+#elif ASYNC_WEBSERVER == true
+    AsyncWebServer server{80};
+
+    void attach(WIFIMANAGER & wifi) { wifi.attachWebServer(&server); }
+
+    hostHttpResponse_t get(const std::string & uri, const std::string & query = std::string()) {
+      hostHttpParams_t params;
+      size_t eq = query.find('=');
+      if (eq != std::string::npos) params.push_back({ query.substr(0, eq), query.substr(eq + 1) });
+      return server.request(HTTP_GET, uri.c_str(), params);
+    }
+    hostHttpResponse_t post(const std::string & uri, const std::string & body) { return server.request(HTTP_POST, uri.c_str(), {}, body, bodyChunk); }
+    hostHttpResponse_t del(const std::string & uri, const std::string & body) { return server.request(HTTP_DELETE, uri.c_str(), {}, body, bodyChunk); }
+#else
+    WebServer server{80};
+
+    void attach(WIFIMANAGER & wifi) { wifi.attachWebServer(&server); }
+
+    hostHttpResponse_t get(const std::string & uri, const std::string & query = std::string()) {
+      hostHttpParams_t params;
+      size_t eq = query.find('=');
+      if (eq != std::string::npos) params.push_back({ query.substr(0, eq), query.substr(eq + 1) });
+      return server.request(HTTP_GET, uri.c_str(), params);
+    }
+    hostHttpResponse_t post(const std::string & uri, const std::string & body) {
+      return server.request(HTTP_POST, uri.c_str(), body.empty() ? hostHttpParams_t() : hostHttpParams_t{ { "plain", body } });
+    }
+    hostHttpResponse_t del(const std::string & uri, const std::string & body) {
+      return server.request(HTTP_DELETE, uri.c_str(), { { "plain", body } });
+    }
+#endif
+};
+
+#endif
@@ -0,0 +1,81 @@
+/**
+ * Wifi Manager - measurements of the host benchmarks
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Include it in exactly one file of a benchmark, it replaces the global operator new
+ * and delete to count the heap allocations and to follow the bytes in use. Results are
+ * printed as one line per measurement with space separated key=value pairs.
+**/
+#ifndef WIFIMANAGER_HOST_BENCH_h
+#define WIFIMANAGER_HOST_BENCH_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <malloc.h>
+#include <atomic>
+#include <chrono>
+#include <new>
+
+static std::atomic<uint64_t> hostBenchAllocs{0};      // Number of heap allocations
+static std::atomic<uint64_t> hostBenchAllocBytes{0};  // Sum of the allocated bytes
+static std::atomic<int64_t> hostBenchLiveBytes{0};    // Bytes in use, as reported by malloc_usable_size()
+static std::atomic<int64_t> hostBenchPeakBytes{0};    // Maximum of hostBenchLiveBytes since the last start()
+
+void * operator new(size_t size) {
+  hostBenchAllocs++;
+  hostBenchAllocBytes += size;
+  void * p = malloc(size ? size : 1);
+  if (p == nullptr) throw std::bad_alloc();
+  int64_t live = hostBenchLiveBytes += malloc_usable_size(p);
+  int64_t peak = hostBenchPeakBytes;
+  while (live > peak && !hostBenchPeakBytes.compare_exchange_weak(peak, live)) {}
+  return p;
+}
+void * operator new[](size_t size) { return operator new(size); }
+void operator delete(void * p) noexcept {
+  if (p == nullptr) return;
+  hostBenchLiveBytes -= malloc_usable_size(p);
+  free(p);
+}
+void operator delete[](void * p) noexcept { operator delete(p); }
+void operator delete(void * p, size_t) noexcept { operator delete(p); }
+void operator delete[](void * p, size_t) noexcept { operator delete(p); }
+
+// Heap usage between start() and the calls of the other methods
+struct hostBenchHeap_t {
+  uint64_t allocs = 0;
+  uint64_t bytes = 0;
+  int64_t live = 0;
+
+  void start() {
+    allocs = hostBenchAllocs;
+    bytes = hostBenchAllocBytes;
+    live = hostBenchLiveBytes;
+    hostBenchPeakBytes = live;
+  }
+  uint64_t allocations() const { return hostBenchAllocs - allocs; }
+  uint64_t allocatedBytes() const { return hostBenchAllocBytes - bytes; }
+  // Most bytes in use at the same time on top of the ones in use at start()
+  uint64_t peakBytes() const { return hostBenchPeakBytes - live; }
+  // Bytes still in use that were not in use at start()
+  int64_t retainedBytes() const { return hostBenchLiveBytes - live; }
+};
+
+// Monotonic host time in nanoseconds
+inline uint64_t hostBenchNanos() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Number of iterations, can be lowered by the environment variable WIFIMANAGER_BENCH_SCALE (percent)
+inline uint32_t hostBenchIterations(uint32_t iterations) {
+  const char * scale = getenv("WIFIMANAGER_BENCH_SCALE");
+  if (scale == nullptr) return iterations;
+  uint64_t scaled = (uint64_t)iterations * atoi(scale) / 100;
+  return scaled > 0 ? scaled : 1;
+}
+
+#endif
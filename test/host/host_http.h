@@ -0,0 +1,27 @@
+/**
+ * Wifi Manager - responses captured by the webserver stand-ins of the host build
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_HOST_HTTP_h
+#define WIFIMANAGER_HOST_HTTP_h
+
+#include <stddef.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Response of a request to one of the webserver stand-ins
+struct hostHttpResponse_t {
+  int code = 0;                     // 0 if no handler answered
+  std::string type;                 // Content type
+  std::string body;                 // Complete body, the chunks are joined
+  bool chunked = false;             // Sent with chunked transfer encoding
+  size_t chunks = 0;                // Number of chunks, without the terminating one
+};
+
+typedef std::vector<std::pair<std::string, std::string>> hostHttpParams_t;
+
+#endif
@@ -0,0 +1,32 @@
+/**
+ * Wifi Manager - simulated HAL of the host tests and benchmarks
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Bundles the simulated clock, NVS, tasks and radio of wifimanager_hal_sim.h with the
+ * HAL pointing to them. Pass &hal to the WifiManager, script the RF environment through
+ * radio. Tests with a real clock or their own radio pass them as template arguments.
+**/
+#ifndef WIFIMANAGER_HOST_SIM_h
+#define WIFIMANAGER_HOST_SIM_h
+
+#include "wifimanager_hal_sim.h"
+
+template<typename C = WifiManagerVirtualClock, typename R = WifiManagerSimRadio> class HostSimHal {
+  public:
+    C clock;
+    WifiManagerSimStore store;
+    WifiManagerSimTasks tasks;
+    R radio{&clock};
+    WifiManagerHal hal = { &radio, &store, &clock, &tasks };
+
+    HostSimHal() {}
+    HostSimHal(const HostSimHal &) = delete;
+    HostSimHal & operator=(const HostSimHal &) = delete;
+};
+
+typedef HostSimHal<> HostSim;
+
+#endif
@@ -0,0 +1,26 @@
+/**
+ * Wifi Manager - assertions of the host tests
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_HOST_TEST_h
+#define WIFIMANAGER_HOST_TEST_h
+
+#include <stdio.h>
+
+static int hostTestFailures = 0;
+
+// Report a failed expectation and continue with the test
+#define EXPECT(condition) do { \
+  if (!(condition)) { \
+    fprintf(stderr, "%s:%d: expected %s\n", __FILE__, __LINE__, #condition); \
+    hostTestFailures++; \
+  } \
+} while (0)
+
+// Exit code of the test
+#define TEST_RESULT() (hostTestFailures == 0 ? 0 : 1)
+
+#endif
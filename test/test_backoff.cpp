@@ -0,0 +1,166 @@
+/**
+ * Wifi Manager - test of the reconnect backoff and the radio budget
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_api.h"
+#include "host_test.h"
+
+// Exposes the backoff state of the WifiManager
+class BackoffManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::scheduleBackoff;
+    using WIFIMANAGER::radioBudgetAvailable;
+    using WIFIMANAGER::backoffMillis;
+    using WIFIMANAGER::nextConnectMillis;
+};
+
+// Run the periodic check of the background task once
+static void checkOnce(HostSim & sim, BackoffManager & wifi) {
+  sim.clock.delay(15000);
+  wifi.loop();
+}
+
+// Request scan results through the API until a scan started by it completed
+static bool freshScan(HostSim & sim, ApiClient & client) {
+  bool started = false;
+  for (uint8_t i = 0; i < 3; i++) {
+    hostHttpResponse_t response = client.get("/api/wifi/scan");
+    if (response.code != 200) return false;
+    if (response.body.find("scanning") == std::string::npos) {
+      if (started) return true;
+      continue;   // results of an earlier scan
+    }
+    started = true;
+    sim.clock.delay(sim.radio.scanDurationMs);
+  }
+  return false;
+}
+
+int main() {
+  Serial.muted = true;
+
+  // The delay grows by the multiplier until the cap
+  {
+    HostSim sim;
+    BackoffManager wifi("growth", &sim.hal);
+    wifiBackoffConfig_t config;
+    config.initialMillis = 1000;
+    config.multiplierPercent = 300;
+    config.maxMillis = 20000;
+    config.jitterPercent = 0;
+    wifi.configureBackoff(config);
+
+    const uint32_t expected[] = { 1000, 3000, 9000, 20000, 20000 };
+    for (uint32_t delayMillis : expected) {
+      wifi.scheduleBackoff();
+      EXPECT(wifi.backoffMillis == delayMillis);
+      EXPECT(wifi.nextConnectMillis == sim.clock.millis() + delayMillis);
+    }
+
+    // a multiplier below 100% would shrink the delay
+    config.multiplierPercent = 50;
+    wifi.configureBackoff(config);
+    EXPECT(wifi.getBackoffConfig().multiplierPercent == 100);
+  }
+
+  // The jitter varies each delay within +/- jitterPercent
+  {
+    HostSim sim;
+    BackoffManager wifi("jitter", &sim.hal);
+    wifiBackoffConfig_t config;
+    config.initialMillis = 10000;
+    config.maxMillis = 10000;
+    config.jitterPercent = 20;
+    wifi.configureBackoff(config);
+
+    uint64_t minDelay = UINT64_MAX;
+    uint64_t maxDelay = 0;
+    for (uint16_t i = 0; i < 1000; i++) {
+      wifi.scheduleBackoff();
+      EXPECT(wifi.backoffMillis == 10000);
+      uint64_t delayMillis = wifi.nextConnectMillis - sim.clock.millis();
+      if (delayMillis < minDelay) minDelay = delayMillis;
+      if (delayMillis > maxDelay) maxDelay = delayMillis;
+    }
+    EXPECT(minDelay >= 8000 && maxDelay <= 12000);
+    EXPECT(minDelay < 8500 && maxDelay > 11500);
+  }
+
+  // Scanning for networks out of range stops when the radio budget of the window is used
+  {
+    HostSim sim;
+    BackoffManager wifi("budget", &sim.hal);
+    wifi.fallbackToSoftAp(false);
+    wifi.addWifi("office", "secret", false);
+    wifi.addWifi("home", "secret", false);
+    wifiBackoffConfig_t config;
+    config.initialMillis = 1000;
+    config.maxMillis = 1000;
+    config.jitterPercent = 0;
+    config.radioDutyPercent = 10;
+    config.dutyWindowMillis = 200000;
+    wifi.configureBackoff(config);
+
+    // each attempt scans for scanDurationMs, 10% of the window allows 10 of them
+    uint32_t budgetScans = config.radioDutyPercent * config.dutyWindowMillis / 100 / sim.radio.scanDurationMs;
+    while (sim.clock.millis() + 15000 < config.dutyWindowMillis) checkOnce(sim, wifi);
+    EXPECT(sim.radio.scans == budgetScans);
+    EXPECT(!wifi.radioBudgetAvailable());
+    EXPECT(wifi.getMetrics().radioActiveMillis >= config.radioDutyPercent * config.dutyWindowMillis / 100);
+
+    // the next window has a new budget
+    uint32_t scans = sim.radio.scans;
+    while (sim.clock.millis() < config.dutyWindowMillis) checkOnce(sim, wifi);
+    checkOnce(sim, wifi);
+    EXPECT(sim.radio.scans > scans);
+  }
+
+  // A scan seeing a known SSID ends the backoff
+  {
+    HostSim sim;
+    sim.radio.scanDurationMs = 100;
+    BackoffManager wifi("known", &sim.hal);
+    wifi.fallbackToSoftAp(false);
+    wifi.addWifi("office", "secret", false);
+    wifi.addWifi("home", "secret", false);
+    wifiBackoffConfig_t config;
+    config.initialMillis = 600000;
+    wifi.configureBackoff(config);
+
+    checkOnce(sim, wifi);
+    EXPECT(wifi.backoffMillis == config.initialMillis && wifi.nextConnectMillis > sim.clock.millis());
+
+    ApiClient client;
+    client.attach(wifi);
+
+    // other networks don't end it
+    simAccessPoint_t neighbour;
+    neighbour.ssid = "neighbour";
+    neighbour.bssid[5] = 1;
+    sim.radio.addAp(neighbour);
+    EXPECT(freshScan(sim, client));
+    uint32_t joins = sim.radio.joins;
+    checkOnce(sim, wifi);
+    EXPECT(wifi.backoffMillis == config.initialMillis && sim.radio.joins == joins);
+
+    // the office comes into range, the next run connects without waiting for the backoff
+    simAccessPoint_t office;
+    office.ssid = "office";
+    office.pass = "secret";
+    office.bssid[5] = 2;
+    sim.radio.addAp(office);
+    EXPECT(freshScan(sim, client));
+    checkOnce(sim, wifi);
+    EXPECT(wifi.getLinkState().gotIp);
+    EXPECT(wifi.backoffMillis == 0 && wifi.nextConnectMillis == 0);
+    wifi.detachWebServer();
+  }
+
+  return TEST_RESULT();
+}
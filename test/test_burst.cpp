@@ -0,0 +1,48 @@
+/**
+ * Wifi Manager - test of the burst mode
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_test.h"
+
+int main() {
+  HostSim sim;
+  Serial.muted = true;
+
+  simAccessPoint_t office;
+  office.ssid = "office";
+  office.pass = "secret";
+  sim.radio.addAp(office);
+
+  // Nothing configured, the radio stays off and no SoftAP is started
+  {
+    WIFIMANAGER wifi("burst", &sim.hal);
+    bool worked = false;
+    wifiBurstResult_t result = wifi.burst([&]() { worked = true; });
+    EXPECT(!result.connected && !worked);
+    EXPECT(sim.radio.scans == 0 && sim.radio.joins == 0);
+    EXPECT(!wifi.getLinkState().softApRunning);
+    EXPECT(sim.radio.softAPgetStationNum() == 0);
+  }
+
+  // The first burst scans and caches the connection, the second one uses the cache
+  {
+    WIFIMANAGER wifi("burst", &sim.hal);
+    wifi.addWifi("office", "secret");
+    wifi.addWifi("home", "secret");
+    bool worked = false;
+    wifiBurstResult_t result = wifi.burst([&]() { worked = true; });
+    EXPECT(result.connected && worked && !result.usedCache);
+    EXPECT(sim.radio.status() != WIFI_LINK_CONNECTED);
+
+    result = wifi.burst(nullptr);
+    EXPECT(result.connected && result.usedCache);
+    EXPECT(!wifi.getLinkState().softApRunning);
+  }
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,155 @@
+/**
+ * Wifi Manager - connection attempts of tryConnect() and tick() against scripted APs
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_test.h"
+#include <atomic>
+#include <thread>
+
+// Exposes the radio owner and the backoff
+class TickManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::radioOwner;
+    using WIFIMANAGER::nextConnectMillis;
+};
+
+// Call tick() like a scheduler does until the IP is received, returns the number of calls
+static uint32_t tickUntilConnected(WIFIMANAGER & wifi, WifiManagerVirtualClock & clock, uint32_t maxCalls = 1000) {
+  for (uint32_t calls = 1; calls <= maxCalls; calls++) {
+    uint32_t wait = wifi.tick();
+    if (wifi.getLinkState().gotIp) return calls;
+    clock.delay(wait);
+  }
+  return 0;
+}
+
+int main() {
+  HostSim sim;
+  Serial.muted = true;
+
+  simAccessPoint_t guest;
+  guest.ssid = "guest";
+  guest.pass = "guest-pass";
+  guest.rssi = -40;
+  guest.bssid[5] = 1;
+  sim.radio.addAp(guest);
+
+  simAccessPoint_t office;
+  office.ssid = "office";
+  office.pass = "office-pass";
+  office.rssi = -55;
+  office.bssid[5] = 2;
+  sim.radio.addAp(office);
+
+  {
+    WIFIMANAGER wifi("test", &sim.hal);
+    EXPECT(wifi.addWifi("guest", "guest-pass", true, 0));
+    EXPECT(wifi.addWifi("office", "office-pass", true, 5));
+  }
+
+  // The priority wins over the stronger signal, the configuration is read back from the NVS
+  {
+    WIFIMANAGER wifi("test", &sim.hal);
+    wifi.loadFromNVS();
+    EXPECT(wifi.tryConnect());
+
+    wifiLinkInfo_t link;
+    EXPECT(sim.radio.linkInfo(link));
+    EXPECT(strcmp(link.ssid, "office") == 0);
+    EXPECT(wifi.getMetrics().connectSuccess == 1);
+  }
+
+  // A wrong password fails without a connection
+  {
+    sim.radio.disconnect();
+    WIFIMANAGER wifi("other", &sim.hal);
+    wifi.addWifi("office", "wrong");
+    EXPECT(!wifi.tryConnect());
+    EXPECT(sim.radio.status() != WIFI_LINK_CONNECTED);
+  }
+
+  // tick() alone connects, scanning first as two networks are configured, and polls in between
+  {
+    sim.radio.disconnect();
+    TickManager wifi("tick", &sim.hal);
+    wifi.addWifi("guest", "guest-pass", true, 0);
+    wifi.addWifi("office", "office-pass", true, 5);
+    uint64_t start = sim.clock.millis();
+    EXPECT(wifi.tick() == WIFIMANAGER_TICK_POLL_MILLIS);
+    EXPECT(sim.radio.scans > 0);
+    EXPECT(tickUntilConnected(wifi, sim.clock) > 1);
+    EXPECT(sim.clock.millis() - start >= sim.radio.scanDurationMs + office.joinLatencyMs + office.dhcpLatencyMs);
+    wifiLinkInfo_t link;
+    EXPECT(sim.radio.linkInfo(link) && strcmp(link.ssid, "office") == 0);
+
+    // connected, the next deadline is the link sample or the check interval, whatever comes first
+    uint32_t wait = wifi.tick();
+    EXPECT(wait > 0 && wait <= 10000);
+    sim.clock.delay(wait);
+    EXPECT(wifi.tick() > 0);
+  }
+
+  // tick() returns at once while another task owns the radio
+  {
+    sim.radio.disconnect();
+    TickManager wifi("busy", &sim.hal);
+    wifi.addWifi("office", "office-pass");
+    std::atomic<int> phase{0};
+    std::thread owner([&]() {
+      WifiRadioGuard guard(wifi.radioOwner, WIFI_RADIO_PRIORITY_APPLICATION);
+      phase = 1;
+      while (phase == 1) std::this_thread::yield();
+    });
+    while (phase == 0) std::this_thread::yield();
+    uint32_t joins = sim.radio.joins, scans = sim.radio.scans;
+    uint64_t now = sim.clock.millis();
+    EXPECT(wifi.tick() == WIFIMANAGER_TICK_POLL_MILLIS);
+    EXPECT(sim.clock.millis() == now);
+    EXPECT(sim.radio.joins == joins && sim.radio.scans == scans);
+    phase = 2;
+    owner.join();
+    EXPECT(tickUntilConnected(wifi, sim.clock) > 0);
+  }
+
+  // Reading the configuration or the scan results in between does not void an attempt
+  {
+    sim.radio.disconnect();
+    TickManager wifi("read", &sim.hal);
+    wifi.addWifi("office", "office-pass");
+    EXPECT(wifi.tick() == WIFIMANAGER_TICK_POLL_MILLIS);
+    uint32_t joins = sim.radio.joins;
+    sim.clock.delay(WIFIMANAGER_TICK_POLL_MILLIS);
+    {
+      WifiRadioGuard guard(wifi.radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, WIFI_RADIO_READ);
+    }
+    wifi.addWifi("guest", "guest-pass", false);
+    EXPECT(tickUntilConnected(wifi, sim.clock) > 0);
+    EXPECT(sim.radio.joins == joins);
+    EXPECT(wifi.nextConnectMillis == 0);
+  }
+
+  // A change of the radio by another task cancels the attempt, the association is stopped and backed off
+  {
+    sim.radio.disconnect();
+    TickManager wifi("change", &sim.hal);
+    wifi.addWifi("office", "office-pass");
+    EXPECT(wifi.tick() == WIFIMANAGER_TICK_POLL_MILLIS);
+    sim.clock.delay(WIFIMANAGER_TICK_POLL_MILLIS);
+    {
+      WifiRadioGuard guard(wifi.radioOwner, WIFI_RADIO_PRIORITY_APPLICATION);
+    }
+    wifi.tick();
+    EXPECT(wifi.nextConnectMillis > sim.clock.millis());
+    sim.clock.delay(office.joinLatencyMs + office.dhcpLatencyMs + sim.radio.scanDurationMs);
+    EXPECT(sim.radio.status() != WIFI_LINK_CONNECTED);
+    EXPECT(!wifi.getLinkState().gotIp);
+  }
+
+  return TEST_RESULT();
+}
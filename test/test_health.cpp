@@ -0,0 +1,133 @@
+/**
+ * Wifi Manager - test of the connectivity health checks
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_test.h"
+
+// Exposes the blacklist of the WifiManager
+class HealthManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::isBlocked;
+    using WIFIMANAGER::apList;
+};
+
+// Run the periodic check of the background task once
+static void checkOnce(HostSim & sim, HealthManager & wifi) {
+  sim.clock.delay(15000);
+  wifi.loop();
+}
+
+int main() {
+  HostSim sim;
+  Serial.muted = true;
+
+  simAccessPoint_t office;
+  office.ssid = "office";
+  office.pass = "secret";
+  office.rssi = -40;
+  office.channel = 1;
+  office.bssid[5] = 1;
+  office.probeLatencyMs = 35;
+  size_t officeAp = sim.radio.addAp(office);
+
+  simAccessPoint_t backup;
+  backup.ssid = "backup";
+  backup.pass = "secret";
+  backup.rssi = -70;
+  backup.channel = 11;
+  backup.bssid[5] = 2;
+  sim.radio.addAp(backup);
+
+  HealthManager wifi("health", &sim.hal);
+  wifi.addWifi("office", "secret", false);
+  wifi.addWifi("backup", "secret", false);
+  wifiHealthConfig_t config;
+  config.intervalMillis = 1000;
+  config.dnsHost = "example.com";
+  config.httpUrl = "http://192.168.0.2/generate_204";
+  wifi.configureHealthCheck(config);
+  EXPECT(wifi.tryConnect());
+  wifiLinkInfo_t link;
+  EXPECT(sim.radio.linkInfo(link) && strcmp(link.ssid, "office") == 0);
+
+  // All probes answer, their latency is the round trip time of the AP
+  checkOnce(sim, wifi);
+  EXPECT(wifi.getHealth().checks == 1 && wifi.getHealth().healthy);
+  EXPECT(wifi.getHealth().gateway.runs == 1 && wifi.getHealth().gateway.lastLatencyMillis == 35);
+  EXPECT(wifi.getHealth().gateway.avgLatencyMillis == 35);
+  EXPECT(wifi.getHealth().dns.lastLatencyMillis == 35);
+  EXPECT(wifi.getHealth().http.lastLatencyMillis == 35);
+
+  // A slower AP moves the average towards the new latency
+  sim.radio.accessPoints[officeAp].probeLatencyMs = 115;
+  checkOnce(sim, wifi);
+  EXPECT(wifi.getHealth().gateway.lastLatencyMillis == 115);
+  EXPECT(wifi.getHealth().gateway.avgLatencyMillis == (35 * 7 + 115) / 8);
+
+  // A captive portal answers the HTTP probe with another status code
+  sim.radio.httpServer = [](const std::string & url) { return (uint16_t)302; };
+  checkOnce(sim, wifi);
+  EXPECT(!wifi.getHealth().healthy && wifi.getHealth().consecutiveFailures == 1);
+  EXPECT(wifi.getHealth().gateway.failures == 0 && wifi.getHealth().dns.failures == 0);
+  EXPECT(wifi.getHealth().http.failures == 1 && wifi.getHealth().http.lastLatencyMillis == WIFI_PROBE_FAILED);
+  EXPECT(wifi.getHealth().actions == 0);
+
+  // The expected status recovers the connection
+  sim.radio.httpServer = [](const std::string & url) { return (uint16_t)204; };
+  checkOnce(sim, wifi);
+  EXPECT(wifi.getHealth().healthy && wifi.getHealth().consecutiveFailures == 0);
+
+  // Without uplink the DNS probe fails, the threshold fails over to the other network
+  sim.radio.accessPoints[officeAp].uplink = false;
+  for (uint8_t i = 0; i < config.failureThreshold; i++) {
+    EXPECT(sim.radio.linkInfo(link) && strcmp(link.ssid, "office") == 0);
+    checkOnce(sim, wifi);
+  }
+  EXPECT(wifi.getHealth().actions == 1);
+  EXPECT(wifi.getHealth().dns.failures == config.failureThreshold);
+  EXPECT(wifi.getHealth().gateway.failures == 0);
+  EXPECT(wifi.apList[0].block.failure == WIFI_FAILURE_NO_UPLINK);
+  wifiCandidate_t broken = wifiCandidate_t();
+  broken.apId = 0;
+  EXPECT(wifi.isBlocked(broken));
+
+  // The reconnect selects the other network although the broken one is stronger
+  for (uint8_t i = 0; i < 10 && !(sim.radio.linkInfo(link) && wifi.getLinkState().gotIp); i++) {
+    checkOnce(sim, wifi);
+  }
+  EXPECT(sim.radio.linkInfo(link) && strcmp(link.ssid, "backup") == 0);
+
+  // With a single network the failover reconnects to the same one
+  {
+    HostSim single;
+    simAccessPoint_t ap = office;
+    ap.uplink = false;
+    single.radio.addAp(ap);
+
+    HealthManager wifi("single", &single.hal);
+    wifi.addWifi("office", "secret", false);
+    wifi.configureHealthCheck(config);
+    EXPECT(wifi.tryConnect());
+    uint32_t joins = single.radio.joins;
+    for (uint8_t i = 0; i < config.failureThreshold; i++) {
+      single.clock.delay(15000);
+      wifi.loop();
+    }
+    EXPECT(wifi.getHealth().actions == 1);
+    EXPECT(wifi.apList[0].block.failure != WIFI_FAILURE_NO_UPLINK);
+    for (uint8_t i = 0; i < 10 && single.radio.joins == joins; i++) {
+      single.clock.delay(15000);
+      wifi.loop();
+    }
+    EXPECT(single.radio.joins > joins);
+    EXPECT(single.radio.linkInfo(link) && strcmp(link.ssid, "office") == 0);
+  }
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,141 @@
+/**
+ * Wifi Manager - test of the RESTful API through the webserver adapters
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Built once per webserver backend, the requests run through the stand-in of the
+ * server in test/host like they arrive from the network.
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_api.h"
+#include "host_test.h"
+#include <atomic>
+#include <thread>
+
+// Exposes the radio owner, to use the API while the radio is busy
+class HttpManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::radioOwner;
+};
+
+static bool contains(const hostHttpResponse_t & response, const char * text) {
+  return response.body.find(text) != std::string::npos;
+}
+
+// The body is valid JSON, returns the number of elements of the top level
+static size_t jsonSize(const hostHttpResponse_t & response) {
+  JsonDocument doc;
+  if (deserializeJson(doc, response.body.c_str())) return (size_t)-1;
+  return doc.size();
+}
+
+int main() {
+  HostSim sim;
+  Serial.muted = true;
+
+  simAccessPoint_t office;
+  office.ssid = "office";
+  office.pass = "secret";
+  office.rssi = -50;
+  sim.radio.addAp(office);
+  simAccessPoint_t neighbour;
+  neighbour.ssid = "neighbour";
+  neighbour.rssi = -70;
+  neighbour.bssid[5] = 2;
+  sim.radio.addAp(neighbour);
+
+  HttpManager wifi("http", &sim.hal);
+  ApiClient client;
+  client.attach(wifi);
+
+  // Adding a network, the body is collected from several pieces
+  hostHttpResponse_t response = client.post("/api/wifi/add", "{\"apName\":\"office\",\"apPass\":\"secret\",\"priority\":3,\"minRssi\":-80}");
+  EXPECT(response.code == 200);
+  EXPECT(response.type == "application/json");
+  EXPECT(client.post("/api/wifi/add", "{\"apName\":\"lab\",\"apPass\":\"secret\",\"priority\":300}").code == 422);
+  EXPECT(client.post("/api/wifi/add", "").code == 400);
+  EXPECT(client.post("/api/wifi/add", "{\"apName\":\"" + std::string(WIFIMANAGER_HTTP_MAX_BODY, 'x') + "\"}").code == 400);
+
+  // The list is streamed in chunks
+  response = client.get("/api/wifi/configlist");
+  EXPECT(response.code == 200);
+  EXPECT(response.chunked);
+  EXPECT(jsonSize(response) == 1);
+  EXPECT(contains(response, "\"apName\":\"office\""));
+  EXPECT(contains(response, "\"priority\":3"));
+  EXPECT(contains(response, "\"apPass\":true"));
+
+  // The status document is serialized into the response, in chunks unless the server buffers a stream response
+  EXPECT(wifi.tryConnect());
+  response = client.get("/api/wifi/status");
+  EXPECT(response.code == 200);
+  EXPECT(response.type == "application/json");
+#if IDF_WEBSERVER == true || ASYNC_WEBSERVER == false
+  EXPECT(response.chunked);
+#endif
+  EXPECT(jsonSize(response) != (size_t)-1);
+  EXPECT(contains(response, "\"powerPolicy\""));
+
+  // The first request starts the scan, the field list is decoded
+  sim.radio.scanDelete();
+  response = client.get("/api/wifi/scan");
+  EXPECT(response.code == 200 && contains(response, "scanning"));
+  sim.clock.delay(sim.radio.scanDurationMs);
+#if IDF_WEBSERVER == true
+  response = client.get("/api/wifi/scan", "fields=ssid%2Crssi");
+#else
+  response = client.get("/api/wifi/scan", "fields=ssid,rssi");
+#endif
+  EXPECT(response.code == 200);
+  EXPECT(jsonSize(response) == 2);
+  EXPECT(contains(response, "\"ssid\":\"office\""));
+  EXPECT(contains(response, "\"rssi\":-70"));
+  EXPECT(!contains(response, "\"channel\""));
+  // the records were copied, the scan list of the radio is released before the response is streamed
+  EXPECT(sim.radio.scanComplete() == WIFI_RADIO_SCAN_FAILED);
+
+  // While another task owns the radio the API answers right away
+  wifi.setPowerPolicy(WIFI_POWER_ADAPTIVE);
+  EXPECT(sim.radio.powerSave == WIFI_POWER_SAVE_MIN_MODEM);
+  {
+    std::atomic<int> phase{0};
+    std::thread owner([&]() {
+      WifiRadioGuard guard(wifi.radioOwner, WIFI_RADIO_PRIORITY_BACKGROUND);
+      phase = 1;
+      while (phase == 1) std::this_thread::yield();
+    });
+    while (phase == 0) std::this_thread::yield();
+    EXPECT(client.get("/api/wifi/configlist").code == 503);
+    EXPECT(client.post("/api/wifi/add", "{\"apName\":\"lab\",\"apPass\":\"secret\"}").code == 503);
+    EXPECT(client.post("/api/wifi/softap/start", "").code == 202);
+    EXPECT(client.get("/api/wifi/status").code == 200);
+    EXPECT(sim.radio.powerSave == WIFI_POWER_SAVE_MIN_MODEM);
+    phase = 2;
+    owner.join();
+  }
+  // the queued request and the end of the modem sleep are applied by the next loop()
+  EXPECT(!wifi.getLinkState().softApRunning);
+  wifi.loop();
+  EXPECT(wifi.getLinkState().softApRunning);
+  EXPECT(sim.radio.powerSave == WIFI_POWER_SAVE_NONE);
+
+  response = client.del("/api/wifi/apName", "{\"apName\":\"office\"}");
+  EXPECT(response.code == 200);
+  EXPECT(jsonSize(client.get("/api/wifi/configlist")) == 0);
+
+  // Nothing is left behind in the server, or a handler that does not answer without removeHandler()
+  wifi.detachWebServer();
+#if IDF_WEBSERVER == true
+  EXPECT(client.server.handlers.empty());
+#elif ASYNC_WEBSERVER == false && WIFIMANAGER_REMOVE_HANDLER == false
+  EXPECT(client.server.handlerCount() == 1);
+  EXPECT(client.get("/api/wifi/status").code == 0);
+#else
+  EXPECT(client.server.handlerCount() == 0);
+#endif
+  return TEST_RESULT();
+}
@@ -0,0 +1,136 @@
+/**
+ * Wifi Manager - test of the static IP and the reuse of the last lease
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_test.h"
+
+// Records the IP configurations given to the radio
+class ConfigRadio : public WifiManagerSimRadio {
+  public:
+    using WifiManagerSimRadio::WifiManagerSimRadio;
+    std::vector<wifiIpConfig_t> configs;
+
+    void config(uint32_t ip, uint32_t gateway, uint32_t netmask, uint32_t dns) override {
+      wifiIpConfig_t config;
+      config.ip = ip;
+      config.gateway = gateway;
+      config.netmask = netmask;
+      config.dns = dns;
+      configs.push_back(config);
+      WifiManagerSimRadio::config(ip, gateway, netmask, dns);
+    }
+};
+
+// Exposes the stored IP configuration of the networks
+class IpManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::apList;
+};
+
+int main() {
+  HostSimHal<WifiManagerVirtualClock, ConfigRadio> sim;
+  Serial.muted = true;
+
+  simAccessPoint_t office;
+  office.ssid = "office";
+  office.pass = "secret";
+  office.bssid[5] = 1;
+  sim.radio.addAp(office);
+
+  simAccessPoint_t home;
+  home.ssid = "home";
+  home.pass = "secret";
+  home.rssi = -50;
+  home.bssid[5] = 2;
+  sim.radio.addAp(home);
+
+  // A static address is given to the radio before the connection
+  {
+    wifiIpConfig_t staticIp;
+    staticIp.mode = WIFI_IP_STATIC;
+    staticIp.ip = 0x3200A8C0;       // 192.168.0.50
+    staticIp.gateway = office.gateway;
+    staticIp.netmask = 0x00FFFFFF;
+    staticIp.dns = office.gateway;
+
+    IpManager wifi("static", &sim.hal);
+    EXPECT(wifi.addWifi("office", "secret", true, WIFIMANAGER_DEFAULT_PRIORITY, WIFIMANAGER_NO_RSSI_FLOOR, staticIp));
+    EXPECT(wifi.tryConnect());
+    EXPECT(sim.radio.configs.size() == 1);
+    EXPECT(sim.radio.configs.back().ip == staticIp.ip);
+    EXPECT(sim.radio.configs.back().gateway == staticIp.gateway);
+    EXPECT(sim.radio.configs.back().netmask == staticIp.netmask);
+    EXPECT(wifi.getLinkState().ip == staticIp.ip);
+    EXPECT(wifi.getMetrics().ipModeConnects[WIFI_IP_STATIC] == 1);
+    EXPECT(wifi.apList[0].ipConfig.ip == staticIp.ip);
+    sim.radio.disconnect();
+  }
+
+  // A stale lease of another network doesn't reach the gateway, a new lease is requested
+  sim.radio.configs.clear();
+  {
+    wifiIpConfig_t lease;
+    lease.mode = WIFI_IP_LAST_LEASE;
+    lease.ip = 0x3200000A;          // 10.0.0.50
+    lease.gateway = 0x0100000A;     // 10.0.0.1
+    lease.netmask = 0x00FFFFFF;
+    lease.dns = lease.gateway;
+
+    IpManager wifi("lease", &sim.hal);
+    EXPECT(wifi.addWifi("home", "secret", true, WIFIMANAGER_DEFAULT_PRIORITY, WIFIMANAGER_NO_RSSI_FLOOR, lease));
+    uint32_t probes = sim.radio.probes;
+    EXPECT(wifi.tryConnect());
+    EXPECT(sim.radio.probes == probes + 1);
+    EXPECT(sim.radio.configs.size() == 2);
+    EXPECT(sim.radio.configs[0].ip == lease.ip);
+    EXPECT(sim.radio.configs[1].ip == 0 && sim.radio.configs[1].gateway == 0);
+
+    // the DHCP lease of the sim replaces the stale one
+    uint32_t dhcpIp = 0x6400A8C0 + (1UL << 24);
+    EXPECT(wifi.getLinkState().ip == dhcpIp);
+    EXPECT(wifi.getMetrics().ipModeConnects[WIFI_IP_DHCP] == 1);
+    EXPECT(wifi.apList[0].ipConfig.mode == WIFI_IP_LAST_LEASE);
+    EXPECT(wifi.apList[0].ipConfig.ip == dhcpIp);
+    EXPECT(wifi.apList[0].ipConfig.gateway == home.gateway);
+    sim.radio.disconnect();
+  }
+
+  // The renewed lease is loaded from the NVS and reused without the DHCP
+  sim.radio.configs.clear();
+  {
+    IpManager wifi("lease", &sim.hal);
+    EXPECT(wifi.loadFromNVS());
+    EXPECT(wifi.tryConnect());
+    EXPECT(sim.radio.configs.size() == 1);
+    EXPECT(sim.radio.configs[0].ip == 0x6400A8C0 + (1UL << 24));
+    EXPECT(wifi.getMetrics().ipModeConnects[WIFI_IP_LAST_LEASE] == 1);
+  }
+
+  // A network without the gateway answering falls back to the DHCP as well
+  sim.radio.configs.clear();
+  sim.radio.disconnect();
+  {
+    wifiIpConfig_t lease;
+    lease.mode = WIFI_IP_LAST_LEASE;
+    lease.ip = 0x3200A8C0;
+    lease.gateway = home.gateway;
+    lease.netmask = 0x00FFFFFF;
+
+    HostSimHal<WifiManagerVirtualClock, ConfigRadio> silent;
+    home.gatewayResponds = false;
+    silent.radio.addAp(home);
+    IpManager wifi("silent", &silent.hal);
+    EXPECT(wifi.addWifi("home", "secret", true, WIFIMANAGER_DEFAULT_PRIORITY, WIFIMANAGER_NO_RSSI_FLOOR, lease));
+    EXPECT(wifi.tryConnect());
+    EXPECT(silent.radio.configs.size() == 2 && silent.radio.configs[1].ip == 0);
+    EXPECT(wifi.getLinkState().ip == 0x6400A8C0);
+  }
+
+  return TEST_RESULT();
+}
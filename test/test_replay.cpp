@@ -0,0 +1,78 @@
+/**
+ * Wifi Manager - test of the trace replay
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#include "wifimanager_replay.h"
+#include "host_sim.h"
+#include "host_test.h"
+
+// Export of /trace
+static std::vector<uint8_t> exportTrace(WIFIMANAGER & wifi, uint32_t nowMicros) {
+  std::vector<uint8_t> data;
+  WifiTraceStream stream(wifi.getTrace(), nowMicros);
+  uint8_t buffer[256];
+  size_t len;
+  while ((len = stream.fill(buffer, sizeof(buffer))) > 0) data.insert(data.end(), buffer, buffer + len);
+  return data;
+}
+
+int main() {
+  Serial.muted = true;
+
+  // A trace recorded in the simulation replays to the same decisions
+  {
+    HostSim sim;
+    simAccessPoint_t office;
+    office.ssid = "office";
+    office.pass = "secret";
+    office.bssid[5] = 1;
+    sim.radio.addAp(office);
+
+    WIFIMANAGER wifi("device", &sim.hal);
+    wifi.addWifi("office", "secret");
+    wifi.addWifi("home", "secret");
+    wifi.startBackgroundTask();
+    sim.clock.runPeriodic([&]() { wifi.loop(); }, 10000, 600000);
+    std::vector<uint8_t> trace = exportTrace(wifi, sim.clock.micros());
+
+    WifiManagerReplay replay;
+    EXPECT(replay.load(trace.data(), trace.size()));
+    replay.addNetwork("office", "secret");
+    replay.addNetwork("home", "secret");
+    wifiReplayReport_t report = replay.run();
+    EXPECT(report.recorded.size() == 1);
+    EXPECT(!report.overran);
+    EXPECT(!report.diverged);
+  }
+
+  // The start of the replay takes longer than the whole trace of half a second
+  {
+    std::vector<uint8_t> trace(WIFIMANAGER_TRACE_HEADER_SIZE, 0);
+    memcpy(trace.data(), "WMTR", 4);
+    trace[4] = WIFIMANAGER_TRACE_VERSION;
+    trace[5] = WIFIMANAGER_TRACE_RECORD_SIZE;
+    for (uint32_t seq = 1; seq <= 2; seq++) {
+      uint8_t record[WIFIMANAGER_TRACE_RECORD_SIZE] = { 0 };
+      uint32_t micros = (seq - 1) * 500000;
+      record[0] = seq;
+      memcpy(record + 4, &micros, sizeof(micros));
+      record[8] = WIFI_TRACE_START;
+      record[9] = 1;
+      trace.insert(trace.end(), record, record + sizeof(record));
+    }
+
+    // the AP is never seen, the failed connection attempt alone takes longer than the trace
+    WifiManagerReplay replay;
+    replay.loopMillis = 1000;
+    EXPECT(replay.load(trace.data(), trace.size()));
+    replay.addNetwork("office", "secret");
+    wifiReplayReport_t report = replay.run();
+    EXPECT(report.overran);
+    EXPECT(report.diverged);
+  }
+
+  return TEST_RESULT();
+}
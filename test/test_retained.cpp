@@ -0,0 +1,83 @@
+/**
+ * Wifi Manager - test of the connection state kept during deep sleep
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_test.h"
+
+// Exposes the retained state of the WifiManager
+class RetainedManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::restoreRetainedState;
+    using WIFIMANAGER::apListPartial;
+    using WIFIMANAGER::configuredSSIDs;
+};
+
+int main() {
+  HostSim sim;
+  Serial.muted = true;
+
+  simAccessPoint_t office;
+  office.ssid = "office";
+  office.pass = "secret";
+  office.channel = 6;
+  office.bssid[5] = 1;
+  sim.radio.addAp(office);
+
+  // The first burst scans, the connection is kept in the retained memory
+  {
+    RetainedManager wifi("device", &sim.hal);
+    wifi.addWifi("office", "secret");
+    wifi.addWifi("home", "secret");
+    EXPECT(!wifi.restoreRetainedState());
+    EXPECT(wifi.burst(nullptr).connected);
+  }
+  wifiRetainedState_t state;
+  memcpy(&state, sim.store.retained.data(), sizeof(state));
+  EXPECT(state.magic == WIFIMANAGER_RETAINED_MAGIC);
+  EXPECT(strcmp(state.apName, "office") == 0);
+  EXPECT(state.cache.channel == 6);
+
+  // After the deep sleep the cached network connects without the NVS and without a scan
+  std::map<std::string, std::string> nvs = sim.store.data["device"];
+  sim.store.data.erase("device");
+  {
+    RetainedManager wifi("device", &sim.hal);
+    EXPECT(wifi.restoreRetainedState());
+    EXPECT(wifi.apListPartial && wifi.configuredSSIDs == 1);
+    uint32_t scans = sim.radio.scans;
+    wifiBurstResult_t result = wifi.burst(nullptr);
+    EXPECT(result.connected && result.usedCache);
+    EXPECT(sim.radio.scans == scans);
+  }
+  sim.store.data["device"] = nvs;
+
+  // Another namespace doesn't use the state of this one
+  {
+    RetainedManager wifi("other", &sim.hal);
+    EXPECT(!wifi.restoreRetainedState());
+  }
+
+  // A damaged password is rejected by the checksum, the configuration comes from the NVS again
+  sim.store.retained[offsetof(wifiRetainedState_t, apPass)] ^= 0x20;
+  {
+    RetainedManager wifi("device", &sim.hal);
+    EXPECT(!wifi.restoreRetainedState());
+    EXPECT(wifi.burst(nullptr).connected);
+    EXPECT(!wifi.apListPartial && wifi.configuredSSIDs == 2);
+  }
+
+  // A power loss clears the retained memory
+  std::fill(sim.store.retained.begin(), sim.store.retained.end(), 0);
+  {
+    RetainedManager wifi("device", &sim.hal);
+    EXPECT(!wifi.restoreRetainedState());
+  }
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,76 @@
+/**
+ * Wifi Manager - test of roaming away from a weak AP
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_test.h"
+
+// Exposes the blacklist of the WifiManager
+class RoamManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::isBlocked;
+};
+
+int main() {
+  HostSim sim;
+  Serial.muted = true;
+
+  // An empty history has no buckets
+  {
+    WifiLinkQuality empty;
+    wifiLinkBucket_t bucket;
+    EXPECT(empty.buckets(0) == 0);
+    empty.bucket(0, 0, bucket);
+    empty.bucket(5, 10, bucket);
+    EXPECT(bucket.samples == 0);
+  }
+
+  simAccessPoint_t near;
+  near.ssid = "office";
+  near.pass = "secret";
+  near.rssi = -50;
+  near.channel = 6;
+  near.bssid[5] = 1;
+  size_t nearAp = sim.radio.addAp(near);
+
+  simAccessPoint_t far = near;
+  far.rssi = -65;
+  far.channel = 11;
+  far.bssid[5] = 2;
+  sim.radio.addAp(far);
+
+  RoamManager wifi("roam", &sim.hal);
+  wifi.addWifi("office", "secret", false, WIFIMANAGER_DEFAULT_PRIORITY, -75);
+  EXPECT(wifi.tryConnect());
+  wifiLinkInfo_t link;
+  EXPECT(sim.radio.linkInfo(link) && link.bssid[5] == 1);
+
+  // The nearest AP fades, the smoothed RSSI drops below the minimum
+  sim.radio.accessPoints[nearAp].rssi = -90;
+  for (uint8_t i = 0; i < 20 && link.bssid[5] == 1; i++) {
+    sim.clock.delay(10000);
+    wifi.loop();
+    if (!sim.radio.linkInfo(link)) link.bssid[5] = 0;
+  }
+
+  wifiCandidate_t weak = wifiCandidate_t();
+  weak.apId = 0;
+  weak.channel = near.channel;
+  memcpy(weak.bssid, near.bssid, sizeof(weak.bssid));
+  EXPECT(wifi.isBlocked(weak));
+  EXPECT(wifi.getLinkQuality().size() <= 1);
+
+  // The reconnect selects the other AP although the faded one is still in range
+  for (uint8_t i = 0; i < 10 && !(sim.radio.linkInfo(link) && wifi.getLinkState().gotIp); i++) {
+    sim.clock.delay(10000);
+    wifi.loop();
+  }
+  EXPECT(sim.radio.linkInfo(link) && link.bssid[5] == 2);
+
+  return TEST_RESULT();
+}
@@ -0,0 +1,130 @@
+/**
+ * Wifi Manager - concurrent use from several tasks
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Threads call loop(), tick(), tryConnect(), burst(), the SoftAP and client control,
+ * change the configuration and use the API at the same time, against the simulated
+ * radio with a real clock. After every operation of the control threads the SoftAP
+ * state of the WifiManager has to match the radio. Configure with -DWIFIMANAGER_TSAN=ON
+ * to run it under ThreadSanitizer.
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_test.h"
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#ifndef STRESS_SECONDS
+#define STRESS_SECONDS 2
+#endif
+
+// Exposes the radio mode of the simulation
+class StressRadio : public WifiManagerSimRadio {
+  public:
+    using WifiManagerSimRadio::WifiManagerSimRadio;
+    bool softApMode() { return mode == WIFI_RADIO_AP || mode == WIFI_RADIO_AP_STA; }
+    bool softApState() { return softApRunning; }
+};
+
+class StressManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::radioOwner;
+    void logMessage(String msg) override {}
+    void setCheckInterval(uint32_t ms) { intervalWifiCheckMillis = ms; }
+};
+
+int main() {
+  HostSimHal<WifiManagerSimClock, StressRadio> sim;
+  sim.radio.scanDurationMs = 30;
+
+  simAccessPoint_t office;
+  office.ssid = "office";
+  office.pass = "secret";
+  office.joinLatencyMs = 20;
+  office.dhcpLatencyMs = 10;
+  sim.radio.addAp(office);
+  simAccessPoint_t lab;
+  lab.ssid = "lab";
+  lab.pass = "secret";
+  lab.bssid[5] = 7;
+  lab.joinLatencyMs = 400;
+  lab.failReason = 15;
+  sim.radio.addAp(lab);
+
+  StressManager wifi("stress", &sim.hal);
+  wifi.addWifi("office", "secret");
+  wifi.addWifi("lab", "secret");
+  wifi.setCheckInterval(5);
+  WebServer server(80);
+  wifi.attachWebServer(&server);
+
+  std::atomic<bool> stop{false};
+  std::atomic<uint32_t> operations{0};
+  std::atomic<uint32_t> inconsistent{0};
+  std::atomic<uint32_t> busy{0};
+  auto check = [&]() {
+    WifiRadioGuard guard(wifi.radioOwner, WIFI_RADIO_PRIORITY_CONTROL);
+    if (sim.radio.softApMode() != sim.radio.softApState() || wifi.getLinkState().softApRunning != sim.radio.softApState()) inconsistent++;
+  };
+
+  std::vector<std::thread> threads;
+  threads.emplace_back([&]() { while (!stop) { wifi.loop(); operations++; } });
+  threads.emplace_back([&]() { while (!stop) { wifi.tick(); check(); operations++; sim.clock.delay(1); } });
+  threads.emplace_back([&]() { while (!stop) { wifi.tryConnect(); check(); operations++; } });
+  threads.emplace_back([&]() { while (!stop) { wifi.burst([&]() { check(); }); operations++; sim.clock.delay(7); } });
+  threads.emplace_back([&]() {
+    while (!stop) {
+      wifi.runSoftAP();
+      check();
+      wifi.stopSoftAP();
+      check();
+      operations++;
+      sim.clock.delay(300);
+    }
+  });
+  threads.emplace_back([&]() {
+    while (!stop) {
+      wifi.stopClient();
+      wifi.triggerReconnect();
+      check();
+      operations++;
+      sim.clock.delay(500);
+    }
+  });
+  threads.emplace_back([&]() {
+    while (!stop) {
+      wifi.addWifi("guest", "secret", false);
+      wifi.delWifi("guest");
+      wifi.loadFromNVS();
+      operations++;
+      sim.clock.delay(3);
+    }
+  });
+  // the API answers without waiting for the radio
+  threads.emplace_back([&]() {
+    const char * uris[] = { "/api/wifi/configlist", "/api/wifi/status", "/api/wifi/scan" };
+    for (uint32_t i = 0; !stop; i++) {
+      hostHttpResponse_t response = server.request(HTTP_GET, uris[i % 3]);
+      if (response.code == 503) busy++;
+      operations++;
+      sim.clock.delay(2);
+    }
+  });
+
+  sim.clock.delay(STRESS_SECONDS * 1000);
+  stop = true;
+  for (auto & thread : threads) thread.join();
+  check();
+  wifi.detachWebServer();
+
+  printf("operations=%u inconsistent=%u api_busy=%u attempts=%u joins=%u scans=%u\n",
+    operations.load(), inconsistent.load(), busy.load(), wifi.getMetrics().connectAttempts, sim.radio.joins, sim.radio.scans);
+  EXPECT(inconsistent == 0);
+  EXPECT(operations > 0);
+  return TEST_RESULT();
+}
@@ -0,0 +1,90 @@
+/**
+ * Wifi Manager - test of the resource usage of the background task
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#include "wifimanager.h"
+#include "host_sim.h"
+#include "host_api.h"
+#include "host_test.h"
+
+// Exposes the sampling of the task usage, run by the task after each loop()
+class TaskManager : public WIFIMANAGER {
+  public:
+    using WIFIMANAGER::WIFIMANAGER;
+    using WIFIMANAGER::sampleTaskUsage;
+};
+
+static bool contains(const hostHttpResponse_t & response, const char * text) {
+  return response.body.find(text) != std::string::npos;
+}
+
+int main() {
+  HostSim sim;
+  Serial.muted = true;
+
+  TaskManager wifi("task", &sim.hal);
+  wifi.fallbackToSoftAp(false);
+  wifiTaskConfig_t config;
+  config.stackSize = 4000;
+  wifi.setTaskConfig(config);
+  wifi.startBackgroundTask();
+  EXPECT(sim.tasks.fn != nullptr && wifi.getTaskUsage().running);
+
+  // A platform without task statistics only counts the runs
+  wifi.sampleTaskUsage(1500);
+  EXPECT(wifi.getTaskUsage().loops == 1 && wifi.getTaskUsage().loopMicros == 1500);
+  EXPECT(!wifi.getTaskUsage().statsValid && !wifi.getTaskUsage().cpuValid);
+
+  // The stack is reported without the CPU time
+  sim.tasks.statsValid = true;
+  sim.tasks.taskStats.stackFreeMin = 1000;
+  wifi.sampleTaskUsage(500);
+  EXPECT(wifi.getTaskUsage().statsValid && !wifi.getTaskUsage().cpuValid);
+  EXPECT(wifi.getTaskUsage().stackFreeMin == 1000);
+
+  // The first sample of the CPU time is the base of the following ones
+  sim.tasks.taskStats.runTimeValid = true;
+  sim.tasks.taskStats.runTime = 50000;
+  sim.tasks.taskStats.runTimeTotal = 900000;
+  wifi.sampleTaskUsage(500);
+  EXPECT(wifi.getTaskUsage().cpuValid);
+  EXPECT(wifi.getTaskUsage().runTime == 0 && wifi.getTaskUsage().runTimeTotal == 0);
+
+  sim.tasks.taskStats.runTime += 100;
+  sim.tasks.taskStats.runTimeTotal += 1000;
+  wifi.sampleTaskUsage(500);
+  EXPECT(wifi.getTaskUsage().runTime == 100 && wifi.getTaskUsage().runTimeTotal == 1000);
+
+  // The 32 bit counters of the platform wrap around, the usage keeps growing
+  sim.tasks.taskStats.runTime = 0xFFFFFF00;
+  sim.tasks.taskStats.runTimeTotal = 0xFFFFF000;
+  wifi.sampleTaskUsage(500);
+  uint64_t runTime = wifi.getTaskUsage().runTime;
+  uint64_t runTimeTotal = wifi.getTaskUsage().runTimeTotal;
+  sim.tasks.taskStats.runTime = 0x100;
+  sim.tasks.taskStats.runTimeTotal = 0x1000;
+  wifi.sampleTaskUsage(500);
+  EXPECT(wifi.getTaskUsage().runTime == runTime + 0x200);
+  EXPECT(wifi.getTaskUsage().runTimeTotal == runTimeTotal + 0x2000);
+  EXPECT(wifi.getTaskUsage().lastRunTime == 0x100 && wifi.getTaskUsage().loops == 6);
+
+  // The metrics report the stack and CPU usage
+  ApiClient client;
+  client.attach(wifi);
+  hostHttpResponse_t response = client.get("/api/wifi/metrics");
+  EXPECT(response.code == 200);
+  EXPECT(contains(response, "\"stackFreeMin\":1000"));
+  EXPECT(contains(response, "\"stackUsedPercent\":75"));
+  EXPECT(contains(response, "\"loops\":6"));
+  EXPECT(contains(response, "\"cpuPercent\":"));
+
+  // The killed task is reported as stopped
+  wifi.stopWifi(true);
+  EXPECT(!wifi.getTaskUsage().running);
+  wifi.detachWebServer();
+
+  return TEST_RESULT();
+}
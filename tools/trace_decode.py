@@ -0,0 +1,114 @@
+#!/usr/bin/env python3
+"""
+Wifi Manager - decoder of the binary event trace
+(c) 2022-2024 Martin Verges
+
+Licensed under CC BY-NC-SA 4.0
+(Attribution-NonCommercial-ShareAlike 4.0 International)
+
+Usage:
+  curl -o trace.bin http://<device>/api/wifi/trace
+  tools/trace_decode.py trace.bin
+  tools/trace_decode.py --json http://<device>/api/wifi/trace
+"""
+import argparse
+import json
+import struct
+import sys
+import urllib.request
+
+HEADER = struct.Struct("<4sBBHII")
+RECORD = struct.Struct("<IIBBHII")
+
+LINK_STATUS = ["idle", "noSsidAvail", "scanCompleted", "connected", "connectFailed", "connectionLost", "disconnected"]
+FAILURE = ["none", "auth", "handshakeTimeout", "notFound", "assocRefused", "linkLost", "noUplink", "other"]
+IP_MODE = ["dhcp", "static", "lastLease"]
+HEALTH_ACTION = ["none", "reconnect", "failover"]
+
+
+def name(names, value):
+    return names[value] if value < len(names) else str(value)
+
+
+def int8(value):
+    value &= 0xff
+    return value - 256 if value > 127 else value
+
+
+def bssid(value):
+    return "??:??:" + ":".join("%02x" % ((value >> shift) & 0xff) for shift in (24, 16, 8, 0))
+
+
+# decode the arguments of a record, keyed by wifiTraceType_t
+TYPES = {
+    1: ("start", lambda a, b, x, y: {"configuredSsids": a}),
+    2: ("scan", lambda a, b, x, y: {"networks": b, "millis": x}),
+    3: ("scanAp", lambda a, b, x, y: {"channel": a, "rssi": int8(b), "authmode": b >> 8, "ssidHash": "%08x" % x, "bssid": bssid(y)}),
+    4: ("connect", lambda a, b, x, y: {"apId": a, "channel": b, "bssid": bssid(x) if b else None, "ipMode": name(IP_MODE, y)}),
+    5: ("connectResult", lambda a, b, x, y: {"status": name(LINK_STATUS, a), "reason": b, "millis": x, "failure": name(FAILURE, y)}),
+    6: ("disconnected", lambda a, b, x, y: {"reason": a, "rssi": int8(b)}),
+    7: ("gotIp", lambda a, b, x, y: {}),
+    8: ("lostIp", lambda a, b, x, y: {}),
+    9: ("backoff", lambda a, b, x, y: {"millis": x}),
+    10: ("block", lambda a, b, x, y: {"apId": a, "failure": name(FAILURE, b), "millis": x, "bssid": bssid(y) if y else None}),
+    11: ("roam", lambda a, b, x, y: {"apId": a, "smoothedRssi": int8(b)}),
+    12: ("health", lambda a, b, x, y: {"healthy": bool(a), "failures": b, "action": name(HEALTH_ACTION, x)}),
+    13: ("softAp", lambda a, b, x, y: {"running": bool(a)}),
+}
+
+
+def decode(data):
+    """Decode an export of /api/wifi/trace into a list of events, oldest first"""
+    if len(data) < HEADER.size:
+        raise ValueError("trace too short")
+    magic, version, record_size, capacity, first, now = HEADER.unpack_from(data)
+    if magic != b"WMTR" or version != 1 or record_size < RECORD.size:
+        raise ValueError("not a WifiManager trace or unsupported version")
+
+    events = []
+    offset = HEADER.size
+    base = None
+    last_seq = first - 1
+    while offset + record_size <= len(data):
+        seq, micros, kind, a, b, arg1, arg2 = RECORD.unpack_from(data, offset)
+        offset += record_size
+        # the device clock has 32 bits of microseconds, unwrap it relative to the export time
+        age = (now - micros) & 0xffffffff
+        if base is None:
+            base = age
+        event_name, args = TYPES.get(kind, ("type%d" % kind, lambda a, b, x, y: {"a": a, "b": b, "arg1": x, "arg2": y}))
+        event = {"seq": seq, "ms": (base - age) / 1000.0, "ageMs": age / 1000.0, "event": event_name}
+        event.update({k: v for k, v in args(a, b, arg1, arg2).items() if v is not None})
+        if seq != last_seq + 1:
+            event["lost"] = seq - last_seq - 1
+        last_seq = seq
+        events.append(event)
+    return events
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Decode a WifiManager event trace")
+    parser.add_argument("source", help="file, http(s) URL of /api/wifi/trace or - for stdin")
+    parser.add_argument("--json", action="store_true", help="print a JSON array instead of text")
+    args = parser.parse_args()
+
+    if args.source == "-":
+        data = sys.stdin.buffer.read()
+    elif args.source.startswith(("http://", "https://")):
+        data = urllib.request.urlopen(args.source).read()
+    else:
+        with open(args.source, "rb") as f:
+            data = f.read()
+
+    events = decode(data)
+    if args.json:
+        print(json.dumps(events, indent=2))
+        return
+    for event in events:
+        details = " ".join("%s=%s" % (k, v) for k, v in event.items() if k not in ("seq", "ms", "ageMs", "event", "lost"))
+        lost = " (%d records lost)" % event["lost"] if "lost" in event else ""
+        print("%6d %12.3f ms  %-14s %s%s" % (event["seq"], event["ms"], event["event"], details, lost))
+
+
+if __name__ == "__main__":
+    main()
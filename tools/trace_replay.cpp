@@ -0,0 +1,91 @@
+/**
+ * Wifi Manager - replay a device trace on the host
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Built by the host build in test/ against the stand-ins of the Arduino core:
+ *   cmake -S test -B build && cmake --build build --target trace_replay
+ *
+ * Usage:
+ *   trace_replay [-v] trace.bin <ssid>[:<password>] ...
+ * The networks have to be given in the order of their IDs on the device, see /configlist.
+ * Exits with 1 if the replayed decisions differ from the recorded ones.
+**/
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include "wifimanager_replay.h"
+
+static const char * decisionName(uint8_t type) {
+  switch(type) {
+    case WIFI_TRACE_CONNECT: return "connect";
+    case WIFI_TRACE_BLOCK: return "block";
+    case WIFI_TRACE_ROAM: return "roam";
+    case WIFI_TRACE_SOFTAP: return "softAp";
+    default: return "?";
+  }
+}
+
+static void printDecision(const std::vector<wifiReplayDecision_t> & list, size_t i) {
+  if (i >= list.size()) {
+    printf("%-40s", "-");
+    return;
+  }
+  char line[64];
+  snprintf(line, sizeof(line), "%10.1fs %-8s %3u %08lx", list[i].millis / 1000.0, decisionName(list[i].type),
+    list[i].a, (unsigned long)list[i].bssid);
+  printf("%-40s", line);
+}
+
+int main(int argc, char ** argv) {
+  WifiManagerReplay replay;
+  if (argc > 1 && strcmp(argv[1], "-v") == 0) {
+    replay.log = [](const char * msg) { fputs(msg, stdout); };
+    argc--;
+    argv++;
+  }
+  if (argc < 3) {
+    fprintf(stderr, "usage: trace_replay [-v] trace.bin <ssid>[:<password>] ...\n");
+    return 2;
+  }
+
+  FILE * f = fopen(argv[1], "rb");
+  if (!f) {
+    perror(argv[1]);
+    return 2;
+  }
+  std::vector<uint8_t> data;
+  uint8_t buf[512];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0) data.insert(data.end(), buf, buf + n);
+  fclose(f);
+
+  if (!replay.load(data.data(), data.size())) {
+    fprintf(stderr, "%s is not a WifiManager trace\n", argv[1]);
+    return 2;
+  }
+  for (int i = 2; i < argc; i++) {
+    std::string arg = argv[i];
+    size_t colon = arg.find(':');
+    std::string ssid = arg.substr(0, colon);
+    std::string pass = colon == std::string::npos ? "" : arg.substr(colon + 1);
+    replay.addNetwork(ssid.c_str(), pass.c_str());
+  }
+
+  wifiReplayReport_t report = replay.run();
+
+  printf("%-40s%-40s\n", "recorded", "replayed");
+  size_t rows = std::max(report.recorded.size(), report.replayed.size());
+  for (size_t i = 0; i < rows; i++) {
+    printDecision(report.recorded, i);
+    printDecision(report.replayed, i);
+    printf("%s\n", report.diverged && i == report.matching ? "  <-- first difference" : "");
+  }
+  printf("\nconnection attempts: recorded %u, replayed %u\n", report.recordedAttempts, report.replayedAttempts);
+  printf("time offline: recorded %.1fs, replayed %.1fs\n", report.recordedOfflineMillis / 1000.0, report.replayedOfflineMillis / 1000.0);
+  if (report.overran) printf("the start of the replay took longer than the trace\n");
+  printf("%s\n", report.diverged ? "decisions differ" : "decisions match");
+  return report.diverged ? 1 : 0;
+}
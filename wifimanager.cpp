@@ -6,15 +6,7 @@
  * (Attribution-NonCommercial-ShareAlike 4.0 International)
 **/
 #include "wifimanager.h"
-#include "AsyncJson.h"
 #include "ArduinoJson.h"
-#if ASYNC_WEBSERVER == true
-  #include <ESPAsyncWebServer.h>
-#else
-  #include <WebServer.h>
-#endif
-#include <WiFi.h>
-#include <Preferences.h>
 
 
 /**
@@ -34,17 +26,21 @@ void WIFIMANAGER::logMessage(String msg) {
  * @param param needs to be a valid WIFIMANAGER instance
  */
 void wifiTask(void* param) {
-  yield();
-  delay(500); // wait a short time until everything is setup before executing the loop forever
-  yield();
-  const TickType_t xDelay = 10000 / portTICK_PERIOD_MS;
   WIFIMANAGER * wifimanager = (WIFIMANAGER *) param;
+  WifiManagerClock * clock = wifimanager->hal.clock;
+
+  clock->yield();
+  clock->delay(500); // wait a short time until everything is setup before executing the loop forever
+  clock->yield();
+  if (wifimanager->apListPartial) wifimanager->loadFromNVS();
 
   for(;;) {
-    yield();
+    clock->yield();
+    uint64_t start = clock->micros();
     wifimanager->loop();
-    yield();
-    vTaskDelay(xDelay);
+    wifimanager->sampleTaskUsage(clock->micros() - start);
+    clock->yield();
+    clock->delay(wifimanager->intervalLinkSampleMillis < 10000 ? wifimanager->intervalLinkSampleMillis : 10000);
   }
 }
 
@@ -58,73 +54,138 @@ void wifiTask(void* param) {
 void WIFIMANAGER::startBackgroundTask(String softApName, String softApPass) {
   if (softApName.length()) this->softApName = softApName;
   if (softApPass.length()) this->softApPass = softApPass;
-  loadFromNVS();
-  tryConnect();
-
-  BaseType_t taskCreated = xTaskCreatePinnedToCore(
-    wifiTask,
-    "WifiManager",
-    4096,   // Stack size in words
-    this,   // Task input parameter
-    1,      // Priority of the task
-    &WifiCheckTask,  // Task handle.
-    0       // Core where the task should run
-  );
+  traceEvent(WIFI_TRACE_START, configuredSSIDs);
+  {
+    WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION);
+    // after a deep sleep, connect to the last network first and read the NVS later
+    bool connected = restoreRetainedState() && connectCached(hal.clock->millis());
+    if (!connected) {
+      loadFromNVS();
+      connected = tryConnect();
+    }
+    // the task continues with the next regular check instead of repeating the attempt
+    lastWifiCheckMillis = hal.clock->millis();
+    if (!radioOwner.cancelled()) connectFinished(connected);
+  }
 
-  if (taskCreated != pdPASS) {
+  taskUsage = wifiTaskUsage_t();
+  WifiCheckTask = (wifiTaskHandle_t)hal.tasks->start(wifiTask, this, "WifiManager", taskConfig);
+  if (WifiCheckTask == nullptr) {
     logMessage("[ERROR] WifiManager: Error creating background task\n");
+    return;
   }
+  taskUsage.running = true;
 }
 
 /**
  * @brief Construct a new WIFIMANAGER::WIFIMANAGER object
- * @details Puts the Wifi mode to AP+STA and registers Wifi Events
+ * @details Registers the Wifi Events
  * @param ns Namespace for the preferences non volatile storage (NVS)
+ * @param customHal Platform implementation to use, defaults to the ESP32 Arduino core.
+ *                  Every instance needs its own, the radio has a single event callback.
+ *                  Required on other platforms, aborts if it is missing.
  */
-WIFIMANAGER::WIFIMANAGER(const char * ns) {
+WIFIMANAGER::WIFIMANAGER(const char * ns, WifiManagerHal * customHal) {
   NVS = (char *)ns;
-
-  // AP on/off
-  WiFi.onEvent([&](WiFiEvent_t event, WiFiEventInfo_t info) {
-    logMessage("[WIFI] onEvent() AP mode started!\n");
-    softApRunning = true;
-#if ESP_ARDUINO_VERSION_MAJOR >= 2
-    }, ARDUINO_EVENT_WIFI_AP_START); // arduino-esp32 2.0.0 and later
-#else
-    }, SYSTEM_EVENT_AP_START); // arduino-esp32 1.0.6
-#endif
-  WiFi.onEvent([&](WiFiEvent_t event, WiFiEventInfo_t info) {
-    logMessage("[WIFI] onEvent() AP mode stopped!\n");
-    softApRunning = false;
-#if ESP_ARDUINO_VERSION_MAJOR >= 2
-    }, ARDUINO_EVENT_WIFI_AP_STOP); // arduino-esp32 2.0.0 and later
-#else
-    }, SYSTEM_EVENT_AP_STOP); // arduino-esp32 1.0.6
-#endif
-  // AP client join/leave
-  WiFi.onEvent([&](WiFiEvent_t event, WiFiEventInfo_t info) {
-    logMessage("[WIFI] onEvent() new client connected to softAP!\n");
-#if ESP_ARDUINO_VERSION_MAJOR >= 2
-    }, ARDUINO_EVENT_WIFI_AP_STACONNECTED); // arduino-esp32 2.0.0 and later
-#else
-    }, SYSTEM_EVENT_AP_STACONNECTED); // arduino-esp32 1.0.6
-#endif
-  WiFi.onEvent([&](WiFiEvent_t event, WiFiEventInfo_t info) {
-    logMessage("[WIFI] onEvent() Client disconnected from softAP!\n");
-#if ESP_ARDUINO_VERSION_MAJOR >= 2
-    }, ARDUINO_EVENT_WIFI_AP_STADISCONNECTED); // arduino-esp32 2.0.0 and later
+#if defined(ESP32)
+  ownHal = customHal == nullptr;
+  hal = customHal ? *customHal : wifiManagerCreateHal();
 #else
-    }, SYSTEM_EVENT_AP_STADISCONNECTED); // arduino-esp32 1.0.6
+  if (customHal == nullptr) {
+    Serial.println("[ERROR] WifiManager: no HAL given, there is no default without the ESP32 core");
+    abort();
+  }
+  hal = *customHal;
 #endif
+
+  hal.radio->onEvent([&](const wifiRadioEvent_t & event) {
+    switch(event.type) {
+      // AP on/off
+      case WIFI_RADIO_EVENT_AP_START:
+        logMessage("[WIFI] onEvent() AP mode started!\n");
+        linkState.update([](wifiLinkState_t & state) { state.softApRunning = true; });
+        traceEvent(WIFI_TRACE_SOFTAP, 1);
+        break;
+      case WIFI_RADIO_EVENT_AP_STOP:
+        logMessage("[WIFI] onEvent() AP mode stopped!\n");
+        linkState.update([](wifiLinkState_t & state) { state.softApRunning = false; });
+        traceEvent(WIFI_TRACE_SOFTAP, 0);
+        break;
+      // AP client join/leave
+      case WIFI_RADIO_EVENT_AP_CLIENT_CONNECTED:
+        logMessage("[WIFI] onEvent() new client connected to softAP!\n");
+        break;
+      case WIFI_RADIO_EVENT_AP_CLIENT_DISCONNECTED:
+        logMessage("[WIFI] onEvent() Client disconnected from softAP!\n");
+        break;
+      // STA disconnect, the reason is classified by connectToCandidate() and the status API
+      case WIFI_RADIO_EVENT_STA_CONNECTED:
+        linkState.update([&](wifiLinkState_t & state) {
+          memcpy(state.ssid, event.link.ssid, sizeof(state.ssid));
+          memcpy(state.bssid, event.link.bssid, sizeof(state.bssid));
+          state.channel = event.link.channel;
+          state.rssi = event.rssi;
+          state.connected = true;
+        });
+        break;
+      case WIFI_RADIO_EVENT_STA_DISCONNECTED: {
+        uint64_t now = hal.clock->millis();
+        linkState.update([&](wifiLinkState_t & state) {
+          wifiLinkState_t disconnected;
+          disconnected.rssi = state.rssi;
+          disconnected.softApRunning = state.softApRunning;
+          disconnected.lastDisconnectReason = event.reason;
+          disconnected.lastDisconnectMillis = now;
+          state = disconnected;
+        });
+        {
+          // the history belongs to a single connection
+          std::lock_guard<std::mutex> lock(linkQualityMutex);
+          linkQuality.reset();
+        }
+        traceEvent(WIFI_TRACE_DISCONNECTED, event.reason, (uint8_t)event.rssi);
+        break;
+      }
+      case WIFI_RADIO_EVENT_STA_GOT_IP:
+        linkState.update([&](wifiLinkState_t & state) {
+          state.ip = event.link.ip;
+          state.gateway = event.link.gateway;
+          state.netmask = event.link.netmask;
+          state.dns = event.link.dns;
+          state.gotIp = true;
+        });
+        traceEvent(WIFI_TRACE_GOT_IP);
+        break;
+      case WIFI_RADIO_EVENT_STA_LOST_IP:
+        linkState.update([](wifiLinkState_t & state) {
+          state.ip = state.gateway = state.netmask = state.dns = 0;
+          state.gotIp = false;
+        });
+        traceEvent(WIFI_TRACE_LOST_IP);
+        break;
+      default:
+        break;
+    }
+  });
 }
 
 /**
  * @brief Destroy the WIFIMANAGER::WIFIMANAGER object
- * @details will stop the background task as well but not cleanup the AsyncWebserver
+ * @details will stop the background task, remove the api routes from the webserver
+ * and unregister the radio events
  */
 WIFIMANAGER::~WIFIMANAGER() {
-  vTaskDelete(WifiCheckTask);
-  // FIXME: get rid of the registered Webserver AsyncCallbackWebHandlers
+  {
+    // the task can't be stopped while it owns the radio
+    WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_CONTROL);
+    hal.tasks->stop(WifiCheckTask);
+    WifiCheckTask = nullptr;
+    detachWebServer();
+    hal.radio->onEvent(nullptr);
+  }
+#if defined(ESP32)
+  if (ownHal) wifiManagerDestroyHal(hal);
+#endif
 }
 
 /**
@@ -151,36 +212,105 @@ bool WIFIMANAGER::getFallbackState() {
  */
 void WIFIMANAGER::clearApList() {
   for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
-    apList[i].apName = "";
-    apList[i].apPass = "";
+    apList[i] = apCredentials_t();
+  }
+  rebuildSsidIndex();
+}
+
+/**
+ * @brief Hash a raw SSID using FNV-1a
+ * @param ssid SSID bytes, not required to be null terminated
+ * @param len Length of the SSID
+ * @return uint32_t hash
+ */
+uint32_t WIFIMANAGER::hashSsid(const uint8_t * ssid, uint8_t len) {
+  uint32_t hash = 2166136261UL;
+  for(uint8_t i = 0; i < len; i++) {
+    hash ^= ssid[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+/**
+ * @brief Recreate the SSID hash index from the current apList
+ * @details The index allows to match scan records against the apList without creating a String
+ * per scan entry and without comparing each of them against every slot.
+ */
+void WIFIMANAGER::rebuildSsidIndex() {
+  memset(ssidIndex, 0, sizeof(ssidIndex));
+  for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
+    if (apList[i].apName.length() == 0) continue;
+    apList[i].ssidHash = hashSsid((const uint8_t *)apList[i].apName.c_str(), apList[i].apName.length());
+    uint16_t pos = apList[i].ssidHash % WIFIMANAGER_SSID_INDEX_SIZE;
+    while (ssidIndex[pos] != 0) pos = (pos + 1) % WIFIMANAGER_SSID_INDEX_SIZE;
+    ssidIndex[pos] = i + 1;
   }
 }
 
 /**
  * @brief Load last saved configuration from the NVS into the memory
+ * @details Owns the radio while the list changes, a running connection attempt of the
+ * background task gives up first.
  * @return true on success
  * @return false on error
  */
 bool WIFIMANAGER::loadFromNVS() {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, WIFI_RADIO_READ);
   configuredSSIDs = 0;
-  if (preferences.begin(NVS, true)) {
+  apListPartial = false;
+  if (hal.store->begin(NVS, true)) {
     clearApList();
     char tmpKey[10] = { 0 };
+    char value[65] = { 0 };
     for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
       sprintf(tmpKey, "apName%d", i);
-      if (preferences.getType(tmpKey) == PT_STR) {
-        String apName = preferences.getString(tmpKey, "");
+      if (hal.store->getString(tmpKey, value, sizeof(value)) > 0) {
+        String apName = value;
         if (apName.length() > 0) {
           sprintf(tmpKey, "apPass%d", i);
-          String apPass = preferences.getString(tmpKey);
+          if (hal.store->getString(tmpKey, value, sizeof(value)) == 0) value[0] = 0;
+          String apPass = value;
           logMessage(String("[WIFI] Load SSID '") + apName + "' to " + String(i+1) + ". slot.\n");
           apList[i].apName = apName;
           apList[i].apPass = apPass;
+          sprintf(tmpKey, "apPrio%d", i);
+          apList[i].apPriority = hal.store->getUChar(tmpKey, WIFIMANAGER_DEFAULT_PRIORITY);
+          sprintf(tmpKey, "apRssi%d", i);
+          apList[i].apMinRssi = hal.store->getChar(tmpKey, WIFIMANAGER_NO_RSSI_FLOOR);
+          sprintf(tmpKey, "apIp%d", i);
+          unsigned mode;
+          unsigned long ip, gateway, netmask, dns;
+          if (hal.store->getString(tmpKey, value, sizeof(value)) > 0
+              && sscanf(value, "%u,%lx,%lx,%lx,%lx", &mode, &ip, &gateway, &netmask, &dns) == 5 && mode <= WIFI_IP_LAST_LEASE) {
+            apList[i].ipConfig.mode = (wifiIpMode_t)mode;
+            apList[i].ipConfig.ip = ip;
+            apList[i].ipConfig.gateway = gateway;
+            apList[i].ipConfig.netmask = netmask;
+            apList[i].ipConfig.dns = dns;
+          }
           configuredSSIDs++;
         }
       }
     }
-    preferences.end();
+    connectionCache = wifiConnectionCache_t();
+    char cache[80] = { 0 };
+    unsigned apId, channel, bssid[6];
+    unsigned long ssidHash, ip, gateway, netmask, dns;
+    if (hal.store->getString("lastConn", cache, sizeof(cache)) > 0
+        && sscanf(cache, "%u,%lx,%u,%02x%02x%02x%02x%02x%02x,%lx,%lx,%lx,%lx", &apId, &ssidHash, &channel,
+          &bssid[0], &bssid[1], &bssid[2], &bssid[3], &bssid[4], &bssid[5], &ip, &gateway, &netmask, &dns) == 13) {
+      connectionCache.apId = apId;
+      connectionCache.ssidHash = ssidHash;
+      connectionCache.channel = channel;
+      for(uint8_t i = 0; i < sizeof(connectionCache.bssid); i++) connectionCache.bssid[i] = bssid[i];
+      connectionCache.ip = ip;
+      connectionCache.gateway = gateway;
+      connectionCache.netmask = netmask;
+      connectionCache.dns = dns;
+    }
+    hal.store->end();
+    rebuildSsidIndex();
     return true;
   }
   logMessage("[WIFI] Unable to load data from NVS, giving up...\n");
@@ -193,36 +323,188 @@ bool WIFIMANAGER::loadFromNVS() {
  * @return false on error with the NVS
  */
 bool WIFIMANAGER::writeToNVS() {
-  if (!preferences.begin(NVS, false)) {
+  if (!hal.store->begin(NVS, false)) {
     logMessage("[WIFI] Unable to write data to NVS, giving up...");
     return false;
   }
 
-  preferences.clear();
+  hal.store->clear();
   char tmpKey[10];
   for(uint8_t i = 0; i < WIFIMANAGER_MAX_APS; i++) {
     if (apList[i].apName.isEmpty()) continue;
 
     snprintf(tmpKey, sizeof(tmpKey), "apName%d", i);
-    preferences.putString(tmpKey, apList[i].apName);
+    hal.store->putString(tmpKey, apList[i].apName.c_str());
 
     snprintf(tmpKey, sizeof(tmpKey), "apPass%d", i);
-    preferences.putString(tmpKey, apList[i].apPass);
+    hal.store->putString(tmpKey, apList[i].apPass.c_str());
+
+    snprintf(tmpKey, sizeof(tmpKey), "apPrio%d", i);
+    hal.store->putUChar(tmpKey, apList[i].apPriority);
+
+    snprintf(tmpKey, sizeof(tmpKey), "apRssi%d", i);
+    hal.store->putChar(tmpKey, apList[i].apMinRssi);
+
+    storeIpConfig(i);
   }
+  storeConnectionCache();
 
-  preferences.end();
+  hal.store->end();
   return true;
 }
 
+/**
+ * @brief Write the IP configuration of a network into the opened NVS namespace
+ * @details Networks using DHCP don't need an entry.
+ * @param apId ID of the network within the apList
+ */
+void WIFIMANAGER::storeIpConfig(uint8_t apId) {
+  const wifiIpConfig_t & ipConfig = apList[apId].ipConfig;
+  if (ipConfig.mode == WIFI_IP_DHCP) return;
+  char tmpKey[10];
+  char value[48];
+  snprintf(tmpKey, sizeof(tmpKey), "apIp%d", apId);
+  snprintf(value, sizeof(value), "%u,%lx,%lx,%lx,%lx", ipConfig.mode, (unsigned long)ipConfig.ip,
+    (unsigned long)ipConfig.gateway, (unsigned long)ipConfig.netmask, (unsigned long)ipConfig.dns);
+  hal.store->putString(tmpKey, value);
+}
+
+/**
+ * @brief Serialize the connection cache into the opened NVS namespace
+ */
+void WIFIMANAGER::storeConnectionCache() {
+  if (connectionCache.apId >= WIFIMANAGER_MAX_APS) return;
+  char value[80];
+  const uint8_t * bssid = connectionCache.bssid;
+  snprintf(value, sizeof(value), "%u,%lx,%u,%02x%02x%02x%02x%02x%02x,%lx,%lx,%lx,%lx",
+    connectionCache.apId, (unsigned long)connectionCache.ssidHash, connectionCache.channel,
+    bssid[0], bssid[1], bssid[2], bssid[3], bssid[4], bssid[5],
+    (unsigned long)connectionCache.ip, (unsigned long)connectionCache.gateway,
+    (unsigned long)connectionCache.netmask, (unsigned long)connectionCache.dns);
+  hal.store->putString("lastConn", value);
+}
+
+/**
+ * @brief Check if the connection cache belongs to a stored network
+ * @return true if the cached network is still configured with the same SSID
+ */
+bool WIFIMANAGER::connectionCacheValid() {
+  uint8_t apId = connectionCache.apId;
+  return apId < WIFIMANAGER_MAX_APS && apList[apId].apName.length() > 0
+    && apList[apId].ssidHash == connectionCache.ssidHash && connectionCache.channel > 0;
+}
+
+/**
+ * @brief Remember a successful connection
+ * @details The NVS is only written if something changed, usually the AP or the lease.
+ * @param apId ID of the connected network within the apList
+ * @param link Information about the established connection
+ */
+void WIFIMANAGER::updateConnectionCache(uint8_t apId, const wifiLinkInfo_t & link) {
+  wifiConnectionCache_t cache;
+  cache.apId = apId;
+  cache.ssidHash = apList[apId].ssidHash;
+  cache.channel = link.channel;
+  memcpy(cache.bssid, link.bssid, sizeof(cache.bssid));
+  cache.ip = link.ip;
+  cache.gateway = link.gateway;
+  cache.netmask = link.netmask;
+  cache.dns = link.dns;
+  bool changed = cache.apId != connectionCache.apId || cache.ssidHash != connectionCache.ssidHash
+    || cache.channel != connectionCache.channel || memcmp(cache.bssid, connectionCache.bssid, sizeof(cache.bssid)) != 0
+    || cache.ip != connectionCache.ip || cache.gateway != connectionCache.gateway
+    || cache.netmask != connectionCache.netmask || cache.dns != connectionCache.dns;
+  connectionCache = cache;
+  storeRetainedState();
+  if (!changed) return;
+
+  if (hal.store->begin(NVS, false)) {
+    storeConnectionCache();
+    hal.store->end();
+  }
+}
+
+/**
+ * @brief Checksum of the retained state
+ * @param data Bytes to hash
+ * @param len Number of bytes
+ * @return uint32_t FNV-1a hash
+ */
+static uint32_t retainedChecksum(const uint8_t * data, size_t len) {
+  uint32_t hash = 2166136261UL;
+  for(size_t i = 0; i < len; i++) {
+    hash ^= data[i];
+    hash *= 16777619UL;
+  }
+  return hash;
+}
+
+/**
+ * @brief Keep the connection cache and the credentials of its network in the retained memory
+ * @details The retained memory survives a deep sleep, so the next wake up can connect without
+ * reading the NVS or scanning. An invalid connection cache invalidates the retained state.
+ */
+void WIFIMANAGER::storeRetainedState() {
+  wifiRetainedState_t state;
+  memset((void *)&state, 0, sizeof(state));   // defined padding for the checksum
+  if (connectionCache.apId < WIFIMANAGER_MAX_APS) {
+    const apCredentials_t & ap = apList[connectionCache.apId];
+    state.magic = WIFIMANAGER_RETAINED_MAGIC;
+    state.nsHash = retainedChecksum((const uint8_t *)NVS, strlen(NVS));
+    state.cache = connectionCache;
+    strncpy(state.apName, ap.apName.c_str(), sizeof(state.apName) - 1);
+    strncpy(state.apPass, ap.apPass.c_str(), sizeof(state.apPass) - 1);
+    state.checksum = retainedChecksum((const uint8_t *)&state, offsetof(wifiRetainedState_t, checksum));
+  }
+  hal.store->writeRetained(&state, sizeof(state));
+}
+
+/**
+ * @brief Restore the cached network from the retained memory
+ * @details Only the cached network is restored, the apList is completed from the NVS
+ * before it is used for anything else.
+ * @return true if the retained state is valid and belongs to this instance
+ */
+bool WIFIMANAGER::restoreRetainedState() {
+  wifiRetainedState_t state;
+  if (!hal.store->readRetained(&state, sizeof(state))) return false;
+  if (state.magic != WIFIMANAGER_RETAINED_MAGIC
+      || state.checksum != retainedChecksum((const uint8_t *)&state, offsetof(wifiRetainedState_t, checksum))
+      || state.nsHash != retainedChecksum((const uint8_t *)NVS, strlen(NVS))
+      || state.cache.apId >= WIFIMANAGER_MAX_APS) {
+    return false;
+  }
+  state.apName[sizeof(state.apName) - 1] = 0;
+  state.apPass[sizeof(state.apPass) - 1] = 0;
+
+  logMessage(String("[WIFI] Restored SSID '") + state.apName + "' from the retained memory\n");
+  for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
+    apList[i] = apCredentials_t();
+  }
+  apList[state.cache.apId].apName = state.apName;
+  apList[state.cache.apId].apPass = state.apPass;
+  configuredSSIDs = 1;
+  rebuildSsidIndex();
+  connectionCache = state.cache;
+  apListPartial = true;
+  return connectionCacheValid();
+}
+
 /**
  * @brief Add a new WIFI SSID to the known credentials list
  * @param apName Name of the SSID to connect to
  * @param apPass Password (or empty) to connect to the SSID
  * @param updateNVS Write the new entry directly to NVS
+ * @param apPriority Networks with a higher priority are preferred over stronger networks with a lower priority
+ * @param apMinRssi RSSI floor, the network is ignored while its signal is weaker
+ * @param ipConfig Static IP or last lease mode, DHCP by default
  * @return true on success
  * @return false on failure
  */
-bool WIFIMANAGER::addWifi(String apName, String apPass, bool updateNVS) {
+bool WIFIMANAGER::addWifi(String apName, String apPass, bool updateNVS, uint8_t apPriority, int8_t apMinRssi, const wifiIpConfig_t & ipConfig) {
+  // the connection attempts read the list
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, WIFI_RADIO_READ);
+  if (apListPartial) loadFromNVS();
   if(apName.length() < 1 || apName.length() > 31) {
     logMessage("[WIFI] No SSID given or ssid too long");
     return false;
@@ -233,12 +515,22 @@ bool WIFIMANAGER::addWifi(String apName, String apPass, bool updateNVS) {
     return false;
   }
 
+  if(ipConfig.mode == WIFI_IP_STATIC && (ipConfig.ip == 0 || ipConfig.netmask == 0)) {
+    logMessage("[WIFI] Static IP configuration without IP or netmask");
+    return false;
+  }
+
   for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
     if (apList[i].apName == "") {
       logMessage(String("[WIFI] Found unused slot Nr. ") + String(i) + " to store the new SSID '" + apName + "' credentials.\n");
+      apList[i] = apCredentials_t();
       apList[i].apName = apName;
       apList[i].apPass = apPass;
+      apList[i].apPriority = apPriority;
+      apList[i].apMinRssi = apMinRssi;
+      apList[i].ipConfig = ipConfig;
       configuredSSIDs++;
+      rebuildSsidIndex();
       if (updateNVS) return writeToNVS();
       else return true;
     }
@@ -254,9 +546,15 @@ bool WIFIMANAGER::addWifi(String apName, String apPass, bool updateNVS) {
  * @return false on error
  */
 bool WIFIMANAGER::delWifi(uint8_t apId) {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, WIFI_RADIO_READ);
+  if (apListPartial) loadFromNVS();
   if (apId < WIFIMANAGER_MAX_APS) {
-    apList[apId].apName.clear();
-    apList[apId].apPass.clear();
+    if (apId == connectionCache.apId) {
+      connectionCache = wifiConnectionCache_t();
+      storeRetainedState();
+    }
+    apList[apId] = apCredentials_t();
+    rebuildSsidIndex();
     return writeToNVS();
   }
   return false;
@@ -269,6 +567,7 @@ bool WIFIMANAGER::delWifi(uint8_t apId) {
  * @return false on error
  */
 bool WIFIMANAGER::delWifi(String apName) {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, WIFI_RADIO_READ);
   int num = 0;
   for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
     if (apList[i].apName == apName) {
@@ -303,470 +602,2006 @@ uint8_t WIFIMANAGER::getApEntry() {
   return 0;
 }
 
+/**
+ * @brief Set the width of the RSSI band used by the default network scoring
+ * @details Networks of the same priority whose signal falls into the same band are
+ * considered equal and are ranked by their recent connection success rate.
+ * @param bandDb Band width in dB, 1 disables the banding
+ */
+void WIFIMANAGER::setRssiBand(uint8_t bandDb) {
+  defaultSelection.scorer.rssiBandDb = bandDb > 0 ? bandDb : 1;
+}
+
+/**
+ * @brief Replace the strategy used to order the scan results
+ * @details The strategy is not owned by the WifiManager and has to outlive it.
+ * @param strategy Custom strategy or nullptr to restore the default priority based one
+ */
+void WIFIMANAGER::setSelectionStrategy(WifiSelectionStrategy * strategy) {
+  selection = strategy ? strategy : &defaultSelection;
+}
+
+/**
+ * @brief Set how many of the ranked networks are tried within one tryConnect()
+ * @param attempts Number of candidates, at least 1
+ */
+void WIFIMANAGER::setMaxConnectAttempts(uint8_t attempts) {
+  maxConnectAttempts = attempts > 0 ? attempts : 1;
+}
+
+/**
+ * @brief Remember the outcome of a connection attempt to calculate the success rate
+ * @details The counters are halved from time to time, so only recent attempts matter.
+ * @param apId ID of the SSID within the apList
+ * @param success true if the connection was established
+ */
+void WIFIMANAGER::recordConnectResult(uint8_t apId, bool success) {
+  if (apId >= WIFIMANAGER_MAX_APS) return;
+  if (apList[apId].connectAttempts >= 16) {
+    apList[apId].connectAttempts /= 2;
+    apList[apId].connectSuccess /= 2;
+  }
+  apList[apId].connectAttempts++;
+  if (success) apList[apId].connectSuccess++;
+}
+
+/**
+ * @brief Check if a candidate is blacklisted because of recent failures
+ * @param candidate Network to check, the BSSID is only checked if known from a scan
+ * @return true if no connection attempt should be made
+ */
+bool WIFIMANAGER::isBlocked(const wifiCandidate_t & candidate) {
+  uint64_t now = hal.clock->millis();
+  if (apList[candidate.apId].block.blocked(now)) return true;
+  if (candidate.channel == 0) return false;
+  for(uint8_t i = 0; i < WIFIMANAGER_BSSID_BLACKLIST_SIZE; i++) {
+    if (blockedBssids[i].blocked(now) && memcmp(blockedBssids[i].bssid, candidate.bssid, sizeof(candidate.bssid)) == 0) return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Blacklist a failed candidate for a while
+ * @details Authentication and handshake failures affect all APs of the network, so the
+ * network is blocked. Other failures only block the BSSID if it is known from a scan.
+ * @param candidate Network that failed
+ * @param failure Classified cause of the failure
+ */
+void WIFIMANAGER::recordFailure(const wifiCandidate_t & candidate, wifiFailureClass_t failure) {
+  uint64_t now = hal.clock->millis();
+  wifiBlock_t * block = &apList[candidate.apId].block;
+
+  if (candidate.channel > 0 && failure != WIFI_FAILURE_AUTH && failure != WIFI_FAILURE_HANDSHAKE_TIMEOUT) {
+    // reuse the entry of this BSSID, otherwise the one expiring first
+    uint8_t slot = 0;
+    for(uint8_t i = 0; i < WIFIMANAGER_BSSID_BLACKLIST_SIZE; i++) {
+      if (memcmp(blockedBssids[i].bssid, candidate.bssid, sizeof(candidate.bssid)) == 0) {
+        slot = i;
+        break;
+      }
+      if (blockedBssids[i].blockedUntilMillis < blockedBssids[slot].blockedUntilMillis) slot = i;
+    }
+    if (memcmp(blockedBssids[slot].bssid, candidate.bssid, sizeof(candidate.bssid)) != 0) {
+      blockedBssids[slot] = blockedBssid_t();
+      memcpy(blockedBssids[slot].bssid, candidate.bssid, sizeof(candidate.bssid));
+    }
+    block = &blockedBssids[slot];
+    apList[candidate.apId].block.failure = failure;
+  }
+
+  block->strike(failure, now);
+  if (block->blocked(now)) {
+    traceEvent(WIFI_TRACE_BLOCK, candidate.apId, failure, block->blockedUntilMillis - now,
+      block == &apList[candidate.apId].block ? 0 : wifiTraceBssid(candidate.bssid));
+    logMessage(String("[WIFI] Blocking ") + (block == &apList[candidate.apId].block ? "SSID " : "BSSID of ")
+      + apList[candidate.apId].apName + " for " + String((uint32_t)(block->blockedUntilMillis - now)) + " ms\n");
+  }
+}
+
 /**
  * @brief Background loop function running inside the task
  * @details regulary check if the connection is up&running, try to reconnect or create a fallback AP
  */
 void WIFIMANAGER::loop() {
-  if (millis() - lastWifiCheckMillis < intervalWifiCheckMillis) return;
-  lastWifiCheckMillis = millis();
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_BACKGROUND);
+  applyControlRequest();
+  applyReconnectRequest();
+  sampleLinkQuality();
+  updatePowerPolicy();
+  if (hal.clock->millis() - lastWifiCheckMillis < intervalWifiCheckMillis) return;
+  lastWifiCheckMillis = hal.clock->millis();
+
+  bool connected = waitForLink(60000) == WIFI_LINK_CONNECTED;
+  wifiLinkState_t link = linkState.read();
+  if(connected && link.gotIp) {
+    if (superviseConnection(link, true)) return;
+  } else if (connectAllowed()) {
+    // let's try to connect to some WiFi in Range, unless another task needs the radio
+    connected = tryConnect();
+    if (!radioOwner.cancelled()) connectFinished(connected);
+  }
 
-  if(WiFi.waitForConnectResult() == WL_CONNECTED) {
-    // Check if we are connected to a well known SSID
-    for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
-      if (WiFi.SSID() == apList[i].apName) {
-        logMessage(String("[WIFI][STATUS] Connected to known SSID: '") + WiFi.SSID() + "' with IP " + WiFi.localIP().toString() + "\n");
-        return;
+  if (checkSoftApTimeout()) hal.clock->delay(100);
+}
+
+/**
+ * @brief Check an established connection
+ * @details Resets the backoff, leaves an AP whose smoothed RSSI dropped below the minimum
+ * of the SSID and runs the health checks. The weak BSSID is blocked for a while, so the
+ * reconnect selects another AP.
+ * @param link Current station connection
+ * @param runHealthCheck Run the health checks, they block until the probes answered
+ * @return true if connected to a known SSID
+ */
+bool WIFIMANAGER::superviseConnection(const wifiLinkState_t & link, bool runHealthCheck) {
+  backoffMillis = 0;  // a new outage starts with the initial delay
+  nextConnectMillis = 0;
+  // Check if we are connected to a well known SSID
+  for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
+    if (apList[i].apName == link.ssid) {
+      logMessage(String("[WIFI][STATUS] Connected to known SSID: '") + link.ssid + "' with IP " + IPAddress(link.ip).toString() + "\n");
+      uint16_t samples;
+      int8_t smoothed;
+      {
+        std::lock_guard<std::mutex> lock(linkQualityMutex);
+        samples = linkQuality.size();
+        smoothed = linkQuality.smoothed();
       }
-    }
-    // looks like we are connected to something else, strange!?
-    logMessage("[WIFI] We are connected to an unknown SSID ignoring. Connected to: " + WiFi.SSID() + "\n");
-  } else {
-    if (softApRunning) {
-      logMessage("[WIFI] Not trying to connect to a known SSID. SoftAP has " + String(WiFi.softAPgetStationNum()) + " clients connected!\n");
-    } else {
-      // let's try to connect to some WiFi in Range
-      if (!tryConnect()) {
-        if (createFallbackAP) runSoftAP();
-        else logMessage("[WIFI] Auto creation of SoftAP is disabled, no starting AP!\n");
+      if (samples >= 3 && smoothed < apList[i].apMinRssi) {
+        // use the smoothed value, a single weak sample is no reason to roam
+        logMessage("[WIFI] Smoothed RSSI " + String(smoothed) + " below the minimum of the SSID, roaming\n");
+        traceEvent(WIFI_TRACE_ROAM, i, (uint8_t)smoothed);
+        wifiCandidate_t candidate = wifiCandidate_t();
+        candidate.apId = i;
+        candidate.channel = link.channel;
+        memcpy(candidate.bssid, link.bssid, sizeof(candidate.bssid));
+        if (candidate.channel > 0) recordFailure(candidate, WIFI_FAILURE_WEAK_SIGNAL);
+        {
+          std::lock_guard<std::mutex> lock(linkQualityMutex);
+          linkQuality.reset();
+        }
+        hal.radio->disconnect();
+        triggerReconnect();
+        return true;
       }
+      if (runHealthCheck) checkHealth(i, link);
+      return true;
     }
   }
+  // looks like we are connected to something else, strange!?
+  logMessage(String("[WIFI] We are connected to an unknown SSID ignoring. Connected to: ") + link.ssid + "\n");
+  return false;
+}
 
-  if (softApRunning && millis() - startApTimeMillis > timeoutApMillis) {
-    if (WiFi.softAPgetStationNum() > 0) {
-      logMessage("[WIFI] SoftAP has " + String(WiFi.softAPgetStationNum()) + " clients connected!\n");
-      startApTimeMillis = millis(); // reset timeout as someone is connected
-      return;
-    }
-    logMessage("[WIFI] Running in AP mode but timeout reached. Closing AP!\n");
-    stopSoftAP();
-    delay(100);
+/**
+ * @brief Check if a connection attempt may be started now
+ * @return false while the SoftAP is running, during the backoff or without radio budget
+ */
+bool WIFIMANAGER::connectAllowed() {
+  if (linkState.read().softApRunning) {
+    logMessage("[WIFI] Not trying to connect to a known SSID. SoftAP has " + String(hal.radio->softAPgetStationNum()) + " clients connected!\n");
+    return false;
+  }
+  if (hal.clock->millis() < nextConnectMillis) {
+    logMessage("[WIFI] Backing off, next connection attempt in " + String((uint32_t)(nextConnectMillis - hal.clock->millis())) + " ms\n");
+    return false;
+  }
+  if (!radioBudgetAvailable()) {
+    logMessage("[WIFI] Radio budget exhausted, skipping connection attempt\n");
+    return false;
   }
+  return true;
 }
 
 /**
- * @brief Try to connect to one of the configured SSIDs (if available).
- * @details If more than 2 SSIDs configured, scan for available WIFIs and connect to the strongest
- * @return true on success
- * @return false on error or no configuration
+ * @brief Reset the backoff after a successful connection attempt or schedule the next one
+ * @details Starts the SoftAP after a failure if the fallback is enabled.
+ * @param connected Result of the connection attempt
  */
-bool WIFIMANAGER::tryConnect() {
-  if (!configAvailable()) {
-    logMessage("[WIFI] No SSIDs configured in NVS, unable to connect\n");
-    if (createFallbackAP) runSoftAP();
-    return false;
+void WIFIMANAGER::connectFinished(bool connected) {
+  if (connected) {
+    backoffMillis = 0;
+    nextConnectMillis = 0;
+    return;
   }
+  scheduleBackoff();
+  if (createFallbackAP) runSoftAP();
+  else logMessage("[WIFI] Auto creation of SoftAP is disabled, no starting AP!\n");
+}
 
-  if (softApRunning) {
-    logMessage("[WIFI] Not trying to connect. SoftAP has " + String(WiFi.softAPgetStationNum()) + " clients connected!\n");
+/**
+ * @brief Close the SoftAP if no client is connected after the timeout
+ * @return true if the SoftAP was closed
+ */
+bool WIFIMANAGER::checkSoftApTimeout() {
+  if (!linkState.read().softApRunning || hal.clock->millis() - startApTimeMillis <= timeoutApMillis) return false;
+  if (hal.radio->softAPgetStationNum() > 0) {
+    logMessage("[WIFI] SoftAP has " + String(hal.radio->softAPgetStationNum()) + " clients connected!\n");
+    startApTimeMillis = hal.clock->millis(); // reset timeout as someone is connected
     return false;
   }
+  logMessage("[WIFI] Running in AP mode but timeout reached. Closing AP!\n");
+  stopSoftAP();
+  return true;
+}
 
-  int choosenAp = INT_MIN;
-  if (configuredSSIDs == 1) {
-    // only one configured SSID, skip scanning and try to connect to this specific one.
-    choosenAp = getApEntry();
-  } else {
-    WiFi.mode(WIFI_STA);
-    int8_t scanResult = WiFi.scanNetworks(false, true);
-    if(scanResult <= 0) {
-      logMessage("[WIFI] Unable to find WIFI networks in range to this device!\n");
-      return false;
-    }
-    logMessage(String("[WIFI] Found ") + String(scanResult) + " networks in range\n");
-    int choosenRssi = INT_MIN;  // we want to select the strongest signal with the highest priority if we have multiple SSIDs available
-    for(int8_t x = 0; x < scanResult; ++x) {
-      String ssid;
-      uint8_t encryptionType;
-      int32_t rssi;
-      uint8_t* bssid;
-      int32_t channel;
-      WiFi.getNetworkInfo(x, ssid, encryptionType, rssi, bssid, channel);
-      for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
-        if (apList[i].apName.length() == 0 || apList[i].apName != ssid) continue;
-
-        if (rssi > choosenRssi) {
-          if(encryptionType == WIFI_AUTH_OPEN || apList[i].apPass.length() > 0) { // open wifi or we do know a password
-            choosenAp = i;
-            choosenRssi = rssi;
-          }
-        } // else lower wifi signal
-      }
+/**
+ * @brief Do the pending work without blocking, replaces the background task
+ * @details For applications with their own scheduler: instead of startBackgroundTask(),
+ * call tick() repeatedly and sleep for the returned time in between. Scans and connection
+ * attempts are started and then polled by the following calls instead of waiting for them.
+ * The health checks and the gateway check of a reused lease are skipped in this mode, as
+ * their probes block. If another task owns the radio, tick() returns without waiting for it.
+ * An attempt is abandoned if another task changed the radio state in between.
+ * @return uint32_t milliseconds until tick() needs to be called again
+ */
+uint32_t WIFIMANAGER::tick() {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_BACKGROUND, std::try_to_lock);
+  if (!radio.owns()) return WIFIMANAGER_TICK_POLL_MILLIS;
+  // another task changed the radio since the last call, the running attempt is void
+  if (tickState != WIFI_TICK_IDLE && radioOwner.sequence() != tickRadioSequence + 1) {
+    logMessage("[WIFI] Connection attempt cancelled\n");
+    tickState = WIFI_TICK_IDLE;
+    // unless the other task connected, stop the association and try again later
+    if (!linkState.read().gotIp) {
+      hal.radio->disconnect();
+      scheduleBackoff();
     }
-    WiFi.scanDelete();
   }
-
-  if (choosenAp == INT_MIN) {
-    logMessage("[WIFI] Unable to find an SSID to connect to!\n");
-    return false;
-  } else {
-    logMessage(String("[WIFI] Trying to connect to SSID ") + apList[choosenAp].apName 
-      + " with password " + (apList[choosenAp].apPass.length() > 0 ? "'***'" : "''") + "\n"
-    );
-
-    WiFi.begin(apList[choosenAp].apName.c_str(), apList[choosenAp].apPass.c_str());
-    wl_status_t status = (wl_status_t)WiFi.waitForConnectResult(5000UL);
-
-    auto startTime = millis();
-    // wait for connection, fail, or timeout
-    while(status != WL_CONNECTED && status != WL_NO_SSID_AVAIL && status != WL_CONNECT_FAILED && (millis() - startTime) <= 10000) {
-        delay(10);
-        status = (wl_status_t)WiFi.waitForConnectResult(5000UL);
-    }
-    switch(status) {
-      case WL_IDLE_STATUS:
-        logMessage("[WIFI] Connecting failed (0): Idle\n");
-        break;
-      case WL_NO_SSID_AVAIL:
-        logMessage("[WIFI] Connecting failed (1): The AP can't be found\n");
-        break;
-      case WL_SCAN_COMPLETED:
-        logMessage("[WIFI] Connecting failed (2): Scan completed\n");
-        break;
-      case WL_CONNECTED: // 3
-        logMessage("[WIFI] Connection successful\n");
-        logMessage("[WIFI] SSID   : " + WiFi.SSID() + "\n");
-        logMessage("[WIFI] IP     : " + WiFi.localIP().toString() + "\n");
-        stopSoftAP();
-        return true;
-        break;
-      case WL_CONNECT_FAILED:
-        logMessage("[WIFI] Connecting failed (4): Unknown reason\n");
-        break;
-      case WL_CONNECTION_LOST:
-        logMessage("[WIFI] Connecting failed (5): Connection lost\n");
-        break;
-      case WL_DISCONNECTED:
-        logMessage("[WIFI] Connecting failed (6): Disconnected\n");
-        break;
-      case WL_NO_SHIELD:
-        logMessage("[WIFI] Connecting failed (7): No Wifi shield found\n");
-        break;
-      default:
-        logMessage("[WIFI] Connecting failed (" + String(status) + "): Unknown status code\n");
-        break;
+  tickRadioSequence = radioOwner.sequence();
+
+  if (!tickStarted) {
+    tickStarted = true;
+    traceEvent(WIFI_TRACE_START, configuredSSIDs);
+    // check right away, after a deep sleep using the last network first
+    lastWifiCheckMillis = hal.clock->millis() - intervalWifiCheckMillis;
+    if (restoreRetainedState() && connectionCacheValid() && !apList[connectionCache.apId].block.blocked(hal.clock->millis())) {
+      lastWifiCheckMillis = hal.clock->millis();
+      tickStartMillis = lastWifiCheckMillis;
+      tickCached = true;
+      cachedCandidate(tickCandidates[0], tickIpConfig);
+      tickNumCandidates = 1;
+      tickCandidate = 0;
+      return tickNextCandidate();
     }
+    loadFromNVS();
   }
-  return false;
+  applyControlRequest();
+  applyReconnectRequest();
+  sampleLinkQuality();
+  updatePowerPolicy();
+
+  if (tickState == WIFI_TICK_SCANNING) return tickScan();
+  if (tickState == WIFI_TICK_CONNECTING) return tickConnect();
+
+  if (hal.clock->millis() - lastWifiCheckMillis >= intervalWifiCheckMillis) {
+    lastWifiCheckMillis = hal.clock->millis();
+    bool connected = hal.radio->status() == WIFI_LINK_CONNECTED;
+    wifiLinkState_t link = linkState.read();
+    if (connected && link.gotIp) {
+      superviseConnection(link, false);
+    } else if (connectAllowed()) {
+      return tickStartConnect();
+    }
+    checkSoftApTimeout();
+  }
+  return tickIdleMillis();
 }
 
-void WIFIMANAGER::configueSoftAp(String apName, String apPass) {
-  this->softApName = apName;
-  this->softApPass = apPass;
+/**
+ * @brief Start a connection attempt of tick(), by a scan if more than one SSID is configured
+ * @return uint32_t milliseconds until the next tick()
+ */
+uint32_t WIFIMANAGER::tickStartConnect() {
+  tickCached = false;
+  tickStartMillis = hal.clock->millis();
+  if (!readyToConnect()) {
+    connectFinished(false);
+    return tickIdleMillis();
+  }
+  if (configuredSSIDs == 1) {
+    tickNumCandidates = singleCandidate(tickCandidates);
+    tickCandidate = 0;
+    return tickNextCandidate();
+  }
+  hal.radio->setMode(WIFI_RADIO_STA);
+  metrics.scans++;
+  if (hal.radio->scan(true) == WIFI_RADIO_SCAN_FAILED) {
+    logMessage("[WIFI] Unable to start a scan\n");
+    connectFinished(false);
+    return tickIdleMillis();
+  }
+  tickState = WIFI_TICK_SCANNING;
+  return WIFIMANAGER_TICK_POLL_MILLIS;
 }
 
 /**
- * @brief Start a SoftAP for direct client access
- * @param apName name of the AP to create (default is ESP_XXXXXXXX)
- * @return true on success
- * @return false o error or if a SoftAP already runs
+ * @brief Poll the scan of tick() and start with the best candidate once it is finished
+ * @return uint32_t milliseconds until the next tick()
  */
-bool WIFIMANAGER::runSoftAP(String apName, String apPass) {
-  if (apName.length()) this->softApName = apName;
-  if (apPass.length()) this->softApPass = apPass;
+uint32_t WIFIMANAGER::tickScan() {
+  int16_t scanResult = hal.radio->scanComplete();
+  if (scanResult == WIFI_RADIO_SCAN_RUNNING) return WIFIMANAGER_TICK_POLL_MILLIS;
+
+  uint32_t scanMillis = hal.clock->millis() - tickStartMillis;
+  metrics.radioActiveMillis += scanMillis;
+  tickNumCandidates = collectCandidates(scanResult, scanMillis, tickCandidates);
+  tickCandidate = 0;
+  return tickNextCandidate();
+}
 
-  if (softApRunning) return true;
-  startApTimeMillis = millis();
+/**
+ * @brief Start the connection to the next candidate of tick() or finish the attempt
+ * @details If the cached network failed, the remaining networks are loaded and scanned.
+ * @return uint32_t milliseconds until the next tick()
+ */
+uint32_t WIFIMANAGER::tickNextCandidate() {
+  if (tickCandidate >= tickNumCandidates || tickCandidate >= maxConnectAttempts) {
+    tickState = WIFI_TICK_IDLE;
+    if (tickCached) {
+      loadFromNVS();
+      return tickStartConnect();
+    }
+    if (tickNumCandidates == 0) logMessage("[WIFI] Unable to find an SSID to connect to!\n");
+    connectFinished(false);
+    return tickIdleMillis();
+  }
+  tickJoinMillis = hal.clock->millis();
+  tickIpMode = beginCandidate(tickCandidates[tickCandidate], tickCached ? &tickIpConfig : nullptr);
+  tickState = WIFI_TICK_CONNECTING;
+  return WIFIMANAGER_TICK_POLL_MILLIS;
+}
 
-  if (this->softApName == "") this->softApName = "ESP_" + String((uint32_t)ESP.getEfuseMac());
-  logMessage("[WIFI] Starting configuration portal on AP SSID " + this->softApName + "\n");
+/**
+ * @brief Poll the connection attempt of tick()
+ * @return uint32_t milliseconds until the next tick()
+ */
+uint32_t WIFIMANAGER::tickConnect() {
+  wifiLinkStatus_t status = hal.radio->status();
+  if (status != WIFI_LINK_CONNECTED && status != WIFI_LINK_NO_SSID_AVAIL && status != WIFI_LINK_CONNECT_FAILED
+      && hal.clock->millis() - tickJoinMillis <= WIFIMANAGER_CONNECT_TIMEOUT_MILLIS) {
+    return WIFIMANAGER_TICK_POLL_MILLIS;
+  }
 
-  WiFi.mode(WIFI_AP);
-  bool state = WiFi.softAP(this->softApName.c_str(), (this->softApPass.length() ? this->softApPass.c_str() : NULL));
-  if (state) {
-    IPAddress IP = WiFi.softAPIP();
-    logMessage("[WIFI] AP created. My IP is: " + String(IP) + "\n");
-    return true;
-  } else {
-    logMessage("[WIFI] Unable to create SoftAP!\n");
-    return false;
+  tickState = WIFI_TICK_IDLE;
+  if (finishCandidate(tickCandidates[tickCandidate], status, tickIpMode, tickJoinMillis)) {
+    recordTimeToIp(tickStartMillis);
+    connectFinished(true);
+    return tickIdleMillis();
   }
+  tickCandidate++;
+  return tickNextCandidate();
 }
 
 /**
- * @brief Stop/Disconnect a current running SoftAP
+ * @brief Time until tick() has work to do while no connection attempt is running
+ * @return uint32_t milliseconds until the next check, link sample or power policy change
  */
-void WIFIMANAGER::stopSoftAP() {
-  WiFi.softAPdisconnect();
-  WiFi.mode(WIFI_STA);
+uint32_t WIFIMANAGER::tickIdleMillis() {
+  if (reconnectRequested) return 0;
+  uint64_t now = hal.clock->millis();
+  uint64_t next = lastWifiCheckMillis + intervalWifiCheckMillis;
+  if (lastLinkSampleMillis + intervalLinkSampleMillis < next) next = lastLinkSampleMillis + intervalLinkSampleMillis;
+  if (powerBoosted && lastActivityMillis + powerIdleTimeoutMillis < next) next = lastActivityMillis + powerIdleTimeoutMillis;
+  return next > now ? next - now : 0;
 }
 
 /**
- * @brief Stop/Disconnect a current wifi connection
+ * @brief Configure the backoff between failed connection attempts and the radio budget
+ * @param config New settings, used from the next failed attempt on
  */
-void WIFIMANAGER::stopClient() {
-  WiFi.disconnect();
+void WIFIMANAGER::configureBackoff(const wifiBackoffConfig_t & config) {
+  backoff = config;
+  if (backoff.multiplierPercent < 100) backoff.multiplierPercent = 100;
+  if (backoff.jitterPercent > 100) backoff.jitterPercent = 100;
+  if (backoff.radioDutyPercent == 0) backoff.radioDutyPercent = 1;
 }
 
 /**
- * @brief Stop/Disconnect all running wifi activies and optionally kill the background task as well
- * @param killTask true to kill the background task to prevent reconnects
+ * @brief Get the current backoff configuration
+ * @return const wifiBackoffConfig_t& settings
  */
-void WIFIMANAGER::stopWifi(bool killTask) {
-  if (killTask) vTaskDelete(WifiCheckTask);
-  stopSoftAP();
-  stopClient();
+const wifiBackoffConfig_t & WIFIMANAGER::getBackoffConfig() {
+  return backoff;
 }
 
 /**
- * @brief Attach the WebServer to the WifiManager to register the RESTful API
- * @param srv WebServer object
+ * @brief Reset the backoff so the next loop() run tries to connect immediately
+ * @details Use it if something relevant happened, like a known SSID becoming visible.
+ * Safe to call from any task, the request is applied by the owner of the radio.
  */
-#if ASYNC_WEBSERVER == true
-void WIFIMANAGER::attachWebServer(AsyncWebServer * srv) {
-#else
-void WIFIMANAGER::attachWebServer(WebServer * srv) {
-#endif
-  webServer = srv; // store it in the class for later use
+void WIFIMANAGER::triggerReconnect() {
+  reconnectRequested = true;
+}
 
-#if ASYNC_WEBSERVER == true
-  // not required
-#else
-  // just for debugging
-  webServer->onNotFound([&]() {
-    String uri = WebServer::urlDecode(webServer->uri());  // required to read paths with blanks
+/**
+ * @brief Apply a SoftAP or client request of the API that was queued while the radio was busy
+ */
+void WIFIMANAGER::applyControlRequest() {
+  wifiApiRoute_t route = (wifiApiRoute_t)controlRequested.exchange(WIFI_API_ROUTES);
+  if (route == WIFI_API_SOFTAP_START) runSoftAP();
+  else if (route == WIFI_API_SOFTAP_STOP) stopSoftAP();
+  else if (route == WIFI_API_CLIENT_STOP) stopClient();
+}
 
-     // Dump debug data
-    String message;
-    message.reserve(100);
-    message = F("Error: File not found\n\nURI: ");
-    message += uri;
-    message += F("\nMethod: ");
-    message += (webServer->method() == HTTP_GET) ? "GET" : "POST";
-    message += F("\nArguments: ");
-    message += webServer->args();
-    message += '\n';
-    for (uint8_t i = 0; i < webServer->args(); i++) {
-      message += F(" NAME:");
-      message += webServer->argName(i);
-      message += F("\n VALUE:");
-      message += webServer->arg(i);
-      message += '\n';
-    }
-    message += "path=";
-    message += webServer->arg("path");
-    message += '\n';
-    logMessage(message);
-  });
-#endif
+/**
+ * @brief Apply a pending triggerReconnect(), called by the owner of the radio
+ */
+void WIFIMANAGER::applyReconnectRequest() {
+  if (!reconnectRequested.exchange(false)) return;
+  backoffMillis = 0;
+  nextConnectMillis = 0;
+  lastWifiCheckMillis = 0;
+}
 
-#if ASYNC_WEBSERVER == true
-  webServer->on((apiPrefix + "/softap/start").c_str(), HTTP_POST, [&](AsyncWebServerRequest * request) {
-    request->send(200, "application/json", "{\"message\":\"Soft AP stopped\"}");
-#else
-  webServer->on((apiPrefix + "/softap/start").c_str(), HTTP_POST, [&]() {
-    webServer->send(200, "application/json", "{\"message\":\"Soft AP stopped\"}");
-#endif
-    yield();
-    delay(250);
-    runSoftAP();
-  });
-  
-#if ASYNC_WEBSERVER == true
-  webServer->on((apiPrefix + "/softap/stop").c_str(), HTTP_POST, [&](AsyncWebServerRequest * request) {
-    request->send(200, "application/json", "{\"message\":\"Soft AP stopped\"}");
-#else
-  webServer->on((apiPrefix + "/softap/stop").c_str(), HTTP_POST, [&]() {
-    webServer->send(200, "application/json", "{\"message\":\"Soft AP stopped\"}");
-#endif
-    yield();
-    delay(250); // It's likely that this message won't go trough, but we give it a short time
-    stopSoftAP();
-  });
+/**
+ * @brief Schedule the next connection attempt after a failure
+ * @details The delay grows exponentially up to the configured maximum and is varied
+ * by a random jitter, so devices losing their AP at the same time spread their attempts.
+ */
+void WIFIMANAGER::scheduleBackoff() {
+  if (backoffMillis == 0) backoffMillis = backoff.initialMillis;
+  else {
+    uint64_t next = (uint64_t)backoffMillis * backoff.multiplierPercent / 100;
+    backoffMillis = next > backoff.maxMillis ? backoff.maxMillis : next;
+  }
 
-#if ASYNC_WEBSERVER == true
-  webServer->on((apiPrefix + "/client/stop").c_str(), HTTP_POST, [&](AsyncWebServerRequest * request) {
-    request->send(200, "application/json", "{\"message\":\"Terminating current Wifi connection\"}");
-#else
-  webServer->on((apiPrefix + "/client/stop").c_str(), HTTP_POST, [&]() {
-    webServer->send(200, "application/json", "{\"message\":\"Terminating current Wifi connection\"}");
-#endif
-    yield();
-    delay(500); // It's likely that this message won't go trough, but we give it a short time
-    stopClient();
-  });
+  uint32_t delayMillis = backoffMillis;
+  if (backoff.jitterPercent > 0) {
+    // xorshift32, seeded per device so the jitter differs within a fleet
+    if (jitterSeed == 0) jitterSeed = (uint32_t)(hal.radio->deviceId() ^ (hal.radio->deviceId() >> 32) ^ hal.clock->micros()) | 1;
+    jitterSeed ^= jitterSeed << 13;
+    jitterSeed ^= jitterSeed >> 17;
+    jitterSeed ^= jitterSeed << 5;
+    uint32_t range = 2 * backoff.jitterPercent + 1;
+    delayMillis = (uint64_t)backoffMillis * (100 - backoff.jitterPercent + jitterSeed % range) / 100;
+  }
+  nextConnectMillis = hal.clock->millis() + delayMillis;
+  traceEvent(WIFI_TRACE_BACKOFF, 0, 0, delayMillis);
+}
 
-#if ASYNC_WEBSERVER == true
-  webServer->on((apiPrefix + "/add").c_str(), HTTP_POST, [&](AsyncWebServerRequest * request){}, NULL,
-    [&](AsyncWebServerRequest * request, uint8_t *data, size_t len, size_t index, size_t total) {
-    JsonDocument jsonBuffer;
-    deserializeJson(jsonBuffer, (const char*)data);
-    auto resp = request;
-#else
-  webServer->on((apiPrefix + "/add").c_str(), HTTP_POST, [&]() {
-    if (webServer->args() != 1) {
-      webServer->send(400, "application/json", "{\"message\":\"Bad Request. Only accepting one json body in request!\"}");
+/**
+ * @brief Check whether the radio budget allows another connection attempt
+ * @return true if the time spent scanning and connecting within the current window is below the budget
+ */
+bool WIFIMANAGER::radioBudgetAvailable() {
+  if (backoff.radioDutyPercent >= 100) return true;
+
+  uint64_t now = hal.clock->millis();
+  if (now - dutyWindowStartMillis >= backoff.dutyWindowMillis) {
+    dutyWindowStartMillis = now;
+    dutyWindowRadioMillis = metrics.radioActiveMillis;
+  }
+  uint64_t used = metrics.radioActiveMillis - dutyWindowRadioMillis;
+  return used * 100 < (uint64_t)backoff.radioDutyPercent * backoff.dutyWindowMillis;
+}
+
+/**
+ * @brief Check if the completed scan contains one of the known SSIDs
+ * @param scanResult Number of available scan records
+ * @return true if at least one record matches a stored SSID
+ */
+bool WIFIMANAGER::scanSeesKnownSsid(int16_t scanResult) {
+  wifiScanRecord_t record;
+  for(int16_t x = 0; x < scanResult; x++) {
+    if (!hal.radio->scanRecord(x, record)) continue;
+    uint8_t ssidLen = strnlen((const char *)record.ssid, sizeof(record.ssid));
+    uint32_t hash = hashSsid(record.ssid, ssidLen);
+    for(uint16_t pos = hash % WIFIMANAGER_SSID_INDEX_SIZE; ssidIndex[pos] != 0; pos = (pos + 1) % WIFIMANAGER_SSID_INDEX_SIZE) {
+      uint8_t i = ssidIndex[pos] - 1;
+      if (apList[i].ssidHash == hash && apList[i].apName.length() == ssidLen && memcmp(apList[i].apName.c_str(), record.ssid, ssidLen) == 0) return true;
     }
-    JsonDocument jsonBuffer;
-    deserializeJson(jsonBuffer, webServer->arg(0));
-    auto resp = webServer;
-#endif
-    if (!jsonBuffer["apName"].is<String>() || !jsonBuffer["apPass"].is<String>()) {
-      resp->send(422, "application/json", "{\"message\":\"Invalid data\"}");
-      return;
+  }
+  return false;
+}
+
+/**
+ * @brief Name of a power policy as used by the API
+ * @param policy Power policy
+ * @return const char* name
+ */
+static const char * powerPolicyName(wifiPowerPolicy_t policy) {
+  switch(policy) {
+    case WIFI_POWER_LOW_LATENCY: return "lowLatency";
+    case WIFI_POWER_BALANCED: return "balanced";
+    case WIFI_POWER_MAX_SAVINGS: return "maxSavings";
+    default: return "adaptive";
+  }
+}
+
+/**
+ * @brief Set the power policy of the station
+ * @details Modem sleep saves a lot of power but delays inbound packets until the next
+ * beacon the radio wakes up for, typically 100 ms or more. The adaptive policy disables
+ * the modem sleep on notifyActivity() and enables it again after the idle timeout.
+ * @param policy Power policy to use
+ * @param idleTimeoutMillis Adaptive policy: time without activity until the modem sleeps again
+ */
+void WIFIMANAGER::setPowerPolicy(wifiPowerPolicy_t policy, uint32_t idleTimeoutMillis) {
+  powerPolicy = policy;
+  powerIdleTimeoutMillis = idleTimeoutMillis;
+  powerBoosted = false;
+  requestPowerPolicy();
+}
+
+/**
+ * @brief Get the power policy of the station
+ * @return wifiPowerPolicy_t current policy
+ */
+wifiPowerPolicy_t WIFIMANAGER::getPowerPolicy() {
+  return powerPolicy;
+}
+
+/**
+ * @brief Apply the power policy to the radio
+ */
+void WIFIMANAGER::applyPowerPolicy() {
+  switch(powerPolicy) {
+    case WIFI_POWER_LOW_LATENCY:
+      hal.radio->setPowerSave(WIFI_POWER_SAVE_NONE);
+      break;
+    case WIFI_POWER_MAX_SAVINGS:
+      hal.radio->setPowerSave(WIFI_POWER_SAVE_MAX_MODEM);
+      break;
+    case WIFI_POWER_ADAPTIVE:
+      hal.radio->setPowerSave(powerBoosted ? WIFI_POWER_SAVE_NONE : WIFI_POWER_SAVE_MIN_MODEM);
+      break;
+    default:
+      hal.radio->setPowerSave(WIFI_POWER_SAVE_MIN_MODEM);
+      break;
+  }
+}
+
+/**
+ * @brief Apply the power policy without waiting for the radio
+ * @details Called from the webserver and application tasks. If another task owns the radio,
+ * the change is left to the next loop() or tick().
+ */
+void WIFIMANAGER::requestPowerPolicy() {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, std::try_to_lock, WIFI_RADIO_READ);
+  if (!radio.owns()) {
+    powerPolicyPending = true;
+    return;
+  }
+  powerPolicyPending = false;
+  applyPowerPolicy();
+}
+
+/**
+ * @brief Report network activity
+ * @details All API endpoints call it. Call it from your own handlers as well, to keep
+ * the adaptive policy in low latency mode while requests come in. Never blocks.
+ */
+void WIFIMANAGER::notifyActivity() {
+  lastActivityMillis = hal.clock->millis();
+  if (powerPolicy != WIFI_POWER_ADAPTIVE || powerBoosted.exchange(true)) return;
+  requestPowerPolicy();
+}
+
+/**
+ * @brief Apply a pending power policy, adaptive policy: enable the modem sleep again after the idle timeout
+ */
+void WIFIMANAGER::updatePowerPolicy() {
+  if (powerPolicyPending.exchange(false)) applyPowerPolicy();
+  if (!powerBoosted || hal.clock->millis() - lastActivityMillis < powerIdleTimeoutMillis) return;
+  powerBoosted = false;
+  applyPowerPolicy();
+}
+
+/**
+ * @brief Set the interval of the link quality samples
+ * @details The background task runs the loop at least every 10 seconds, shorter intervals make it run more often.
+ * @param intervalMillis Time between two samples, at least 100 ms
+ */
+void WIFIMANAGER::setLinkSampleInterval(uint32_t intervalMillis) {
+  intervalLinkSampleMillis = intervalMillis < 100 ? 100 : intervalMillis;
+}
+
+/**
+ * @brief Set the weight of a new sample for the smoothed RSSI
+ * @param alphaPercent 1 reacts very slowly, 100 disables the smoothing
+ */
+void WIFIMANAGER::setRssiSmoothing(uint8_t alphaPercent) {
+  if (alphaPercent == 0) alphaPercent = 1;
+  std::lock_guard<std::mutex> lock(linkQualityMutex);
+  linkQuality.alphaPercent = alphaPercent > 100 ? 100 : alphaPercent;
+}
+
+/**
+ * @brief Get the RSSI history of the current connection
+ * @details Returns a copy, the history is updated by the background task.
+ * @return WifiLinkQuality samples, smoothed value and min/max
+ */
+WifiLinkQuality WIFIMANAGER::getLinkQuality() {
+  std::lock_guard<std::mutex> lock(linkQualityMutex);
+  return linkQuality;
+}
+
+/**
+ * @brief Sample the signal strength of the current connection if due
+ */
+void WIFIMANAGER::sampleLinkQuality() {
+  uint64_t now = hal.clock->millis();
+  if (lastLinkSampleMillis > 0 && now - lastLinkSampleMillis < intervalLinkSampleMillis) return;
+  lastLinkSampleMillis = now;
+
+  wifiLinkInfo_t link;
+  if (!hal.radio->linkInfo(link)) return;
+  {
+    std::lock_guard<std::mutex> lock(linkQualityMutex);
+    linkQuality.add(now, link.bssid, link.rssi, link.channel);
+  }
+  linkState.update([&](wifiLinkState_t & state) { state.rssi = link.rssi; });
+}
+
+/**
+ * @brief Configure the connectivity health checks of an established connection
+ * @details Being associated does not mean the network works. The checks ping the gateway,
+ * resolve a hostname and GET an URL, each only if configured. Keep the interval long,
+ * every check costs radio time.
+ * @param config New settings
+ */
+void WIFIMANAGER::configureHealthCheck(const wifiHealthConfig_t & config) {
+  healthConfig = config;
+  if (healthConfig.failureThreshold == 0) healthConfig.failureThreshold = 1;
+  health.consecutiveFailures = 0;
+}
+
+/**
+ * @brief Get the results of the health checks
+ * @return const wifiHealth_t& probe statistics and current state
+ */
+const wifiHealth_t & WIFIMANAGER::getHealth() {
+  return health;
+}
+
+/**
+ * @brief Get the state of the station and SoftAP
+ * @details The state is maintained by the radio events, reading it needs no driver call
+ * and never blocks on the radio. The RSSI is updated with each link sample.
+ * @return wifiLinkState_t consistent copy of the current state
+ */
+wifiLinkState_t WIFIMANAGER::getLinkState() {
+  return linkState.read();
+}
+
+/**
+ * @brief Get the binary event trace
+ * @details Records scans, connection attempts and their results, disconnect reasons,
+ * backoff and blacklisting decisions with a microsecond timestamp. Decode an export
+ * of /trace with tools/trace_decode.py.
+ * @return const WifiTrace& ring buffer of the recent events
+ */
+const WifiTrace & WIFIMANAGER::getTrace() {
+  return trace;
+}
+
+/**
+ * @brief Set the stack size, priority and core of the background task
+ * @details Has to be called before startBackgroundTask(). Use the stackFreeMin of
+ * getTaskUsage() after some time of operation to find a smaller stack size.
+ * @param config Settings of the task
+ */
+void WIFIMANAGER::setTaskConfig(const wifiTaskConfig_t & config) {
+  taskConfig = config;
+}
+
+/**
+ * @brief Get the settings of the background task
+ * @return const wifiTaskConfig_t& stack size, priority and core
+ */
+const wifiTaskConfig_t & WIFIMANAGER::getTaskConfig() {
+  return taskConfig;
+}
+
+/**
+ * @brief Get the stack and CPU usage of the background task
+ * @return const wifiTaskUsage_t& usage, updated after each loop() run of the task
+ */
+const wifiTaskUsage_t & WIFIMANAGER::getTaskUsage() {
+  return taskUsage;
+}
+
+/**
+ * @brief Update the stack and CPU usage of the background task
+ * @details The CPU time counters of the platform are 32 bit and wrap around,
+ * they are accumulated here on each run of the task.
+ * @param loopMicros Duration of the last loop() run
+ */
+void WIFIMANAGER::sampleTaskUsage(uint64_t loopMicros) {
+  taskUsage.loops++;
+  taskUsage.loopMicros += loopMicros;
+
+  wifiTaskStats_t stats;
+  taskUsage.statsValid = hal.tasks->stats(WifiCheckTask, stats);
+  if (!taskUsage.statsValid) return;
+  taskUsage.stackFreeMin = stats.stackFreeMin;
+  if (!stats.runTimeValid) return;
+  if (taskUsage.cpuValid) {
+    taskUsage.runTime += (uint32_t)(stats.runTime - taskUsage.lastRunTime);
+    taskUsage.runTimeTotal += (uint32_t)(stats.runTimeTotal - taskUsage.lastRunTimeTotal);
+  }
+  taskUsage.lastRunTime = stats.runTime;
+  taskUsage.lastRunTimeTotal = stats.runTimeTotal;
+  taskUsage.cpuValid = true;
+}
+
+/**
+ * @brief Update the statistics of a single probe
+ * @param stats Statistics of the probe type
+ * @param result Latency or WIFI_PROBE_*
+ * @return true if the probe succeeded or is not supported by the platform
+ */
+bool WIFIMANAGER::recordProbe(wifiProbeStats_t & stats, int32_t result) {
+  if (result == WIFI_PROBE_UNSUPPORTED) return true;
+  stats.runs++;
+  stats.lastLatencyMillis = result;
+  if (result < 0) {
+    stats.failures++;
+    return false;
+  }
+  if (stats.runs - stats.failures == 1) stats.avgLatencyMillis = result;
+  else stats.avgLatencyMillis = (stats.avgLatencyMillis * 7 + result) / 8;
+  return true;
+}
+
+/**
+ * @brief Run the health checks if due and act on repeated failures
+ * @details The probes run in order gateway, DNS, HTTP and stop at the first failure.
+ * A connection without an IP address is considered unhealthy as well. The check is
+ * postponed if another task requests the radio with a higher priority.
+ * @param apId ID of the connected network within the apList
+ * @param link Information about the current connection
+ */
+void WIFIMANAGER::checkHealth(uint8_t apId, const wifiLinkState_t & link) {
+  if (healthConfig.intervalMillis == 0) return;
+  uint64_t now = hal.clock->millis();
+  if (health.checks > 0 && now - health.lastCheckMillis < healthConfig.intervalMillis) return;
+  if (radioOwner.cancelled()) return;
+  health.lastCheckMillis = now;
+  health.checks++;
+
+  bool healthy = link.ip != 0;
+  if (healthy && healthConfig.probeGateway) {
+    healthy = recordProbe(health.gateway, hal.radio->probeGateway(link.gateway, healthConfig.timeoutMillis));
+  }
+  if (healthy && healthConfig.dnsHost.length() && !radioOwner.cancelled()) {
+    healthy = recordProbe(health.dns, hal.radio->probeDns(healthConfig.dnsHost.c_str(), healthConfig.timeoutMillis));
+  }
+  if (healthy && healthConfig.httpUrl.length() && !radioOwner.cancelled()) {
+    healthy = recordProbe(health.http, hal.radio->probeHttp(healthConfig.httpUrl.c_str(), healthConfig.httpStatus, healthConfig.timeoutMillis));
+  }
+  metrics.radioActiveMillis += hal.clock->millis() - now;
+  if (radioOwner.cancelled()) {
+    // another task needs the radio, repeat the incomplete check with the next run
+    health.lastCheckMillis = now - healthConfig.intervalMillis;
+    health.checks--;
+    return;
+  }
+
+  // trace failures and the recovery, not every periodic check
+  bool wasHealthy = health.healthy;
+  health.healthy = healthy;
+  if (healthy) {
+    if (!wasHealthy) traceEvent(WIFI_TRACE_HEALTH, 1);
+    health.consecutiveFailures = 0;
+    return;
+  }
+  if (health.consecutiveFailures < UINT8_MAX) health.consecutiveFailures++;
+  logMessage("[WIFI] Health check failed " + String(health.consecutiveFailures) + " times in a row\n");
+  if (health.consecutiveFailures < healthConfig.failureThreshold || healthConfig.action == WIFI_HEALTH_ACTION_NONE) {
+    traceEvent(WIFI_TRACE_HEALTH, 0, health.consecutiveFailures, WIFI_HEALTH_ACTION_NONE);
+    return;
+  }
+  traceEvent(WIFI_TRACE_HEALTH, 0, health.consecutiveFailures, configuredSSIDs > 1 ? healthConfig.action : WIFI_HEALTH_ACTION_RECONNECT);
+
+  health.consecutiveFailures = 0;
+  health.actions++;
+  if (healthConfig.action == WIFI_HEALTH_ACTION_FAILOVER && configuredSSIDs > 1) {
+    logMessage("[WIFI] Network seems to be broken, failing over to another SSID\n");
+    wifiCandidate_t candidate = wifiCandidate_t();
+    candidate.apId = apId;
+    recordFailure(candidate, WIFI_FAILURE_NO_UPLINK);
+  } else {
+    logMessage("[WIFI] Network seems to be broken, reconnecting\n");
+  }
+  hal.radio->disconnect();
+  triggerReconnect();
+}
+
+/**
+ * @brief Try to connect to one of the configured SSIDs (if available).
+ * @details If more than 2 SSIDs configured, scan for available WIFIs, order them using the
+ * selection strategy and try the best rated ones until one is connected. Gives up early
+ * if another task requests the radio with a higher priority.
+ * @see setSelectionStrategy()
+ * @return true on success
+ * @return false on error or no configuration
+ */
+bool WIFIMANAGER::tryConnect() {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION);
+  if (!readyToConnect() || radioOwner.cancelled()) return false;
+
+  uint64_t startMillis = hal.clock->millis();
+  wifiCandidate_t candidates[WIFIMANAGER_MAX_CANDIDATES];
+  uint8_t numCandidates = 0;
+  if (configuredSSIDs == 1) {
+    numCandidates = singleCandidate(candidates);
+  } else {
+    hal.radio->setMode(WIFI_RADIO_STA);
+    int16_t scanResult = scanUntilComplete();
+    metrics.scans++;
+    metrics.radioActiveMillis += hal.clock->millis() - startMillis;
+    numCandidates = collectCandidates(scanResult, hal.clock->millis() - startMillis, candidates);
+  }
+
+  if (numCandidates == 0) {
+    logMessage("[WIFI] Unable to find an SSID to connect to!\n");
+    return false;
+  }
+
+  for(uint8_t c = 0; c < numCandidates && c < maxConnectAttempts && !radioOwner.cancelled(); c++) {
+    if (connectToCandidate(candidates[c])) {
+      recordTimeToIp(startMillis);
+      return true;
     }
-    if (!addWifi(jsonBuffer["apName"].as<String>(), jsonBuffer["apPass"].as<String>())) {
-      resp->send(500, "application/json", "{\"message\":\"Unable to process data\"}");
-    } else resp->send(200, "application/json", "{\"message\":\"New AP added\"}");
-  });
+  }
+  return false;
+}
 
-#if ASYNC_WEBSERVER == true
-  webServer->on((apiPrefix + "/id").c_str(), HTTP_DELETE, [&](AsyncWebServerRequest * request){}, NULL,
-    [&](AsyncWebServerRequest * request, uint8_t *data, size_t len, size_t index, size_t total) {
-    JsonDocument jsonBuffer;
-    deserializeJson(jsonBuffer, (const char*)data);
-    auto resp = request;
-#else
-  webServer->on((apiPrefix + "/id").c_str(), HTTP_DELETE, [&]() {
-    if (webServer->args() != 1) {
-      webServer->send(400, "application/json", "{\"message\":\"Bad Request. Only accepting one json body in request!\"}");
+/**
+ * @brief Scan for networks and wait for the result
+ * @details Polls the scan in slices, so the radio is released early if another task
+ * requests it with a higher priority.
+ * @return int16_t number of records, WIFI_RADIO_SCAN_RUNNING if cancelled or WIFI_RADIO_SCAN_FAILED
+ */
+int16_t WIFIMANAGER::scanUntilComplete() {
+  int16_t scanResult = hal.radio->scan(true);
+  while (scanResult == WIFI_RADIO_SCAN_RUNNING && !radioOwner.cancelled()) {
+    hal.clock->delay(WIFIMANAGER_CANCEL_POLL_MILLIS);
+    scanResult = hal.radio->scanComplete();
+  }
+  return scanResult;
+}
+
+/**
+ * @brief Check the preconditions of a connection attempt
+ * @details Loads the remaining networks if only the cached one is known and starts the
+ * SoftAP if nothing is configured.
+ * @return true if a connection attempt can be made
+ */
+bool WIFIMANAGER::readyToConnect() {
+  if (apListPartial) loadFromNVS();
+  if (!configAvailable()) {
+    logMessage("[WIFI] No SSIDs configured in NVS, unable to connect\n");
+    if (createFallbackAP) runSoftAP();
+    return false;
+  }
+
+  if (linkState.read().softApRunning) {
+    logMessage("[WIFI] Not trying to connect. SoftAP has " + String(hal.radio->softAPgetStationNum()) + " clients connected!\n");
+    return false;
+  }
+  return true;
+}
+
+/**
+ * @brief Use the only configured SSID as candidate, skips the scan
+ * @param candidates Output list with space for one entry
+ * @return uint8_t number of candidates, 0 if the network is blocked
+ */
+uint8_t WIFIMANAGER::singleCandidate(wifiCandidate_t * candidates) {
+  uint8_t apId = getApEntry();
+  candidates[0] = wifiCandidate_t();
+  candidates[0].apId = apId;
+  candidates[0].network = apList[apId];
+  return isBlocked(candidates[0]) ? 0 : 1;
+}
+
+/**
+ * @brief Match the finished scan against the configured SSIDs and rank the results
+ * @param scanResult Number of scan records or WIFI_RADIO_SCAN_*
+ * @param scanMillis Duration of the scan
+ * @param candidates Output list with space for WIFIMANAGER_MAX_CANDIDATES entries
+ * @return uint8_t number of candidates, best rated first
+ */
+uint8_t WIFIMANAGER::collectCandidates(int16_t scanResult, uint32_t scanMillis, wifiCandidate_t * candidates) {
+  if(scanResult <= 0) {
+    logMessage("[WIFI] Unable to find WIFI networks in range to this device!\n");
+    return 0;
+  }
+  logMessage(String("[WIFI] Found ") + String(scanResult) + " networks in range\n");
+  traceEvent(WIFI_TRACE_SCAN, 0, scanResult, scanMillis);
+  uint8_t numCandidates = 0;
+  for(int16_t x = 0; x < scanResult; ++x) {
+    // match the raw scan record against the SSID index, no String required
+    wifiScanRecord_t record;
+    if (!hal.radio->scanRecord(x, record)) continue;
+    uint8_t ssidLen = strnlen((const char *)record.ssid, sizeof(record.ssid));
+    uint32_t hash = hashSsid(record.ssid, ssidLen);
+    int8_t rssi = record.rssi;
+
+    for(uint16_t pos = hash % WIFIMANAGER_SSID_INDEX_SIZE; ssidIndex[pos] != 0; pos = (pos + 1) % WIFIMANAGER_SSID_INDEX_SIZE) {
+      uint8_t i = ssidIndex[pos] - 1;
+      if (apList[i].ssidHash != hash || apList[i].apName.length() != ssidLen) continue;
+      if (memcmp(apList[i].apName.c_str(), record.ssid, ssidLen) != 0) continue;
+      traceEvent(WIFI_TRACE_SCAN_AP, record.channel, (uint8_t)rssi | record.authmode << 8, hash, wifiTraceBssid(record.bssid));
+      if(record.authmode != 0 && apList[i].apPass.length() == 0) continue; // need a password we don't know for a non open network
+
+      wifiCandidate_t candidate;
+      candidate.apId = i;
+      candidate.rssi = rssi;
+      candidate.channel = record.channel;
+      memcpy(candidate.bssid, record.bssid, sizeof(candidate.bssid));
+      candidate.network = apList[i];
+      if (isBlocked(candidate)) continue;
+
+      uint8_t slot = numCandidates;
+      if (numCandidates == WIFIMANAGER_MAX_CANDIDATES) {
+        // list is full, replace the weakest entry if this one is stronger
+        slot = 0;
+        for(uint8_t c = 1; c < numCandidates; c++) {
+          if (candidates[c].rssi < candidates[slot].rssi) slot = c;
+        }
+        if (candidates[slot].rssi >= rssi) continue;
+      } else numCandidates++;
+
+      candidates[slot] = candidate;
     }
-    JsonDocument jsonBuffer;
-    deserializeJson(jsonBuffer, webServer->arg(0));
-    auto resp = webServer;
-#endif
-    if (!jsonBuffer["id"].is<uint8_t>() || jsonBuffer["id"].as<uint8_t>() >= WIFIMANAGER_MAX_APS) {
-      resp->send(422, "application/json", "{\"message\":\"Invalid data\"}");
+  }
+  hal.radio->scanDelete();
+  return selection->rank(candidates, numCandidates);
+}
+
+/**
+ * @brief Add a time to IP sample
+ * @param startMillis Time the connection attempt started
+ */
+void WIFIMANAGER::recordTimeToIp(uint64_t startMillis) {
+  metrics.timeToIpMillis[metrics.timeToIpPos] = hal.clock->millis() - startMillis;
+  metrics.timeToIpPos = (metrics.timeToIpPos + 1) % WIFIMANAGER_METRICS_SAMPLES;
+  if (metrics.timeToIpCount < WIFIMANAGER_METRICS_SAMPLES) metrics.timeToIpCount++;
+}
+
+/**
+ * @brief Connect to the BSSID and channel of the last connection reusing its IP lease
+ * @param startMillis Start of the connection attempt, for the time to IP
+ * @return true on success, false if there is no cache or the connection failed
+ */
+bool WIFIMANAGER::connectCached(uint64_t startMillis) {
+  if (!connectionCacheValid() || apList[connectionCache.apId].block.blocked(startMillis)) return false;
+
+  wifiCandidate_t candidate;
+  wifiIpConfig_t lease;
+  cachedCandidate(candidate, lease);
+  if (connectToCandidate(candidate, &lease)) {
+    recordTimeToIp(startMillis);
+    return true;
+  }
+  return false;
+}
+
+/**
+ * @brief Build the candidate and IP configuration of the cached connection
+ * @param candidate Cached BSSID and channel
+ * @param lease Cached IP lease, or the static configuration of the network
+ */
+void WIFIMANAGER::cachedCandidate(wifiCandidate_t & candidate, wifiIpConfig_t & lease) {
+  logMessage("[WIFI] Connecting using the cached connection\n");
+  hal.radio->setMode(WIFI_RADIO_STA);
+  candidate = wifiCandidate_t();
+  candidate.apId = connectionCache.apId;
+  candidate.channel = connectionCache.channel;
+  memcpy(candidate.bssid, connectionCache.bssid, sizeof(candidate.bssid));
+  candidate.network = apList[candidate.apId];
+
+  // a static configuration of the network wins over the cached lease
+  lease = apList[candidate.apId].ipConfig;
+  if (lease.mode != WIFI_IP_STATIC) {
+    lease.mode = WIFI_IP_LAST_LEASE;
+    lease.ip = connectionCache.ip;
+    lease.gateway = connectionCache.gateway;
+    lease.netmask = connectionCache.netmask;
+    lease.dns = connectionCache.dns;
+  }
+}
+
+/**
+ * @brief Connect as fast as possible, run the work and disable the radio again
+ * @details Made for battery powered devices waking up to send some data. Instead of
+ * startBackgroundTask(), call it after each wake up. The last successful connection is
+ * cached in the NVS, so the scan and DHCP are skipped by connecting to the same BSSID
+ * on the same channel reusing the last IP lease. If that fails, the normal connection
+ * path with scan and DHCP is used. Without a configured SSID the radio stays off and the
+ * SoftAP is not started.
+ * @param work Callback executed while connected, e.g. to send a reading
+ * @return wifiBurstResult_t connection state and timings
+ */
+wifiBurstResult_t WIFIMANAGER::burst(std::function<void()> work) {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION);
+  wifiBurstResult_t result;
+  uint64_t startMillis = hal.clock->millis();
+  metrics.bursts++;
+  if (!configAvailable() && !restoreRetainedState()) loadFromNVS();
+  if (!configAvailable()) {
+    // nothing to connect to, and nobody is around to use a SoftAP
+    logMessage("[WIFI] No SSIDs configured, burst skipped\n");
+    return result;
+  }
+
+  hal.radio->setMode(WIFI_RADIO_STA);
+  result.usedCache = connectCached(startMillis);
+  result.connected = result.usedCache || tryConnect();
+  result.connectMillis = hal.clock->millis() - startMillis;
+
+  if (result.connected && work) work();
+
+  hal.radio->disconnect();
+  hal.radio->setMode(WIFI_RADIO_OFF);
+  result.radioOnMillis = hal.clock->millis() - startMillis;
+  metrics.lastBurstRadioMillis = result.radioOnMillis;
+  logMessage("[WIFI] Burst finished, radio was on for " + String(result.radioOnMillis) + " ms\n");
+  return result;
+}
+
+/**
+ * @brief Get the connection statistics
+ * @return const wifiMetrics_t& counters since boot or the last resetMetrics()
+ */
+const wifiMetrics_t & WIFIMANAGER::getMetrics() {
+  return metrics;
+}
+
+/**
+ * @brief Calculate a percentile of the recent time to IP samples
+ * @details Uses the nearest rank method on the last WIFIMANAGER_METRICS_SAMPLES successful connections.
+ * @param percentile Percentile between 0 and 100
+ * @return uint32_t time in milliseconds, 0 if no sample is available
+ */
+uint32_t WIFIMANAGER::getTimeToIpPercentile(uint8_t percentile) {
+  if (metrics.timeToIpCount == 0) return 0;
+  if (percentile > 100) percentile = 100;
+
+  uint32_t sorted[WIFIMANAGER_METRICS_SAMPLES];
+  uint8_t count = metrics.timeToIpCount;
+  for(uint8_t i = 0; i < count; i++) {
+    // insertion sort, the sample list is short
+    uint8_t pos = i;
+    while (pos > 0 && sorted[pos-1] > metrics.timeToIpMillis[i]) {
+      sorted[pos] = sorted[pos-1];
+      pos--;
+    }
+    sorted[pos] = metrics.timeToIpMillis[i];
+  }
+  uint16_t rank = (percentile * count + 99) / 100;
+  return sorted[rank > 0 ? rank - 1 : 0];
+}
+
+/**
+ * @brief Reset all connection statistics
+ */
+void WIFIMANAGER::resetMetrics() {
+  metrics = wifiMetrics_t();
+}
+
+/**
+ * @brief Start the connection to a candidate
+ * @param candidate Network to connect to, channel and BSSID are used if known from a scan
+ */
+void WIFIMANAGER::startJoin(const wifiCandidate_t & candidate) {
+  const apCredentials_t & ap = apList[candidate.apId];
+  if (candidate.channel > 0) {
+    hal.radio->begin(ap.apName.c_str(), ap.apPass.c_str(), candidate.channel, candidate.bssid);
+  } else {
+    hal.radio->begin(ap.apName.c_str(), ap.apPass.c_str());
+  }
+}
+
+/**
+ * @brief Wait until the connection started by startJoin() is established or failed
+ * @return wifiLinkStatus_t final state
+ */
+wifiLinkStatus_t WIFIMANAGER::waitForJoin() {
+  wifiLinkStatus_t status = waitForLink(5000UL);
+
+  auto startTime = hal.clock->millis();
+  // wait for connection, fail, timeout or cancellation
+  while(status != WIFI_LINK_CONNECTED && status != WIFI_LINK_NO_SSID_AVAIL && status != WIFI_LINK_CONNECT_FAILED
+      && (hal.clock->millis() - startTime) <= WIFIMANAGER_CONNECT_TIMEOUT_MILLIS - 5000UL && !radioOwner.cancelled()) {
+      hal.clock->delay(10);
+      status = waitForLink(5000UL);
+  }
+  return status;
+}
+
+/**
+ * @brief Wait until the station is connected or failed, in slices to notice a cancellation
+ * @param timeoutMillis Max time to wait
+ * @return wifiLinkStatus_t state at the end of the wait
+ */
+wifiLinkStatus_t WIFIMANAGER::waitForLink(uint32_t timeoutMillis) {
+  uint64_t startMillis = hal.clock->millis();
+  wifiLinkStatus_t status;
+  do {
+    uint64_t sliceMillis = hal.clock->millis();
+    uint32_t slice = timeoutMillis < WIFIMANAGER_CANCEL_POLL_MILLIS ? timeoutMillis : WIFIMANAGER_CANCEL_POLL_MILLIS;
+    status = hal.radio->waitForConnectResult(slice);
+    if (hal.clock->millis() - sliceMillis < slice) break;  // returned early, the state is final
+  } while (hal.clock->millis() - startMillis < timeoutMillis && !radioOwner.cancelled());
+  return status;
+}
+
+/**
+ * @brief Connect to a single candidate and wait for the connection result
+ * @details If the candidate comes from a scan, its channel and BSSID are used to skip the driver side scan.
+ * A static IP or reused lease skips the DHCP.
+ * @param candidate Network to connect to
+ * @param ipConfig IP configuration to use instead of the one of the network, e.g. a cached lease
+ * @return true on success
+ * @return false on error
+ */
+bool WIFIMANAGER::connectToCandidate(const wifiCandidate_t & candidate, const wifiIpConfig_t * ipConfig) {
+  if (ipConfig == nullptr) ipConfig = &apList[candidate.apId].ipConfig;
+  uint64_t startMillis = hal.clock->millis();
+  wifiIpMode_t ipMode = beginCandidate(candidate, ipConfig);
+
+  // a reused lease is verified by reaching the gateway
+  wifiLinkStatus_t status = waitForJoin();
+  if (status != WIFI_LINK_CONNECTED && radioOwner.cancelled()) {
+    logMessage("[WIFI] Connection attempt cancelled\n");
+    hal.radio->disconnect();
+    metrics.radioActiveMillis += hal.clock->millis() - startMillis;
+    traceEvent(WIFI_TRACE_CONNECT_RESULT, status, 0, hal.clock->millis() - startMillis);
+    return false;
+  }
+  if (status == WIFI_LINK_CONNECTED && ipMode == WIFI_IP_LAST_LEASE
+      && hal.radio->probeGateway(ipConfig->gateway, 1000) == WIFI_PROBE_FAILED) {
+    logMessage("[WIFI] Gateway not reachable with the last lease, requesting a new one\n");
+    ipMode = WIFI_IP_DHCP;
+    hal.radio->disconnect();
+    hal.radio->config(0, 0, 0, 0);
+    startJoin(candidate);
+    status = waitForJoin();
+  }
+  return finishCandidate(candidate, status, ipMode, startMillis);
+}
+
+/**
+ * @brief Configure the IP address and start the connection to a candidate
+ * @param candidate Network to connect to
+ * @param ipConfig IP configuration to use instead of the one of the network, e.g. a cached lease
+ * @return wifiIpMode_t mode used, DHCP if the configuration has no address
+ */
+wifiIpMode_t WIFIMANAGER::beginCandidate(const wifiCandidate_t & candidate, const wifiIpConfig_t * ipConfig) {
+  const apCredentials_t & ap = apList[candidate.apId];
+  if (ipConfig == nullptr) ipConfig = &ap.ipConfig;
+  logMessage(String("[WIFI] Trying to connect to SSID ") + ap.apName
+    + " with password " + (ap.apPass.length() > 0 ? "'***'" : "''") + "\n"
+  );
+  metrics.connectAttempts++;
+  linkState.update([](wifiLinkState_t & state) { state.lastDisconnectReason = 0; });
+
+  // a known address skips the DHCP
+  wifiIpMode_t ipMode = ipConfig->ip != 0 ? ipConfig->mode : WIFI_IP_DHCP;
+  traceEvent(WIFI_TRACE_CONNECT, candidate.apId, candidate.channel, wifiTraceBssid(candidate.bssid), ipMode);
+  if (ipMode == WIFI_IP_DHCP) hal.radio->config(0, 0, 0, 0);
+  else hal.radio->config(ipConfig->ip, ipConfig->gateway, ipConfig->netmask, ipConfig->dns);
+  startJoin(candidate);
+  return ipMode;
+}
+
+/**
+ * @brief Evaluate the result of a connection attempt
+ * @details Updates the statistics, the connection cache and the blacklist.
+ * @param candidate Network of the attempt
+ * @param status Final state of the attempt
+ * @param ipMode IP mode used for the attempt
+ * @param startMillis Start of the attempt
+ * @return true if connected
+ */
+bool WIFIMANAGER::finishCandidate(const wifiCandidate_t & candidate, wifiLinkStatus_t status, wifiIpMode_t ipMode, uint64_t startMillis) {
+  apCredentials_t & ap = apList[candidate.apId];
+  metrics.radioActiveMillis += hal.clock->millis() - startMillis;
+
+  wifiLinkInfo_t link;
+  if (status == WIFI_LINK_CONNECTED) traceEvent(WIFI_TRACE_CONNECT_RESULT, status, 0, hal.clock->millis() - startMillis);
+  switch(status) {
+    case WIFI_LINK_IDLE:
+      logMessage("[WIFI] Connecting failed (0): Idle\n");
+      break;
+    case WIFI_LINK_NO_SSID_AVAIL:
+      logMessage("[WIFI] Connecting failed (1): The AP can't be found\n");
+      break;
+    case WIFI_LINK_SCAN_COMPLETED:
+      logMessage("[WIFI] Connecting failed (2): Scan completed\n");
+      break;
+    case WIFI_LINK_CONNECTED: // 3
+      logMessage("[WIFI] Connection successful\n");
+      hal.radio->linkInfo(link);
+      updateConnectionCache(candidate.apId, link);
+      metrics.ipModeConnects[ipMode]++;
+      metrics.ipModeMillis[ipMode] += hal.clock->millis() - startMillis;
+      if (ap.ipConfig.mode == WIFI_IP_LAST_LEASE && (ap.ipConfig.ip != link.ip || ap.ipConfig.gateway != link.gateway)) {
+        ap.ipConfig.ip = link.ip;
+        ap.ipConfig.gateway = link.gateway;
+        ap.ipConfig.netmask = link.netmask;
+        ap.ipConfig.dns = link.dns;
+        if (hal.store->begin(NVS, false)) {
+          storeIpConfig(candidate.apId);
+          hal.store->end();
+        }
+      }
+      logMessage(String("[WIFI] SSID   : ") + link.ssid + "\n");
+      logMessage("[WIFI] IP     : " + IPAddress(link.ip).toString() + "\n");
+      recordConnectResult(candidate.apId, true);
+      apList[candidate.apId].block = wifiBlock_t();
+      metrics.connectSuccess++;
+      applyPowerPolicy();
+      stopSoftAP();
+      return true;
+      break;
+    case WIFI_LINK_CONNECT_FAILED:
+      logMessage("[WIFI] Connecting failed (4): Unknown reason\n");
+      break;
+    case WIFI_LINK_CONNECTION_LOST:
+      logMessage("[WIFI] Connecting failed (5): Connection lost\n");
+      break;
+    case WIFI_LINK_DISCONNECTED:
+      logMessage("[WIFI] Connecting failed (6): Disconnected\n");
+      break;
+    case WIFI_LINK_NO_SHIELD:
+      logMessage("[WIFI] Connecting failed (7): No Wifi shield found\n");
+      break;
+    default:
+      logMessage("[WIFI] Connecting failed (" + String(status) + "): Unknown status code\n");
+      break;
+  }
+  recordConnectResult(candidate.apId, false);
+
+  uint8_t lastDisconnectReason = linkState.read().lastDisconnectReason;
+  wifiFailureClass_t failure = wifiClassifyReason(lastDisconnectReason);
+  if (failure == WIFI_FAILURE_NONE) failure = status == WIFI_LINK_NO_SSID_AVAIL ? WIFI_FAILURE_NOT_FOUND : WIFI_FAILURE_OTHER;
+  logMessage(String("[WIFI] Disconnect reason ") + String(lastDisconnectReason) + ": " + wifiFailureName(failure) + "\n");
+  traceEvent(WIFI_TRACE_CONNECT_RESULT, status, lastDisconnectReason, hal.clock->millis() - startMillis, failure);
+  recordFailure(candidate, failure);
+  return false;
+}
+
+void WIFIMANAGER::configueSoftAp(String apName, String apPass) {
+  this->softApName = apName;
+  this->softApPass = apPass;
+}
+
+/**
+ * @brief Start a SoftAP for direct client access
+ * @param apName name of the AP to create (default is ESP_XXXXXXXX)
+ * @return true on success
+ * @return false o error or if a SoftAP already runs
+ */
+bool WIFIMANAGER::runSoftAP(String apName, String apPass) {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_CONTROL);
+  if (apName.length()) this->softApName = apName;
+  if (apPass.length()) this->softApPass = apPass;
+
+  if (linkState.read().softApRunning) return true;
+  startApTimeMillis = hal.clock->millis();
+
+  if (this->softApName == "") this->softApName = "ESP_" + String((uint32_t)hal.radio->deviceId());
+  logMessage("[WIFI] Starting configuration portal on AP SSID " + this->softApName + "\n");
+
+  hal.radio->setMode(WIFI_RADIO_AP);
+  bool state = hal.radio->softAP(this->softApName.c_str(), (this->softApPass.length() ? this->softApPass.c_str() : NULL));
+  if (state) {
+    IPAddress IP = hal.radio->softAPIP();
+    logMessage("[WIFI] AP created. My IP is: " + String(IP) + "\n");
+    return true;
+  } else {
+    logMessage("[WIFI] Unable to create SoftAP!\n");
+    return false;
+  }
+}
+
+/**
+ * @brief Stop/Disconnect a current running SoftAP
+ */
+void WIFIMANAGER::stopSoftAP() {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_CONTROL);
+  hal.radio->softAPdisconnect();
+  hal.radio->setMode(WIFI_RADIO_STA);
+}
+
+/**
+ * @brief Stop/Disconnect a current wifi connection
+ */
+void WIFIMANAGER::stopClient() {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_CONTROL);
+  hal.radio->disconnect();
+}
+
+/**
+ * @brief Stop/Disconnect all running wifi activies and optionally kill the background task as well
+ * @param killTask true to kill the background task to prevent reconnects
+ */
+void WIFIMANAGER::stopWifi(bool killTask) {
+  // the task can't be stopped while it owns the radio
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_CONTROL);
+  if (killTask) {
+    hal.tasks->stop(WifiCheckTask);
+    WifiCheckTask = nullptr;
+    taskUsage.running = false;
+  }
+  stopSoftAP();
+  stopClient();
+}
+
+/**
+ * @brief Name of an IP mode as used by the API
+ * @param mode IP mode
+ * @return const char* name
+ */
+static const char * ipModeName(wifiIpMode_t mode) {
+  switch(mode) {
+    case WIFI_IP_STATIC: return "static";
+    case WIFI_IP_LAST_LEASE: return "lastLease";
+    default: return "dhcp";
+  }
+}
+
+/**
+ * @brief Read the optional IP configuration of a network from an /add request
+ * @details Supported are ipMode=dhcp|static|lastLease and the addresses ip, gateway,
+ * netmask and dns as dotted strings. A static configuration requires ip and netmask.
+ * @param json Request body
+ * @param ipConfig Parsed configuration
+ * @return true on success
+ * @return false on invalid data
+ */
+static bool parseIpConfig(JsonDocument & json, wifiIpConfig_t & ipConfig) {
+  ipConfig = wifiIpConfig_t();
+  if (json["ipMode"].isNull()) return true;
+  if (!json["ipMode"].is<String>()) return false;
+
+  String name = json["ipMode"].as<String>();
+  uint8_t mode = WIFI_IP_DHCP;
+  while (mode <= WIFI_IP_LAST_LEASE && name != ipModeName((wifiIpMode_t)mode)) mode++;
+  if (mode > WIFI_IP_LAST_LEASE) return false;
+  ipConfig.mode = (wifiIpMode_t)mode;
+  if (ipConfig.mode != WIFI_IP_STATIC) return true;
+
+  const char * keys[] = { "ip", "gateway", "netmask", "dns" };
+  uint32_t * values[] = { &ipConfig.ip, &ipConfig.gateway, &ipConfig.netmask, &ipConfig.dns };
+  for(uint8_t i = 0; i < 4; i++) {
+    if (json[keys[i]].isNull()) continue;
+    IPAddress addr;
+    if (!json[keys[i]].is<String>() || !addr.fromString(json[keys[i]].as<String>())) return false;
+    *values[i] = (uint32_t)addr;
+  }
+  return ipConfig.ip != 0 && ipConfig.netmask != 0;
+}
+
+/**
+ * @brief Read the /scan query parameters
+ * @details Supported are sort=rssi, limit=N, unique=ssid, minRssi=-80 and
+ * fields=ssid,encryptionType,rssi,channel,bssid
+ * @param query Parsed query
+ * @param param Returns the value of a query parameter or an empty String
+ * @return true on success
+ * @return false on invalid parameters
+ */
+bool WIFIMANAGER::parseScanQuery(scanQuery_t & query, std::function<String(const char *)> param) {
+  query = scanQuery_t();
+
+  String value = param("sort");
+  if (value.length()) {
+    if (value != "rssi") return false;
+    query.sortRssi = true;
+  }
+
+  value = param("unique");
+  if (value.length()) {
+    if (value != "ssid") return false;
+    query.uniqueSsid = true;
+  }
+
+  value = param("limit");
+  if (value.length()) {
+    int limit = value.toInt();
+    if (limit < 1 || limit > UINT16_MAX) return false;
+    query.limit = limit;
+  }
+
+  value = param("minRssi");
+  if (value.length()) {
+    int minRssi = value.toInt();
+    if (minRssi < INT8_MIN || minRssi > 0) return false;
+    query.minRssi = minRssi;
+  }
+
+  value = param("fields");
+  if (value.length()) {
+    query.fields = 0;
+    int start = 0;
+    while (start <= (int)value.length()) {
+      int end = value.indexOf(',', start);
+      if (end < 0) end = value.length();
+      String field = value.substring(start, end);
+      if (field == "ssid") query.fields |= SCAN_FIELD_SSID;
+      else if (field == "encryptionType") query.fields |= SCAN_FIELD_ENCRYPTION;
+      else if (field == "rssi") query.fields |= SCAN_FIELD_RSSI;
+      else if (field == "channel") query.fields |= SCAN_FIELD_CHANNEL;
+      else if (field == "bssid") query.fields |= SCAN_FIELD_BSSID;
+      else return false;
+      start = end + 1;
+    }
+  }
+  return true;
+}
+
+/**
+ * @brief Filter, deduplicate, sort and limit the scan results in a single pass
+ * @param query Parsed /scan query
+ * @param scanResult Number of available scan records
+ * @param selected Receives the indexes of the scan records to output
+ */
+void WIFIMANAGER::selectScanResults(const scanQuery_t & query, int16_t scanResult, std::vector<uint16_t> & selected) {
+  std::vector<int8_t> rssis;      // RSSI of the selected entries
+  std::vector<uint32_t> hashes;   // SSID hashes of the selected entries, only used with uniqueSsid
+  selected.clear();
+  selected.reserve(scanResult < query.limit ? scanResult : query.limit);
+
+  wifiScanRecord_t record, other;
+  for(int16_t x = 0; x < scanResult; x++) {
+    if (!hal.radio->scanRecord(x, record) || record.rssi < query.minRssi) continue;
+
+    size_t pos = selected.size();
+    uint32_t hash = 0;
+    if (query.uniqueSsid) {
+      hash = hashSsid(record.ssid, strnlen((const char *)record.ssid, sizeof(record.ssid)));
+      size_t dup = 0;
+      for(; dup < selected.size(); dup++) {
+        if (hashes[dup] != hash || !hal.radio->scanRecord(selected[dup], other)) continue;
+        if (strncmp((const char *)other.ssid, (const char *)record.ssid, sizeof(record.ssid)) == 0) break;
+      }
+      if (dup < selected.size()) {
+        // keep only the strongest BSSID of each SSID
+        if (rssis[dup] >= record.rssi) continue;
+        if (!query.sortRssi) {
+          selected[dup] = x;
+          rssis[dup] = record.rssi;
+          continue;
+        }
+        selected.erase(selected.begin() + dup);
+        rssis.erase(rssis.begin() + dup);
+        hashes.erase(hashes.begin() + dup);
+        pos = selected.size();
+      }
+    }
+
+    if (query.sortRssi) {
+      while (pos > 0 && rssis[pos-1] < record.rssi) pos--;
+    }
+    if (pos >= query.limit) continue;
+
+    selected.insert(selected.begin() + pos, x);
+    rssis.insert(rssis.begin() + pos, record.rssi);
+    if (query.uniqueSsid) hashes.insert(hashes.begin() + pos, hash);
+    if (selected.size() > query.limit) {
+      selected.pop_back();
+      rssis.pop_back();
+      if (query.uniqueSsid) hashes.pop_back();
+    }
+  }
+}
+
+/**
+ * @brief Send a JSON array as chunked response, rendering only one element at a time
+ * @details Peak memory usage is independent of the number of elements.
+ * @param http Request adapter of the webserver
+ * @param count Number of elements to render, the row callback may skip elements
+ * @param row Callback writing a single element
+ * @param onDone Optional callback, executed when the response is finished or aborted
+ */
+template<typename R>
+static void sendJsonArray(R & http, uint16_t count, WifiJsonArrayStream::RowWriter row, std::function<void()> onDone = nullptr) {
+  http.sendChunked("application/json", std::make_shared<WifiJsonArrayStream>(count, row, onDone));
+}
+
+/**
+ * @brief Parse the JSON body of a request, answers with an error if there is none
+ * @param http Request adapter of the webserver
+ * @param json Document to fill
+ * @return true if the request has a body
+ */
+template<typename R>
+static bool readJsonBody(R & http, JsonDocument & json) {
+  const char * body = http.body();
+  if (body == nullptr) {
+    http.send(400, "application/json", "{\"message\":\"Bad Request. Only accepting one json body in request!\"}");
+    return false;
+  }
+  deserializeJson(json, body);
+  return true;
+}
+
+/**
+ * @brief Answer a request that needs the radio while another task owns it
+ * @details The webserver must not block until a scan or connection attempt finished.
+ */
+template<typename R>
+static void sendRadioBusy(R & http) {
+  http.send(503, "application/json", "{\"message\":\"Radio busy, retry later\"}");
+}
+
+/**
+ * @brief Dispatch a request of the RESTful API to its endpoint
+ * @param route Endpoint that matched the request
+ * @param http Request adapter of the webserver
+ */
+template<typename R>
+void WIFIMANAGER::handleApi(wifiApiRoute_t route, R & http) {
+  notifyActivity();
+  switch (route) {
+    case WIFI_API_SOFTAP_START:
+    case WIFI_API_SOFTAP_STOP:
+    case WIFI_API_CLIENT_STOP:   apiControl(route, http); break;
+    case WIFI_API_ADD:           apiAddWifi(http); break;
+    case WIFI_API_DELETE_ID:
+    case WIFI_API_DELETE_APNAME: apiDelWifi(route, http); break;
+    case WIFI_API_POWER:         apiPower(http); break;
+    case WIFI_API_CONFIGLIST:    apiConfigList(http); break;
+    case WIFI_API_SCAN:          apiScan(http); break;
+    case WIFI_API_HISTORY:       apiHistory(http); break;
+    case WIFI_API_TRACE:         apiTrace(http); break;
+    case WIFI_API_STATUS:        apiStatus(http); break;
+    case WIFI_API_METRICS:       apiMetrics(http); break;
+    default:
+      http.send(404, "application/json", "{\"message\":\"Not found\"}");
+      break;
+  }
+}
+
+/**
+ * @brief Start or stop the SoftAP or the client connection
+ * @details The response is sent first, it's likely that it won't go trough afterwards,
+ * but we give it a short time. If another task owns the radio, the request is queued
+ * and applied by the next loop() or tick().
+ */
+template<typename R>
+void WIFIMANAGER::apiControl(wifiApiRoute_t route, R & http) {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_CONTROL, std::try_to_lock);
+  if (!radio.owns()) {
+    controlRequested = route;
+    http.send(202, "application/json", "{\"message\":\"Radio busy, request queued\"}");
+    return;
+  }
+  if (route == WIFI_API_CLIENT_STOP) {
+    http.send(200, "application/json", "{\"message\":\"Terminating current Wifi connection\"}");
+  } else {
+    http.send(200, "application/json", "{\"message\":\"Soft AP stopped\"}");
+  }
+  hal.clock->yield();
+  hal.clock->delay(route == WIFI_API_CLIENT_STOP ? 500 : 250);
+  if (route == WIFI_API_SOFTAP_START) runSoftAP();
+  else if (route == WIFI_API_SOFTAP_STOP) stopSoftAP();
+  else stopClient();
+}
+
+template<typename R>
+void WIFIMANAGER::apiAddWifi(R & http) {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, std::try_to_lock, WIFI_RADIO_READ);
+  if (!radio.owns()) return sendRadioBusy(http);
+  JsonDocument jsonBuffer;
+  if (!readJsonBody(http, jsonBuffer)) return;
+  if (!jsonBuffer["apName"].is<String>() || !jsonBuffer["apPass"].is<String>()) {
+    http.send(422, "application/json", "{\"message\":\"Invalid data\"}");
+    return;
+  }
+  uint8_t apPriority = WIFIMANAGER_DEFAULT_PRIORITY;
+  int8_t apMinRssi = WIFIMANAGER_NO_RSSI_FLOOR;
+  if (!jsonBuffer["priority"].isNull()) {
+    if (!jsonBuffer["priority"].is<uint8_t>()) {
+      http.send(422, "application/json", "{\"message\":\"Invalid data\"}");
       return;
     }
-    if (!delWifi(jsonBuffer["id"].as<uint8_t>())) {
-      resp->send(500, "application/json", "{\"message\":\"Unable to delete entry\"}");
-    } else resp->send(200, "application/json", "{\"message\":\"AP deleted\"}");
-  });
+    apPriority = jsonBuffer["priority"].as<uint8_t>();
+  }
+  if (!jsonBuffer["minRssi"].isNull()) {
+    if (!jsonBuffer["minRssi"].is<int8_t>()) {
+      http.send(422, "application/json", "{\"message\":\"Invalid data\"}");
+      return;
+    }
+    apMinRssi = jsonBuffer["minRssi"].as<int8_t>();
+  }
+  wifiIpConfig_t ipConfig;
+  if (!parseIpConfig(jsonBuffer, ipConfig)) {
+    http.send(422, "application/json", "{\"message\":\"Invalid data\"}");
+    return;
+  }
+  if (!addWifi(jsonBuffer["apName"].as<String>(), jsonBuffer["apPass"].as<String>(), true, apPriority, apMinRssi, ipConfig)) {
+    http.send(500, "application/json", "{\"message\":\"Unable to process data\"}");
+  } else http.send(200, "application/json", "{\"message\":\"New AP added\"}");
+}
 
-#if ASYNC_WEBSERVER == true
-  webServer->on((apiPrefix + "/apName").c_str(), HTTP_DELETE, [&](AsyncWebServerRequest * request){}, NULL,
-    [&](AsyncWebServerRequest * request, uint8_t *data, size_t len, size_t index, size_t total) {
-    JsonDocument jsonBuffer;
-    deserializeJson(jsonBuffer, (const char*)data);
-    auto resp = request;
-#else
-  webServer->on((apiPrefix + "/apName").c_str(), HTTP_DELETE, [&]() {
-    if (webServer->args() != 1) {
-      webServer->send(400, "application/json", "{\"message\":\"Bad Request. Only accepting one json body in request!\"}");
+template<typename R>
+void WIFIMANAGER::apiDelWifi(wifiApiRoute_t route, R & http) {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, std::try_to_lock, WIFI_RADIO_READ);
+  if (!radio.owns()) return sendRadioBusy(http);
+  JsonDocument jsonBuffer;
+  if (!readJsonBody(http, jsonBuffer)) return;
+  bool deleted;
+  if (route == WIFI_API_DELETE_ID) {
+    if (!jsonBuffer["id"].is<uint8_t>() || jsonBuffer["id"].as<uint8_t>() >= WIFIMANAGER_MAX_APS) {
+      http.send(422, "application/json", "{\"message\":\"Invalid data\"}");
+      return;
     }
-    JsonDocument jsonBuffer;
-    deserializeJson(jsonBuffer, webServer->arg(0));
-    auto resp = webServer;
-#endif
+    deleted = delWifi(jsonBuffer["id"].as<uint8_t>());
+  } else {
     if (!jsonBuffer["apName"].is<String>()) {
-      resp->send(422, "application/json", "{\"message\":\"Invalid data\"}");
+      http.send(422, "application/json", "{\"message\":\"Invalid data\"}");
       return;
     }
-    if (!delWifi(jsonBuffer["apName"].as<String>())) {
-      resp->send(500, "application/json", "{\"message\":\"Unable to delete entry\"}");
-    } else resp->send(200, "application/json", "{\"message\":\"AP deleted\"}");
+    deleted = delWifi(jsonBuffer["apName"].as<String>());
+  }
+  if (!deleted) {
+    http.send(500, "application/json", "{\"message\":\"Unable to delete entry\"}");
+  } else http.send(200, "application/json", "{\"message\":\"AP deleted\"}");
+}
+
+template<typename R>
+void WIFIMANAGER::apiPower(R & http) {
+  JsonDocument jsonBuffer;
+  if (!readJsonBody(http, jsonBuffer)) return;
+  String name = jsonBuffer["policy"].is<String>() ? jsonBuffer["policy"].as<String>() : String();
+  uint8_t policy = WIFI_POWER_LOW_LATENCY;
+  while (policy <= WIFI_POWER_ADAPTIVE && name != powerPolicyName((wifiPowerPolicy_t)policy)) policy++;
+  if (policy > WIFI_POWER_ADAPTIVE
+      || (!jsonBuffer["idleTimeoutMillis"].isNull() && !jsonBuffer["idleTimeoutMillis"].is<uint32_t>())) {
+    http.send(422, "application/json", "{\"message\":\"Invalid data\"}");
+    return;
+  }
+  uint32_t idleTimeoutMillis = powerIdleTimeoutMillis;
+  if (!jsonBuffer["idleTimeoutMillis"].isNull()) idleTimeoutMillis = jsonBuffer["idleTimeoutMillis"].as<uint32_t>();
+  setPowerPolicy((wifiPowerPolicy_t)policy, idleTimeoutMillis);
+  http.send(200, "application/json", "{\"message\":\"Power policy changed\"}");
+}
+
+template<typename R>
+void WIFIMANAGER::apiConfigList(R & http) {
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, std::try_to_lock, WIFI_RADIO_READ);
+  if (!radio.owns()) return sendRadioBusy(http);
+  // the list may change while the response is streamed
+  auto list = std::make_shared<std::vector<apCredentials_t>>(apList, apList + WIFIMANAGER_MAX_APS);
+  sendJsonArray(http, WIFIMANAGER_MAX_APS, [list](WifiJsonWriter & json, uint16_t i) {
+    const apCredentials_t & ap = (*list)[i];
+    if (ap.apName.length() == 0) return;
+    json.beginObject();
+    json.key("id"); json.value((int32_t)i);
+    json.key("apName"); json.value(ap.apName.c_str(), ap.apName.length());
+    json.key("apPass"); json.value(ap.apPass.length() > 0);
+    json.key("priority"); json.value((int32_t)ap.apPriority);
+    json.key("minRssi"); json.value((int32_t)ap.apMinRssi);
+    json.key("ipMode"); json.value(ipModeName(ap.ipConfig.mode));
+    if (ap.ipConfig.ip != 0) {
+      String ip = IPAddress(ap.ipConfig.ip).toString();
+      json.key("ip"); json.value(ip.c_str(), ip.length());
+    }
+    json.endObject();
   });
+}
 
-#if ASYNC_WEBSERVER == true
-  webServer->on((apiPrefix + "/configlist").c_str(), HTTP_GET, [&](AsyncWebServerRequest *request) {
-    AsyncResponseStream *response = request->beginResponseStream("application/json");
-#else
-  webServer->on((apiPrefix + "/configlist").c_str(), HTTP_GET, [&]() {
-    String buffer;
-#endif
-    JsonDocument jsonDoc;
-    auto jsonArray = jsonDoc.to<JsonArray>();
-    for(uint8_t i=0; i<WIFIMANAGER_MAX_APS; i++) {
-      if (apList[i].apName.length() > 0) {
-        JsonObject wifiNet = jsonArray.createNestedObject();
-        wifiNet["id"] = i;
-        wifiNet["apName"] = apList[i].apName;
-        wifiNet["apPass"] = apList[i].apPass.length() > 0 ? true : false;
-      }
+template<typename R>
+void WIFIMANAGER::apiScan(R & http) {
+  scanQuery_t query;
+  if (!parseScanQuery(query, [&http](const char * name) { return http.param(name); })) {
+    http.send(422, "application/json", "{\"message\":\"Invalid data\"}");
+    return;
+  }
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, std::try_to_lock, WIFI_RADIO_READ);
+  if (!radio.owns()) return sendRadioBusy(http);
+  int16_t scanResult = hal.radio->scanComplete();
+  if (scanResult == WIFI_RADIO_SCAN_FAILED) {
+    radioOwner.markChanged();
+    hal.radio->scan(true);   // FIXME: scanNetworks is disconnecting clients!
+  }
+  if (scanResult < 0) {
+    http.send(200, "application/json", "{\"status\":\"scanning\"}");
+    return;
+  }
+  if (nextConnectMillis > 0 && scanSeesKnownSsid(scanResult)) {
+    logMessage("[WIFI] Known SSID in range, stop backing off\n");
+    triggerReconnect();
+  }
+  std::vector<uint16_t> selected;
+  selectScanResults(query, scanResult, selected);
+
+  // the response is streamed after the radio is released, it only reads a copy of the selected records
+  auto records = std::make_shared<std::vector<wifiScanRecord_t>>();
+  records->reserve(selected.size());
+  for (uint16_t index : selected) {
+    wifiScanRecord_t record;
+    if (hal.radio->scanRecord(index, record)) records->push_back(record);
+  }
+  // a scan started by tick() is left for its next call
+  if (tickState != WIFI_TICK_SCANNING) hal.radio->scanDelete();
+
+  sendJsonArray(http, records->size(), [records, query](WifiJsonWriter & json, uint16_t i) {
+    const wifiScanRecord_t & record = (*records)[i];
+    json.beginObject();
+    if (query.fields & SCAN_FIELD_SSID) {
+      json.key("ssid"); json.value((const char *)record.ssid, strnlen((const char *)record.ssid, sizeof(record.ssid)));
     }
-#if ASYNC_WEBSERVER == true
-    serializeJson(jsonArray, *response);
-    response->setCode(200);
-    response->setContentLength(measureJson(jsonDoc));
-    request->send(response);
-#else
-    // Improve me: not that efficient without the stream response
-    serializeJson(jsonArray, buffer);
-    webServer->send(200, "application/json", (buffer.equals("null") ? "{}" : buffer));
-#endif
+    if (query.fields & SCAN_FIELD_ENCRYPTION) {
+      json.key("encryptionType"); json.value((int32_t)record.authmode);
+    }
+    if (query.fields & SCAN_FIELD_RSSI) {
+      json.key("rssi"); json.value((int32_t)record.rssi);
+    }
+    if (query.fields & SCAN_FIELD_CHANNEL) {
+      json.key("channel"); json.value((int32_t)record.channel);
+    }
+    if (query.fields & SCAN_FIELD_BSSID) {
+      char bssid[18];
+      snprintf(bssid, sizeof(bssid), "%02X:%02X:%02X:%02X:%02X:%02X",
+        record.bssid[0], record.bssid[1], record.bssid[2], record.bssid[3], record.bssid[4], record.bssid[5]);
+      json.key("bssid"); json.value(bssid);
+    }
+    json.endObject();
   });
+}
 
-#if ASYNC_WEBSERVER == true
-  webServer->on((apiPrefix + "/scan").c_str(), HTTP_GET, [&](AsyncWebServerRequest *request) {
-    AsyncResponseStream *response = request->beginResponseStream("application/json");
-#else
-  webServer->on((apiPrefix + "/scan").c_str(), HTTP_GET, [&]() {
-    String buffer;
-#endif
-    JsonDocument jsonDoc;
-
-    int scanResult;
-    String ssid;
-    uint8_t encryptionType;
-    int32_t rssi;
-    uint8_t* bssid;
-    int32_t channel;
-
-    scanResult = WiFi.scanComplete();
-    if (scanResult == WIFI_SCAN_FAILED) {
-      scanResult = WiFi.scanNetworks(true, true);   // FIXME: scanNetworks is disconnecting clients!
-      jsonDoc["status"] = "scanning";
-    } else if (scanResult > 0) {
-      for (int8_t i = 0; i < scanResult; i++) {
-        WiFi.getNetworkInfo(i, ssid, encryptionType, rssi, bssid, channel);
-
-        JsonObject wifiNet = jsonDoc.createNestedObject();
-        wifiNet["ssid"] = ssid;
-        wifiNet["encryptionType"] = encryptionType;
-        wifiNet["rssi"] = rssi;
-        wifiNet["channel"] = channel;
-        yield();
-      }
-      WiFi.scanDelete();
+template<typename R>
+void WIFIMANAGER::apiHistory(R & http) {
+  String pointsParam = http.param("points");
+  uint16_t points = WIFIMANAGER_LINK_HISTORY;
+  if (pointsParam.length()) {
+    int value = pointsParam.toInt();
+    if (value < 1 || value > WIFIMANAGER_LINK_HISTORY) {
+      http.send(422, "application/json", "{\"message\":\"Invalid data\"}");
+      return;
     }
-#if ASYNC_WEBSERVER == true
-    serializeJson(jsonDoc, *response);
-    response->setCode(200);
-    response->setContentLength(measureJson(jsonDoc));
-    request->send(response);
-#else
-    // Improve me: not that efficient without the stream response
-    serializeJson(jsonDoc, buffer);
-    webServer->send(200, "application/json", buffer);
-#endif
+    points = value;
+  }
+  uint32_t now = hal.clock->millis();
+  // the background task keeps sampling while the response is streamed
+  std::shared_ptr<WifiLinkQuality> history = std::make_shared<WifiLinkQuality>(getLinkQuality());
+  sendJsonArray(http, history->buckets(points), [history, points, now](WifiJsonWriter & json, uint16_t i) {
+    wifiLinkBucket_t bucket;
+    history->bucket(i, points, bucket);
+    json.beginObject();
+    json.key("ageMillis"); json.value((int32_t)(now - bucket.millis));
+    json.key("rssi"); json.value((int32_t)bucket.rssi);
+    json.key("minRssi"); json.value((int32_t)bucket.minRssi);
+    json.key("maxRssi"); json.value((int32_t)bucket.maxRssi);
+    json.key("smoothedRssi"); json.value((int32_t)bucket.smoothed);
+    json.key("channel"); json.value((int32_t)bucket.channel);
+    json.key("samples"); json.value((int32_t)bucket.samples);
+    json.endObject();
   });
+}
 
-#if ASYNC_WEBSERVER == true
-  webServer->on((apiPrefix + "/status").c_str(), HTTP_GET, [&](AsyncWebServerRequest *request) {
-    AsyncResponseStream *response = request->beginResponseStream("application/json");
-#else
-  webServer->on((apiPrefix + "/status").c_str(), HTTP_GET, [&]() {
-    String buffer;
-#endif
-    JsonDocument jsonDoc;
+template<typename R>
+void WIFIMANAGER::apiTrace(R & http) {
+  http.sendChunked("application/octet-stream", std::make_shared<WifiTraceStream>(trace, (uint32_t)hal.clock->micros()));
+}
 
-    jsonDoc["ssid"] = WiFi.SSID();
-    jsonDoc["signalStrengh"] = WiFi.RSSI();
+template<typename R>
+void WIFIMANAGER::apiStatus(R & http) {
+  JsonDocument jsonDoc;
+
+  wifiLinkState_t link = linkState.read();
+  jsonDoc["ssid"] = link.ssid;
+  jsonDoc["signalStrengh"] = link.rssi;
+  WifiLinkQuality quality = getLinkQuality();
+  if (quality.size() > 0) {
+    jsonDoc["smoothedRssi"] = quality.smoothed();
+    jsonDoc["minRssi"] = quality.minRssi();
+    jsonDoc["maxRssi"] = quality.maxRssi();
+  }
 
-    jsonDoc["ip"] = WiFi.localIP().toString();
-    jsonDoc["gw"] = WiFi.gatewayIP().toString();
-    jsonDoc["nm"] = WiFi.subnetMask().toString();
+  jsonDoc["ip"] = IPAddress(link.ip).toString();
+  jsonDoc["gw"] = IPAddress(link.gateway).toString();
+  jsonDoc["nm"] = IPAddress(link.netmask).toString();
 
-    jsonDoc["hostname"] = WiFi.getHostname();
+  jsonDoc["hostname"] = hal.radio->hostname();
+  jsonDoc["powerPolicy"] = powerPolicyName(powerPolicy);
 
-    jsonDoc["chipModel"] = ESP.getChipModel();
-    jsonDoc["chipRevision"] = ESP.getChipRevision();
-    jsonDoc["chipCores"] = ESP.getChipCores();
+  uint64_t now = hal.clock->millis();
+  if (link.lastDisconnectMillis > 0) {
+    jsonDoc["lastDisconnect"]["reason"] = link.lastDisconnectReason;
+    jsonDoc["lastDisconnect"]["class"] = wifiFailureName(wifiClassifyReason(link.lastDisconnectReason));
+    jsonDoc["lastDisconnect"]["ageMillis"] = now - link.lastDisconnectMillis;
+  }
+  // the block lists belong to the owner of the radio, left out while it is busy
+  WifiRadioGuard radio(radioOwner, WIFI_RADIO_PRIORITY_APPLICATION, std::try_to_lock, WIFI_RADIO_READ);
+  if (radio.owns()) {
+    JsonArray blocked = jsonDoc["blocked"].to<JsonArray>();
+    for(uint8_t i = 0; i < WIFIMANAGER_MAX_APS; i++) {
+      if (apList[i].apName.length() == 0 || !apList[i].block.blocked(now)) continue;
+      JsonObject entry = blocked.add<JsonObject>();
+      entry["apName"] = apList[i].apName;
+      entry["class"] = wifiFailureName(apList[i].block.failure);
+      entry["strikes"] = apList[i].block.strikes;
+      entry["remainingMillis"] = apList[i].block.blockedUntilMillis - now;
+    }
+    for(uint8_t i = 0; i < WIFIMANAGER_BSSID_BLACKLIST_SIZE; i++) {
+      if (!blockedBssids[i].blocked(now)) continue;
+      char bssid[18];
+      snprintf(bssid, sizeof(bssid), "%02X:%02X:%02X:%02X:%02X:%02X",
+        blockedBssids[i].bssid[0], blockedBssids[i].bssid[1], blockedBssids[i].bssid[2],
+        blockedBssids[i].bssid[3], blockedBssids[i].bssid[4], blockedBssids[i].bssid[5]);
+      JsonObject entry = blocked.add<JsonObject>();
+      entry["bssid"] = bssid;
+      entry["class"] = wifiFailureName(blockedBssids[i].failure);
+      entry["strikes"] = blockedBssids[i].strikes;
+      entry["remainingMillis"] = blockedBssids[i].blockedUntilMillis - now;
+    }
+  }
+
+  jsonDoc["chipModel"] = ESP.getChipModel();
+  jsonDoc["chipRevision"] = ESP.getChipRevision();
+  jsonDoc["chipCores"] = ESP.getChipCores();
 
-    jsonDoc["getHeapSize"] = ESP.getHeapSize();
-    jsonDoc["freeHeap"] = ESP.getFreeHeap();
+  jsonDoc["getHeapSize"] = ESP.getHeapSize();
+  jsonDoc["freeHeap"] = ESP.getFreeHeap();
 
-#if ASYNC_WEBSERVER == true
-    serializeJson(jsonDoc, *response);
-    response->setCode(200);
-    response->setContentLength(measureJson(jsonDoc));
-    request->send(response);
+  http.sendJson(jsonDoc);
+}
+
+template<typename R>
+void WIFIMANAGER::apiMetrics(R & http) {
+  JsonDocument jsonDoc;
+
+  jsonDoc["scans"] = metrics.scans;
+  jsonDoc["connectAttempts"] = metrics.connectAttempts;
+  jsonDoc["connectSuccess"] = metrics.connectSuccess;
+  jsonDoc["radioActiveMillis"] = metrics.radioActiveMillis;
+  jsonDoc["bursts"] = metrics.bursts;
+  jsonDoc["lastBurstRadioMillis"] = metrics.lastBurstRadioMillis;
+
+  jsonDoc["timeToIp"]["samples"] = metrics.timeToIpCount;
+  jsonDoc["timeToIp"]["p50"] = getTimeToIpPercentile(50);
+  jsonDoc["timeToIp"]["p95"] = getTimeToIpPercentile(95);
+  jsonDoc["timeToIp"]["p99"] = getTimeToIpPercentile(99);
+  for(uint8_t mode = WIFI_IP_DHCP; mode <= WIFI_IP_LAST_LEASE; mode++) {
+    JsonObject byMode = jsonDoc["timeToIp"]["byMode"][ipModeName((wifiIpMode_t)mode)].to<JsonObject>();
+    byMode["connects"] = metrics.ipModeConnects[mode];
+    byMode["avgMillis"] = metrics.ipModeConnects[mode] ? (uint32_t)(metrics.ipModeMillis[mode] / metrics.ipModeConnects[mode]) : 0;
+  }
+
+  jsonDoc["task"]["running"] = taskUsage.running;
+  jsonDoc["task"]["stackSize"] = taskConfig.stackSize;
+  jsonDoc["task"]["priority"] = taskConfig.priority;
+  jsonDoc["task"]["core"] = taskConfig.core;
+  if (taskUsage.statsValid) {
+    jsonDoc["task"]["stackFreeMin"] = taskUsage.stackFreeMin;
+    jsonDoc["task"]["stackUsedPercent"] = 100 - (uint64_t)taskUsage.stackFreeMin * 100 / taskConfig.stackSize;
+  }
+  jsonDoc["task"]["loops"] = taskUsage.loops;
+  jsonDoc["task"]["loopMillis"] = taskUsage.loopMicros / 1000;
+  if (taskUsage.cpuValid && taskUsage.runTimeTotal > 0) {
+    jsonDoc["task"]["cpuPercent"] = (float)taskUsage.runTime * 100.0f / taskUsage.runTimeTotal;
+  }
+
+  jsonDoc["health"]["healthy"] = health.healthy;
+  jsonDoc["health"]["checks"] = health.checks;
+  jsonDoc["health"]["actions"] = health.actions;
+  const char * probeNames[] = { "gateway", "dns", "http" };
+  const wifiProbeStats_t * probeStats[] = { &health.gateway, &health.dns, &health.http };
+  for(uint8_t i = 0; i < 3; i++) {
+    JsonObject probe = jsonDoc["health"][probeNames[i]].to<JsonObject>();
+    probe["runs"] = probeStats[i]->runs;
+    probe["failures"] = probeStats[i]->failures;
+    probe["lastLatencyMillis"] = probeStats[i]->lastLatencyMillis;
+    probe["avgLatencyMillis"] = probeStats[i]->avgLatencyMillis;
+  }
+
+  http.sendJson(jsonDoc);
+}
+
+#if IDF_WEBSERVER == true
+/**
+ * @brief URI handler of the esp_http_server, runs in the task of the server
+ * @param request Request with the apiContext_t of the route as user context
+ * @return ESP_OK, the response is sent in any case
+ */
+esp_err_t WIFIMANAGER::handleHttpd(httpd_req_t * request) {
+  apiContext_t * context = (apiContext_t *)request->user_ctx;
+  WifiHttpIdf http(request);
+  context->manager->handleApi(context->route, http);
+  return ESP_OK;
+}
+#endif
+
+/**
+ * @brief Attach the WebServer to the WifiManager to register the RESTful API
+ * @details The esp_http_server only accepts 8 URI handlers by default, start it with
+ * max_uri_handlers set to at least WIFI_API_ROUTES plus the ones of the application.
+ * @param srv WebServer object
+ */
+#if IDF_WEBSERVER == true
+void WIFIMANAGER::attachWebServer(httpd_handle_t srv) {
+#elif ASYNC_WEBSERVER == true
+void WIFIMANAGER::attachWebServer(AsyncWebServer * srv) {
 #else
-    // Improve me: not that efficient without the stream response
-    serializeJson(jsonDoc, buffer);
-    webServer->send(200, "application/json", buffer);
+void WIFIMANAGER::attachWebServer(WebServer * srv) {
 #endif
+  detachWebServer();
+  webServer = srv; // store it in the class for later use
+
+#if IDF_WEBSERVER == true
+  for (uint8_t i = 0; i < WIFI_API_ROUTES; i++) {
+    apiContexts[i].manager = this;
+    apiContexts[i].route = wifiApiRoutes[i].route;
+    String uri = apiPrefix + wifiApiRoutes[i].path;
+    httpd_uri_t handler = {};
+    handler.uri = uri.c_str();  // copied by the server
+    handler.method = WifiHttpIdf::method(wifiApiRoutes[i].method);
+    handler.handler = handleHttpd;
+    handler.user_ctx = &apiContexts[i];
+    if (httpd_register_uri_handler(webServer, &handler) != ESP_OK) {
+      logMessage("[WIFI] Unable to register " + uri + ", increase max_uri_handlers of the server\n");
+    }
+  }
+#else
+#if ASYNC_WEBSERVER == false
+  // just for debugging
+  webServer->onNotFound([&]() {
+    String uri = WebServer::urlDecode(webServer->uri());  // required to read paths with blanks
+
+     // Dump debug data
+    String message;
+    message.reserve(100);
+    message = F("Error: File not found\n\nURI: ");
+    message += uri;
+    message += F("\nMethod: ");
+    message += (webServer->method() == HTTP_GET) ? "GET" : "POST";
+    message += F("\nArguments: ");
+    message += webServer->args();
+    message += '\n';
+    for (uint8_t i = 0; i < webServer->args(); i++) {
+      message += F(" NAME:");
+      message += webServer->argName(i);
+      message += F("\n VALUE:");
+      message += webServer->arg(i);
+      message += '\n';
+    }
+    message += "path=";
+    message += webServer->arg("path");
+    message += '\n';
+    logMessage(message);
   });
+#endif
+
+  // a single handler claims all routes below the prefix, other requests only pay a prefix compare
+  apiHandler = new WifiApiHandler<WIFIMANAGER>(*this, apiPrefix);
+  webServer->addHandler(apiHandler);
+#endif
+}
+
+/**
+ * @brief Remove the RESTful API from the WebServer again
+ * @details Requests already being answered must be finished before the WifiManager is destroyed.
+ * With arduino-esp32 before 3.1.0 the WebServer has no removeHandler(), the handler of the API then
+ * stays in the WebServer without answering any request.
+ */
+void WIFIMANAGER::detachWebServer() {
+  if (webServer == nullptr) return;
+#if IDF_WEBSERVER == true
+  for (uint8_t i = 0; i < WIFI_API_ROUTES; i++) {
+    httpd_unregister_uri_handler(webServer, (apiPrefix + wifiApiRoutes[i].path).c_str(), WifiHttpIdf::method(wifiApiRoutes[i].method));
+  }
+#else
+#if ASYNC_WEBSERVER == false
+  webServer->onNotFound(nullptr);
+#endif
+#if ASYNC_WEBSERVER == false && WIFIMANAGER_REMOVE_HANDLER == false
+  // the WebServer of arduino-esp32 before 3.1.0 can't remove a handler, it keeps it disabled
+  apiHandler->detach();
+#else
+  webServer->removeHandler(apiHandler);
+  delete apiHandler;
+#endif
+  apiHandler = nullptr;
+#endif
+  webServer = nullptr;
 }
@@ -12,42 +12,251 @@
 #define WIFIMANAGER_MAX_APS 4   // Valid range is uint8_t
 #endif
 
+#ifndef WIFIMANAGER_METRICS_SAMPLES
+#define WIFIMANAGER_METRICS_SAMPLES 32  // Number of recent time to IP samples kept for percentiles, valid range is uint8_t
+#endif
+
+#ifndef WIFIMANAGER_BSSID_BLACKLIST_SIZE
+#define WIFIMANAGER_BSSID_BLACKLIST_SIZE 8  // Max number of temporarily blocked BSSIDs
+#endif
+
+#ifndef WIFIMANAGER_TICK_POLL_MILLIS
+#define WIFIMANAGER_TICK_POLL_MILLIS 50  // Interval of tick() while a scan or connection attempt is running
+#endif
+
+#define WIFIMANAGER_CONNECT_TIMEOUT_MILLIS 15000UL  // Max time to wait for the result of a connection attempt
+
+#ifndef WIFIMANAGER_CANCEL_POLL_MILLIS
+#define WIFIMANAGER_CANCEL_POLL_MILLIS 100  // Max delay until a waiting connection attempt notices its cancellation
+#endif
+
+#define WIFIMANAGER_RETAINED_MAGIC 0x574D5231  // Version of the wifiRetainedState_t layout
+
+#define WIFIMANAGER_SSID_INDEX_SIZE (2 * WIFIMANAGER_MAX_APS + 1)  // Open addressing table, kept half empty
+
 #ifndef ASYNC_WEBSERVER
   #define ASYNC_WEBSERVER true
 #endif
 
+#ifndef IDF_WEBSERVER
+  #define IDF_WEBSERVER false   // Use the ESP-IDF esp_http_server, takes precedence over ASYNC_WEBSERVER
+#endif
+
 #include <Arduino.h>
-#include <Preferences.h>
-#if ASYNC_WEBSERVER == true
-  #include <ESPAsyncWebServer.h>
+#include <atomic>
+#include <vector>
+#include "wifimanager_hal.h"
+#include "wifimanager_selection.h"
+#include "wifimanager_json.h"
+#include "wifimanager_linkquality.h"
+#include "wifimanager_trace.h"
+#include "wifimanager_radioowner.h"
+#include "wifimanager_linkstate.h"
+#include "wifimanager_http.h"
+
+
+void wifiTask(void* param);
+
+// Handle of the background task, created by WifiManagerTasks::start()
+#if defined(ESP32)
+typedef TaskHandle_t wifiTaskHandle_t;
 #else
-  #include <WebServer.h>
+typedef void * wifiTaskHandle_t;
 #endif
 
+// How a stored network gets its IP address
+enum wifiIpMode_t : uint8_t {
+  WIFI_IP_DHCP = 0,                 // Request a lease on each connect
+  WIFI_IP_STATIC,                   // Use the configured static address
+  WIFI_IP_LAST_LEASE,               // Reuse the last lease, DHCP if the gateway is not reachable with it
+};
 
-void wifiTask(void* param);
+// IP configuration of a stored network, addresses in network byte order as used by IPAddress
+struct wifiIpConfig_t {
+  wifiIpMode_t mode = WIFI_IP_DHCP;
+  uint32_t ip = 0;                  // Static address or last lease, 0 uses DHCP
+  uint32_t gateway = 0;
+  uint32_t netmask = 0;
+  uint32_t dns = 0;
+};
+
+// Connection statistics, see WIFIMANAGER::getMetrics()
+struct wifiMetrics_t {
+  uint32_t scans = 0;               // Number of scans done to select a network
+  uint32_t connectAttempts = 0;     // Number of connection attempts
+  uint32_t connectSuccess = 0;      // Number of successful connection attempts
+  uint64_t radioActiveMillis = 0;   // Time spent scanning and connecting
+  uint32_t timeToIpMillis[WIFIMANAGER_METRICS_SAMPLES] = { 0 }; // Recent durations of successful tryConnect() calls
+  uint8_t timeToIpCount = 0;        // Number of valid samples
+  uint8_t timeToIpPos = 0;          // Next sample to overwrite
+  uint32_t ipModeConnects[3] = { 0 }; // Successful connections by the wifiIpMode_t used
+  uint64_t ipModeMillis[3] = { 0 }; // Sum of the connection times from begin() to IP by the wifiIpMode_t used
+  uint32_t bursts = 0;              // Number of burst() calls
+  uint32_t lastBurstRadioMillis = 0; // Radio on time of the last burst()
+};
+
+// Last successful connection, allows to skip the scan and DHCP
+struct wifiConnectionCache_t {
+  uint8_t apId = UINT8_MAX;         // ID within the apList, UINT8_MAX if there is no cache
+  uint32_t ssidHash = 0;            // Hash of the SSID, invalidates the cache if the apList entry changed
+  uint8_t channel = 0;              // Primary channel of the AP
+  uint8_t bssid[6] = { 0 };         // MAC of the AP
+  uint32_t ip = 0;                  // Last IP lease, in network byte order
+  uint32_t gateway = 0;
+  uint32_t netmask = 0;
+  uint32_t dns = 0;
+};
+
+// Connection state kept in the retained (RTC) memory during deep sleep
+struct wifiRetainedState_t {
+  uint32_t magic;                   // Layout version, WIFIMANAGER_RETAINED_MAGIC
+  uint32_t nsHash;                  // Hash of the NVS namespace of the owning instance
+  wifiConnectionCache_t cache;      // Last successful connection
+  char apName[33];                  // Credentials of the cached network, no NVS access required
+  char apPass[65];
+  uint32_t checksum;                // FNV-1a of all previous bytes
+};
+static_assert(sizeof(wifiRetainedState_t) <= WIFIMANAGER_RETAINED_SIZE, "wifiRetainedState_t exceeds WIFIMANAGER_RETAINED_SIZE");
+
+// Result of WIFIMANAGER::burst()
+struct wifiBurstResult_t {
+  bool connected = false;           // The connection was established and the callback executed
+  bool usedCache = false;           // Connected with the cached channel, BSSID and IP
+  uint32_t connectMillis = 0;       // Time until the connection was usable
+  uint32_t radioOnMillis = 0;       // Time from enabling to disabling the radio
+};
+
+// Reconnect backoff and radio budget, see WIFIMANAGER::configureBackoff()
+struct wifiBackoffConfig_t {
+  uint32_t initialMillis = 15000;   // Delay after the first failed connection attempt
+  uint16_t multiplierPercent = 200; // Growth of the delay after each further failure, 200 doubles it
+  uint32_t maxMillis = 600000;      // Upper limit of the delay
+  uint8_t jitterPercent = 20;       // Random +/- variation of each delay, prevents fleets reconnecting in lockstep
+  uint8_t radioDutyPercent = 100;   // Max share of time to spend scanning and connecting, 100 disables the budget
+  uint32_t dutyWindowMillis = 600000; // Time window the radio budget applies to
+};
+
+// Work in progress of WIFIMANAGER::tick()
+enum wifiTickState_t : uint8_t {
+  WIFI_TICK_IDLE = 0,               // Waiting for the next check
+  WIFI_TICK_SCANNING,               // Scan started, polling for the result
+  WIFI_TICK_CONNECTING,             // Connection to a candidate started, polling for the result
+};
+
+// Power policy of the station, see WIFIMANAGER::setPowerPolicy()
+enum wifiPowerPolicy_t : uint8_t {
+  WIFI_POWER_LOW_LATENCY = 0,       // No modem sleep, fastest response to inbound requests
+  WIFI_POWER_BALANCED,              // Modem sleep between DTIM beacons, the driver default
+  WIFI_POWER_MAX_SAVINGS,           // Modem sleep for the listen interval, highest latency
+  WIFI_POWER_ADAPTIVE,              // Low latency during HTTP activity, balanced while idle
+};
+
+// Action taken if the health checks fail repeatedly
+enum wifiHealthAction_t : uint8_t {
+  WIFI_HEALTH_ACTION_NONE = 0,      // Only report the state
+  WIFI_HEALTH_ACTION_RECONNECT,     // Reconnect, the network is selected again
+  WIFI_HEALTH_ACTION_FAILOVER,      // Block the current network for a while and connect to another one
+};
+
+// Connectivity health checks, see WIFIMANAGER::configureHealthCheck()
+struct wifiHealthConfig_t {
+  uint32_t intervalMillis = 0;      // Time between two checks, 0 disables the health checks
+  uint32_t timeoutMillis = 2000;    // Timeout of a single probe
+  bool probeGateway = true;         // Ping the gateway
+  String dnsHost;                   // Hostname to resolve, empty skips the DNS probe
+  String httpUrl;                   // URL to GET, e.g. http://192.168.0.2/generate_204, empty skips the HTTP probe
+  uint16_t httpStatus = 204;        // Expected HTTP status code
+  uint8_t failureThreshold = 3;     // Failed checks in a row until the action is taken
+  wifiHealthAction_t action = WIFI_HEALTH_ACTION_FAILOVER;
+};
+
+// Statistics of a single probe type
+struct wifiProbeStats_t {
+  uint32_t runs = 0;                // Number of probes
+  uint32_t failures = 0;            // Number of failed probes
+  int32_t lastLatencyMillis = -1;   // Latency of the last probe or WIFI_PROBE_* on failure
+  uint32_t avgLatencyMillis = 0;    // Moving average latency of the successful probes
+};
+
+// Results of the health checks, see WIFIMANAGER::getHealth()
+struct wifiHealth_t {
+  bool healthy = true;              // Result of the last check
+  uint8_t consecutiveFailures = 0;  // Failed checks in a row
+  uint32_t checks = 0;              // Number of checks
+  uint32_t actions = 0;             // Number of reconnects or failovers triggered
+  uint64_t lastCheckMillis = 0;     // Time of the last check
+  wifiProbeStats_t gateway;
+  wifiProbeStats_t dns;
+  wifiProbeStats_t http;
+};
+
+// Resource usage of the background task, see WIFIMANAGER::getTaskUsage()
+struct wifiTaskUsage_t {
+  bool running = false;             // The background task is started
+  bool statsValid = false;          // The platform reports the stack usage
+  bool cpuValid = false;            // The platform reports the CPU time
+  uint32_t stackFreeMin = 0;        // Lowest free stack since the start, same unit as wifiTaskConfig_t::stackSize
+  uint32_t loops = 0;               // Number of loop() runs of the task
+  uint64_t loopMicros = 0;          // Time spent within loop(), including waits for the radio
+  uint64_t runTime = 0;             // CPU time used by the task, in the unit of the platform
+  uint64_t runTimeTotal = 0;        // Elapsed time since the start in the same unit
+  uint32_t lastRunTime = 0;         // Raw counters of the last sample, to handle the wrap around
+  uint32_t lastRunTimeTotal = 0;
+};
 
 class WIFIMANAGER {
+  friend void wifiTask(void* param);
+
   protected:
+#if IDF_WEBSERVER == true
+    httpd_handle_t webServer = nullptr; // The Webserver to register routes on
+
+    // Passed to the esp_http_server as user context of a route
+    struct apiContext_t {
+      WIFIMANAGER * manager;
+      wifiApiRoute_t route;
+    };
+    apiContext_t apiContexts[WIFI_API_ROUTES];
+
+    // URI handler of the esp_http_server
+    static esp_err_t handleHttpd(httpd_req_t * request);
+#else
+    friend class WifiApiHandler<WIFIMANAGER>;
 #if ASYNC_WEBSERVER == true
-    AsyncWebServer * webServer;         // The Webserver to register routes on
+    AsyncWebServer * webServer = nullptr; // The Webserver to register routes on
 #else
-    WebServer * webServer;              // The Webserver to register routes on
+    WebServer * webServer = nullptr;    // The Webserver to register routes on
+#endif
+    WifiApiHandler<WIFIMANAGER> * apiHandler = nullptr; // Dispatcher of all API routes
 #endif
     String apiPrefix = "/api/wifi";     // Prefix for all IP endpionts
 
-    Preferences preferences;            // Used to store AP credentials to NVS
+    WifiManagerHal hal;                 // Platform access to radio, NVS, clock and tasks
+    bool ownHal = false;                // The hal was created by the constructor and is released by the destructor
+    wifiTaskConfig_t taskConfig;        // Stack size, priority and core of the background task
     char * NVS;                         // Name used for NVS preferences
 
-    struct apCredentials_t {
+    struct apCredentials_t : wifiNetworkInfo_t {
       String apName;                    // Name of the AP SSID
       String apPass;                    // Password if required to the AP
+      uint32_t ssidHash = 0;            // Hash of the apName, used to match raw scan records
+      wifiBlock_t block;                // Blacklisting after failures affecting all BSSIDs, like a wrong password
+      wifiIpConfig_t ipConfig;          // Static IP or last lease
     };
     apCredentials_t apList[WIFIMANAGER_MAX_APS];  // Stored AP list
+    uint8_t ssidIndex[WIFIMANAGER_SSID_INDEX_SIZE] = { 0 }; // apList IDs + 1 by SSID hash, 0 marks an unused bucket
 
     uint8_t configuredSSIDs = 0;        // Number of stored SSIDs in the NVS
 
-    bool softApRunning = false;         // Due to lack of functions, we have to remember if the AP is already running...
+    struct blockedBssid_t : wifiBlock_t {
+      uint8_t bssid[6] = { 0 };         // MAC of the blocked AP
+    };
+    blockedBssid_t blockedBssids[WIFIMANAGER_BSSID_BLACKLIST_SIZE]; // Blacklisting after failures of a single AP
+
+    wifiConnectionCache_t connectionCache; // Last successful connection, persisted in the NVS
+    bool apListPartial = false;         // Only the cached network was restored from the retained memory
+
+    WifiLinkStateStore linkState;       // Station and SoftAP state, written by the event handler
     bool createFallbackAP = true;       // Create an AP for configuration if no other connection is available
 
     uint64_t lastWifiCheckMillis = 0;   // Time of last Wifi health check
@@ -55,6 +264,53 @@ class WIFIMANAGER {
     uint64_t startApTimeMillis = 0;     // Time when the AP was started
     uint32_t timeoutApMillis = 120000;  // Timeout of an AP when no client is connected, if timeout reached rescan, tryconnect or createAP
 
+    WifiPrioritySelection defaultSelection;           // Default strategy, rates by priority, RSSI band and success rate
+    WifiSelectionStrategy * selection = &defaultSelection; // Strategy used to order the scan results
+    uint8_t maxConnectAttempts = 2;     // Number of ranked candidates to try within one tryConnect()
+
+    wifiMetrics_t metrics;              // Connection statistics
+
+    wifiBackoffConfig_t backoff;        // Reconnect backoff and radio budget settings
+    uint32_t backoffMillis = 0;         // Current delay between connection attempts, 0 if not backing off
+    uint64_t nextConnectMillis = 0;     // Earliest time of the next connection attempt
+    uint64_t dutyWindowStartMillis = 0; // Start of the current radio budget window
+    uint64_t dutyWindowRadioMillis = 0; // metrics.radioActiveMillis at the start of the window
+    uint32_t jitterSeed = 0;            // State of the jitter random generator
+
+    WifiLinkQuality linkQuality;        // RSSI history of the current connection
+    std::mutex linkQualityMutex;        // Guards the linkQuality, the webserver and event tasks access it too
+    uint64_t lastLinkSampleMillis = 0;  // Time of the last link sample
+    uint32_t intervalLinkSampleMillis = 10000; // Interval of the link samples
+
+    std::atomic<wifiPowerPolicy_t> powerPolicy{WIFI_POWER_BALANCED}; // Power policy of the station
+    std::atomic<uint32_t> powerIdleTimeoutMillis{10000}; // Adaptive policy: time without activity until the modem sleeps again
+    std::atomic<uint64_t> lastActivityMillis{0}; // Time of the last notifyActivity() call
+    std::atomic<bool> powerBoosted{false}; // Adaptive policy: modem sleep is disabled due to activity
+    std::atomic<bool> powerPolicyPending{false}; // The radio was busy, the next loop() or tick() applies the policy
+
+    wifiHealthConfig_t healthConfig;    // Connectivity health check settings
+    wifiHealth_t health;                // Results of the health checks
+
+    WifiTrace trace;                    // Binary event trace, exported by /trace
+
+    WifiRadioOwner radioOwner;          // Serializes the radio operations of all tasks
+    std::atomic<bool> reconnectRequested{false}; // triggerReconnect() was called, applied by the owner of the radio
+    std::atomic<uint8_t> controlRequested{WIFI_API_ROUTES}; // Control endpoint called while the radio was busy, applied by the owner
+
+    wifiTaskUsage_t taskUsage;          // Stack and CPU usage of the background task
+
+    bool tickStarted = false;           // tick() ran before
+    wifiTickState_t tickState = WIFI_TICK_IDLE; // Scan or connection attempt running within tick()
+    bool tickCached = false;            // The running attempt uses the cached connection
+    wifiCandidate_t tickCandidates[WIFIMANAGER_MAX_CANDIDATES]; // Ranked networks of the running attempt
+    uint8_t tickNumCandidates = 0;
+    uint8_t tickCandidate = 0;          // Index of the candidate being connected
+    wifiIpConfig_t tickIpConfig;        // Lease of the cached connection
+    wifiIpMode_t tickIpMode = WIFI_IP_DHCP; // IP mode of the candidate being connected
+    uint64_t tickStartMillis = 0;       // Start of the running attempt, for the time to IP
+    uint64_t tickJoinMillis = 0;        // Start of the connection to the current candidate
+    uint32_t tickRadioSequence = 0;     // radioOwner.sequence() of the last tick(), detects radio changes of other tasks
+
     String softApName;                  // Name of the soft AP if created, default to ESP_XXXXXXXX if empty
     String softApPass;                  // Password for the soft AP, default to no password (empty)
 
@@ -63,15 +319,186 @@ class WIFIMANAGER {
 
     // Get id of the first non empty entry
     uint8_t getApEntry();
+
+    // Recreate the ssidIndex from the apList, called on each change of the apList
+    void rebuildSsidIndex();
     
     // Print a log message to Serial, can be overwritten
     virtual void logMessage(String msg);
 
+    enum scanField_t : uint8_t {
+      SCAN_FIELD_SSID       = 1 << 0,
+      SCAN_FIELD_ENCRYPTION = 1 << 1,
+      SCAN_FIELD_RSSI       = 1 << 2,
+      SCAN_FIELD_CHANNEL    = 1 << 3,
+      SCAN_FIELD_BSSID      = 1 << 4,
+    };
+
+    struct scanQuery_t {
+      bool sortRssi = false;            // Strongest networks first
+      bool uniqueSsid = false;          // Only the strongest BSSID of each SSID
+      uint16_t limit = UINT16_MAX;      // Max number of networks in the response
+      int8_t minRssi = INT8_MIN;        // Skip networks with a weaker signal
+      uint8_t fields = SCAN_FIELD_SSID | SCAN_FIELD_ENCRYPTION | SCAN_FIELD_RSSI | SCAN_FIELD_CHANNEL; // Attributes to output
+    };
+
+    // Read the /scan query parameters
+    bool parseScanQuery(scanQuery_t & query, std::function<String(const char *)> param);
+
+    // Select the scan records to output in a single pass
+    void selectScanResults(const scanQuery_t & query, int16_t scanResult, std::vector<uint16_t> & selected);
+
+    // Handle a request of the RESTful API, R is the request adapter of the webserver
+    template<typename R> void handleApi(wifiApiRoute_t route, R & http);
+
+    // Endpoints of the RESTful API
+    template<typename R> void apiControl(wifiApiRoute_t route, R & http);
+    template<typename R> void apiAddWifi(R & http);
+    template<typename R> void apiDelWifi(wifiApiRoute_t route, R & http);
+    template<typename R> void apiPower(R & http);
+    template<typename R> void apiConfigList(R & http);
+    template<typename R> void apiScan(R & http);
+    template<typename R> void apiHistory(R & http);
+    template<typename R> void apiTrace(R & http);
+    template<typename R> void apiStatus(R & http);
+    template<typename R> void apiMetrics(R & http);
+
+    // Connect to a single candidate and wait for the result, ipConfig defaults to the one of the network
+    bool connectToCandidate(const wifiCandidate_t & candidate, const wifiIpConfig_t * ipConfig = nullptr);
+
+    // Configure the IP address and start the connection, returns the IP mode used
+    wifiIpMode_t beginCandidate(const wifiCandidate_t & candidate, const wifiIpConfig_t * ipConfig);
+
+    // Update statistics, cache and blacklist after a connection attempt, returns true if connected
+    bool finishCandidate(const wifiCandidate_t & candidate, wifiLinkStatus_t status, wifiIpMode_t ipMode, uint64_t startMillis);
+
+    // Start the connection to the candidate
+    void startJoin(const wifiCandidate_t & candidate);
+
+    // Wait until the connection is established or failed
+    wifiLinkStatus_t waitForJoin();
+
+    // Like waitForConnectResult() of the radio, but gives up if the connection attempt is cancelled
+    wifiLinkStatus_t waitForLink(uint32_t timeoutMillis);
+
+    // Scan and wait for the result, gives up if another task requests the radio
+    int16_t scanUntilComplete();
+
+    // Check the configuration and SoftAP before a connection attempt
+    bool readyToConnect();
+
+    // Use the only configured SSID as candidate, returns the number of candidates
+    uint8_t singleCandidate(wifiCandidate_t * candidates);
+
+    // Match the scan records against the configured SSIDs, returns the number of ranked candidates
+    uint8_t collectCandidates(int16_t scanResult, uint32_t scanMillis, wifiCandidate_t * candidates);
+
+    // Check an established connection, returns false if the SSID is unknown
+    bool superviseConnection(const wifiLinkState_t & link, bool runHealthCheck);
+
+    // Run a SoftAP or client request of the API that was queued while the radio was busy
+    void applyControlRequest();
+
+    // Reset the backoff if triggerReconnect() was called
+    void applyReconnectRequest();
+
+    // Check the SoftAP, backoff and radio budget before a connection attempt
+    bool connectAllowed();
+
+    // Reset or schedule the backoff and start the SoftAP after a failed attempt
+    void connectFinished(bool connected);
+
+    // Close the SoftAP after the timeout, returns true if it was closed
+    bool checkSoftApTimeout();
+
+    // Steps of tick(), each returns the milliseconds until the next call
+    uint32_t tickStartConnect();
+    uint32_t tickScan();
+    uint32_t tickNextCandidate();
+    uint32_t tickConnect();
+    uint32_t tickIdleMillis();
+
+    // Write the IP configuration of a network into the opened NVS namespace
+    void storeIpConfig(uint8_t apId);
+
+    // Schedule the next connection attempt after a failure
+    void scheduleBackoff();
+
+    // Check whether the radio budget allows another connection attempt
+    bool radioBudgetAvailable();
+
+    // Check if the last scan contains one of the known SSIDs
+    bool scanSeesKnownSsid(int16_t scanResult);
+
+    // Check if the connection cache matches the current apList
+    bool connectionCacheValid();
+
+    // Remember a successful connection, written to the NVS if it changed
+    void updateConnectionCache(uint8_t apId, const wifiLinkInfo_t & link);
+
+    // Serialize the connection cache into the NVS, the store has to be opened
+    void storeConnectionCache();
+
+    // Keep the connection cache and its credentials in the retained memory
+    void storeRetainedState();
+
+    // Restore the cached network from the retained memory, false if it is invalid
+    bool restoreRetainedState();
+
+    // Connect to the cached BSSID and channel with the cached IP lease
+    bool connectCached(uint64_t startMillis);
+
+    // Build the candidate and IP configuration of the cached connection
+    void cachedCandidate(wifiCandidate_t & candidate, wifiIpConfig_t & lease);
+
+    // Add a time to IP sample
+    void recordTimeToIp(uint64_t startMillis);
+
+    // Check if a candidate is blacklisted
+    bool isBlocked(const wifiCandidate_t & candidate);
+
+    // Blacklist the network or BSSID of a failed candidate depending on the failure class
+    void recordFailure(const wifiCandidate_t & candidate, wifiFailureClass_t failure);
+
+    // Add a link sample if due
+    void sampleLinkQuality();
+
+    // Apply the power policy to the radio
+    void applyPowerPolicy();
+
+    // Apply the power policy now if the radio is free, otherwise by the next loop() or tick()
+    void requestPowerPolicy();
+
+    // Adaptive policy: return to modem sleep after the idle timeout
+    void updatePowerPolicy();
+
+    // Run the health checks if due and reconnect or failover on repeated failures
+    void checkHealth(uint8_t apId, const wifiLinkState_t & link);
+
+    // Update the stack and CPU usage of the background task, called from the task
+    void sampleTaskUsage(uint64_t loopMicros);
+
+    // Add a record to the event trace
+    void traceEvent(wifiTraceType_t type, uint8_t a = 0, uint16_t b = 0, uint32_t arg1 = 0, uint32_t arg2 = 0) {
+      trace.record((uint32_t)hal.clock->micros(), type, a, b, arg1, arg2);
+    }
+
+    // Update the statistics of a probe, returns false if the probe failed
+    static bool recordProbe(wifiProbeStats_t & stats, int32_t result);
+
+    // Remember the outcome of a connection attempt for the success rate
+    void recordConnectResult(uint8_t apId, bool success);
+
   public:
     // We let the loop run as as Task
-    TaskHandle_t WifiCheckTask;
+    wifiTaskHandle_t WifiCheckTask = nullptr;
 
-    WIFIMANAGER(const char * ns = "wifimanager");
+#if defined(ESP32)
+    WIFIMANAGER(const char * ns = "wifimanager", WifiManagerHal * customHal = nullptr);
+#else
+    // without the ESP32 core there is no default HAL
+    WIFIMANAGER(const char * ns, WifiManagerHal * customHal);
+#endif
     virtual ~WIFIMANAGER();
 
     // If no known Wifi can't be found, create an AP but retry regulary
@@ -83,15 +510,25 @@ class WIFIMANAGER {
     // Call to run the Task in the background
     void startBackgroundTask(String apName = "", String apPass = "");
 
+    // Without background task: do the pending work without blocking, returns the ms until the next call
+    uint32_t tick();
+
     // Attach a webserver and register api routes
-#if ASYNC_WEBSERVER == true
+#if IDF_WEBSERVER == true
+    void attachWebServer(httpd_handle_t srv);
+#elif ASYNC_WEBSERVER == true
     void attachWebServer(AsyncWebServer * srv);
 #else
     void attachWebServer(WebServer * srv);
 #endif
 
+    // Remove the api routes from the webserver again
+    void detachWebServer();
+
     // Add another AP to the list of known WIFIs
-    bool addWifi(String apName, String apPass, bool updateNVS = true);
+    bool addWifi(String apName, String apPass, bool updateNVS = true,
+      uint8_t apPriority = WIFIMANAGER_DEFAULT_PRIORITY, int8_t apMinRssi = WIFIMANAGER_NO_RSSI_FLOOR,
+      const wifiIpConfig_t & ipConfig = wifiIpConfig_t());
 
     // Delete Wifi from apList by ID
     bool delWifi(uint8_t apId);
@@ -99,6 +536,75 @@ class WIFIMANAGER {
     // Delete Wifi from apList by Name
     bool delWifi(String apName);
 
+    // Set the width of the RSSI band in which networks of the same priority are considered equal
+    void setRssiBand(uint8_t bandDb);
+
+    // Use a custom strategy to order the scan results, nullptr restores the default
+    void setSelectionStrategy(WifiSelectionStrategy * strategy);
+
+    // Number of ranked networks to try within one connection attempt
+    void setMaxConnectAttempts(uint8_t attempts);
+
+    // Get the connection statistics
+    const wifiMetrics_t & getMetrics();
+
+    // Get a percentile (0-100) of the recent time to IP samples, 0 if there is none
+    uint32_t getTimeToIpPercentile(uint8_t percentile);
+
+    // Reset the connection statistics
+    void resetMetrics();
+
+    // Configure the backoff between failed connection attempts and the radio budget
+    void configureBackoff(const wifiBackoffConfig_t & config);
+
+    // Get the current backoff configuration
+    const wifiBackoffConfig_t & getBackoffConfig();
+
+    // Reset the backoff and try to connect with the next loop() run
+    void triggerReconnect();
+
+    // Set the power policy, applied immediately and on each connect
+    void setPowerPolicy(wifiPowerPolicy_t policy, uint32_t idleTimeoutMillis = 10000);
+
+    // Get the power policy
+    wifiPowerPolicy_t getPowerPolicy();
+
+    // Report network activity, keeps the adaptive policy in low latency mode
+    void notifyActivity();
+
+    // Set the interval of the link samples, the background task runs at least every 10 seconds
+    void setLinkSampleInterval(uint32_t intervalMillis);
+
+    // Set the weight (1-100 %) of a new sample for the smoothed RSSI
+    void setRssiSmoothing(uint8_t alphaPercent);
+
+    // Get a copy of the RSSI history of the current connection
+    WifiLinkQuality getLinkQuality();
+
+    // Configure the connectivity health checks of an established connection
+    void configureHealthCheck(const wifiHealthConfig_t & config);
+
+    // Get the results of the health checks
+    const wifiHealth_t & getHealth();
+
+    // Get a consistent copy of the station and SoftAP state, lock-free and without driver calls
+    wifiLinkState_t getLinkState();
+
+    // Get the binary event trace
+    const WifiTrace & getTrace();
+
+    // Set the stack size, priority and core of the background task, used by the next startBackgroundTask()
+    void setTaskConfig(const wifiTaskConfig_t & config);
+
+    // Get the settings of the background task
+    const wifiTaskConfig_t & getTaskConfig();
+
+    // Get the stack and CPU usage of the background task
+    const wifiTaskUsage_t & getTaskUsage();
+
+    // Connect as fast as possible, run the work and disable the radio again
+    wifiBurstResult_t burst(std::function<void()> work);
+
     // Try each known SSID and connect until none is left or one is connected.
     bool tryConnect();
 
@@ -123,6 +629,9 @@ class WIFIMANAGER {
     // Run in the loop to maintain state
     void loop();
 
+    // Hash a raw SSID, used by the ssidIndex and the trace
+    static uint32_t hashSsid(const uint8_t * ssid, uint8_t len);
+
     // Write AP Settings into persistent storage. Called on each addAP;
     bool writeToNVS();
 
@@ -0,0 +1,222 @@
+/**
+ * Wifi Manager - hardware abstraction layer
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_HAL_h
+#define WIFIMANAGER_HAL_h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+// Radio operation mode
+enum wifiRadioMode_t : uint8_t {
+  WIFI_RADIO_OFF = 0,
+  WIFI_RADIO_STA,
+  WIFI_RADIO_AP,
+  WIFI_RADIO_AP_STA,
+};
+
+// Station link state, values match the Arduino wl_status_t
+enum wifiLinkStatus_t : uint8_t {
+  WIFI_LINK_IDLE = 0,
+  WIFI_LINK_NO_SSID_AVAIL = 1,
+  WIFI_LINK_SCAN_COMPLETED = 2,
+  WIFI_LINK_CONNECTED = 3,
+  WIFI_LINK_CONNECT_FAILED = 4,
+  WIFI_LINK_CONNECTION_LOST = 5,
+  WIFI_LINK_DISCONNECTED = 6,
+  WIFI_LINK_NO_SHIELD = 255,
+};
+
+// Modem power save of the station, values match the ESP-IDF wifi_ps_type_t
+enum wifiPowerSave_t : uint8_t {
+  WIFI_POWER_SAVE_NONE = 0,         // Radio always on
+  WIFI_POWER_SAVE_MIN_MODEM,        // Wake up for every DTIM beacon
+  WIFI_POWER_SAVE_MAX_MODEM,        // Wake up for every listen interval
+};
+
+// Return values of scan() and scanComplete() besides the number of records
+#define WIFI_RADIO_SCAN_RUNNING (-1)
+#define WIFI_RADIO_SCAN_FAILED  (-2)
+
+// Return values of the connectivity probes besides the latency
+#define WIFI_PROBE_FAILED       (-1)
+#define WIFI_PROBE_UNSUPPORTED  (-2)
+
+// A single scan result
+struct wifiScanRecord_t {
+  uint8_t ssid[33];                 // Null terminated SSID
+  uint8_t bssid[6];                 // MAC of the AP
+  uint8_t channel;                  // Primary channel
+  int8_t rssi;                      // Signal strength
+  uint8_t authmode;                 // wifi_auth_mode_t, 0 is an open network
+};
+
+// Information about the current station connection
+struct wifiLinkInfo_t {
+  char ssid[33];                    // Null terminated SSID, empty if not connected
+  uint8_t bssid[6];                 // MAC of the AP
+  uint8_t channel;                  // Primary channel
+  int8_t rssi;                      // Signal strength
+  uint32_t ip;                      // IPv4 addresses in network byte order as used by IPAddress
+  uint32_t gateway;
+  uint32_t netmask;
+  uint32_t dns;
+};
+
+// Events reported by the radio
+enum wifiRadioEventType_t : uint8_t {
+  WIFI_RADIO_EVENT_AP_START,
+  WIFI_RADIO_EVENT_AP_STOP,
+  WIFI_RADIO_EVENT_AP_CLIENT_CONNECTED,
+  WIFI_RADIO_EVENT_AP_CLIENT_DISCONNECTED,
+  WIFI_RADIO_EVENT_STA_CONNECTED,
+  WIFI_RADIO_EVENT_STA_DISCONNECTED,
+  WIFI_RADIO_EVENT_STA_GOT_IP,
+  WIFI_RADIO_EVENT_STA_LOST_IP,
+};
+
+struct wifiRadioEvent_t {
+  wifiRadioEventType_t type;
+  uint8_t reason;                   // 802.11 reason code of WIFI_RADIO_EVENT_STA_DISCONNECTED
+  int8_t rssi;                      // Signal strength when the event occurred, if known
+  wifiLinkInfo_t link;              // STA_CONNECTED: ssid, bssid and channel, STA_GOT_IP: the addresses
+};
+
+typedef std::function<void(const wifiRadioEvent_t & event)> wifiRadioEventCb;
+
+// Access to the WiFi radio and network interface
+class WifiManagerRadio {
+  public:
+    virtual ~WifiManagerRadio() {}
+
+    // Register the single event callback of the WifiManager, nullptr to unregister it
+    virtual void onEvent(wifiRadioEventCb callback) = 0;
+
+    virtual void setMode(wifiRadioMode_t mode) = 0;
+
+    // Start a scan including hidden networks, returns the number of records or WIFI_RADIO_SCAN_*
+    virtual int16_t scan(bool async) = 0;
+    // Number of records of the last scan or WIFI_RADIO_SCAN_*
+    virtual int16_t scanComplete() = 0;
+    // Copy a single record of the last scan
+    virtual bool scanRecord(uint16_t index, wifiScanRecord_t & record) = 0;
+    // Release the records of the last scan
+    virtual void scanDelete() = 0;
+
+    // Start to connect, channel 0 and bssid nullptr let the driver search the SSID
+    virtual void begin(const char * ssid, const char * pass, uint8_t channel = 0, const uint8_t * bssid = nullptr) = 0;
+    // Use a static IP configuration for the next connections, ip 0 enables DHCP again
+    virtual void config(uint32_t ip, uint32_t gateway, uint32_t netmask, uint32_t dns) = 0;
+    // Block until the connection is established, failed or the timeout is reached
+    virtual wifiLinkStatus_t waitForConnectResult(uint32_t timeoutMs) = 0;
+    virtual wifiLinkStatus_t status() = 0;
+    virtual void disconnect() = 0;
+    // Fill the information of the current station connection, returns false if not connected
+    virtual bool linkInfo(wifiLinkInfo_t & info) = 0;
+    virtual const char * hostname() = 0;
+    virtual void setPowerSave(wifiPowerSave_t mode) = 0;
+
+    // Connectivity probes through the station interface, return the latency in ms or WIFI_PROBE_*
+    virtual int32_t probeGateway(uint32_t gateway, uint32_t timeoutMs) = 0;
+    virtual int32_t probeDns(const char * host, uint32_t timeoutMs) = 0;
+    // HTTP GET, fails if the server does not answer with the expected status code
+    virtual int32_t probeHttp(const char * url, uint16_t expectStatus, uint32_t timeoutMs) = 0;
+
+    virtual bool softAP(const char * ssid, const char * pass) = 0;
+    virtual void softAPdisconnect() = 0;
+    virtual uint8_t softAPgetStationNum() = 0;
+    virtual uint32_t softAPIP() = 0;
+
+    // Unique ID of the device, used for the default SoftAP name
+    virtual uint64_t deviceId() = 0;
+};
+
+#ifndef WIFIMANAGER_RETAINED_SIZE
+#define WIFIMANAGER_RETAINED_SIZE 192       // Bytes of memory kept during deep sleep (RTC memory on ESP32)
+#endif
+
+// Persistent key value storage, modeled after the Arduino Preferences
+class WifiManagerStore {
+  public:
+    virtual ~WifiManagerStore() {}
+
+    virtual bool begin(const char * ns, bool readOnly) = 0;
+    virtual void end() = 0;
+    virtual bool clear() = 0;
+    virtual bool isKey(const char * key) = 0;
+
+    // Copy a string value including the null terminator, returns the length or 0 if missing
+    virtual size_t getString(const char * key, char * value, size_t maxLen) = 0;
+    virtual bool putString(const char * key, const char * value) = 0;
+    virtual uint8_t getUChar(const char * key, uint8_t defaultValue) = 0;
+    virtual bool putUChar(const char * key, uint8_t value) = 0;
+    virtual int8_t getChar(const char * key, int8_t defaultValue) = 0;
+    virtual bool putChar(const char * key, int8_t value) = 0;
+
+    // Memory kept during deep sleep but lost on power loss, up to WIFIMANAGER_RETAINED_SIZE bytes
+    virtual bool readRetained(void * data, size_t len) = 0;
+    virtual bool writeRetained(const void * data, size_t len) = 0;
+};
+
+// Time source and waiting
+class WifiManagerClock {
+  public:
+    virtual ~WifiManagerClock() {}
+
+    virtual uint64_t millis() = 0;
+    virtual uint64_t micros() = 0;
+    // Block the calling task for the given time
+    virtual void delay(uint32_t ms) = 0;
+    // Give other tasks a chance to run
+    virtual void yield() = 0;
+};
+
+// Settings of the background task
+struct wifiTaskConfig_t {
+  uint32_t stackSize = 4096;        // Stack size, in bytes on ESP32 (ESP-IDF FreeRTOS)
+  uint8_t priority = 1;             // Priority of the task
+  int8_t core = 0;                  // Core where the task should run
+};
+
+// Resource usage of a task, see WifiManagerTasks::stats()
+struct wifiTaskStats_t {
+  uint32_t stackFreeMin = 0;        // Lowest free stack since the start, same unit as wifiTaskConfig_t::stackSize
+  bool runTimeValid = false;        // The platform measures the CPU time of tasks
+  uint32_t runTime = 0;             // CPU time used by the task, wraps around
+  uint32_t runTimeTotal = 0;        // Elapsed time in the same unit, wraps around
+};
+
+// Background task handling
+class WifiManagerTasks {
+  public:
+    virtual ~WifiManagerTasks() {}
+
+    // Run fn(param) in a new task, returns an opaque task handle or nullptr on error
+    virtual void * start(void (*fn)(void *), void * param, const char * name, const wifiTaskConfig_t & config) = 0;
+    // Stop a task created by start(), also allowed from within the task itself
+    virtual void stop(void * handle) = 0;
+    // Read the stack and CPU usage of a task created by start(), returns false if not supported
+    virtual bool stats(void * handle, wifiTaskStats_t & stats) = 0;
+};
+
+// Bundle of all platform dependencies used by the WifiManager
+struct WifiManagerHal {
+  WifiManagerRadio * radio;
+  WifiManagerStore * store;
+  WifiManagerClock * clock;
+  WifiManagerTasks * tasks;
+};
+
+#if defined(ESP32)
+// HAL using the ESP32 Arduino core, created for every WifiManager that is not given another HAL
+WifiManagerHal wifiManagerCreateHal();
+// Release a HAL returned by wifiManagerCreateHal()
+void wifiManagerDestroyHal(WifiManagerHal & hal);
+#endif
+
+#endif
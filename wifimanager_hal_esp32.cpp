@@ -0,0 +1,395 @@
+/**
+ * Wifi Manager - ESP32 Arduino implementation of the hardware abstraction layer
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#if defined(ESP32)
+
+#include "wifimanager_hal.h"
+#include <Arduino.h>
+#include <WiFi.h>
+#include <Preferences.h>
+#include <HTTPClient.h>
+#include <esp_wifi.h>
+#include <vector>
+#if ESP_ARDUINO_VERSION_MAJOR >= 2
+  #include <ping/ping_sock.h>
+  #include <lwip/dns.h>
+  #include <lwip/priv/tcpip_priv.h>
+#endif
+#include <atomic>
+
+#if ESP_ARDUINO_VERSION_MAJOR >= 2
+  #define WIFIMANAGER_EVENT(v2, v1) v2    // arduino-esp32 2.0.0 and later
+#else
+  #define WIFIMANAGER_EVENT(v2, v1) v1    // arduino-esp32 1.0.6
+#endif
+
+/**
+ * @brief Radio implementation using the Arduino WiFi class
+ */
+class WifiManagerEsp32Radio : public WifiManagerRadio {
+  protected:
+    wifiRadioEventCb callback;          // Event callback of the WifiManager
+    std::vector<wifi_event_id_t> eventIds; // Handlers registered at the WiFi class
+
+    void registerEvent(WiFiEvent_t id, wifiRadioEventType_t type) {
+      eventIds.push_back(WiFi.onEvent([this, type](WiFiEvent_t event, WiFiEventInfo_t info) {
+        if (!callback) return;
+        wifiRadioEvent_t radioEvent = { type, 0, 0, {} };
+        if (type == WIFI_RADIO_EVENT_STA_DISCONNECTED) {
+#if ESP_ARDUINO_VERSION_MAJOR >= 2
+          radioEvent.reason = info.wifi_sta_disconnected.reason;
+#else
+          radioEvent.reason = info.disconnected.reason;
+#endif
+        } else if (type == WIFI_RADIO_EVENT_STA_CONNECTED) {
+#if ESP_ARDUINO_VERSION_MAJOR >= 2
+          const auto & connected = info.wifi_sta_connected;
+#else
+          const auto & connected = info.connected;
+#endif
+          memcpy(radioEvent.link.ssid, connected.ssid, connected.ssid_len < 32 ? connected.ssid_len : 32);
+          memcpy(radioEvent.link.bssid, connected.bssid, sizeof(radioEvent.link.bssid));
+          radioEvent.link.channel = connected.channel;
+          radioEvent.rssi = WiFi.RSSI();
+        } else if (type == WIFI_RADIO_EVENT_STA_GOT_IP) {
+          radioEvent.link.ip = info.got_ip.ip_info.ip.addr;
+          radioEvent.link.gateway = info.got_ip.ip_info.gw.addr;
+          radioEvent.link.netmask = info.got_ip.ip_info.netmask.addr;
+          radioEvent.link.dns = WiFi.dnsIP();
+        }
+        callback(radioEvent);
+      }, id));
+    }
+
+  public:
+    // Every instance registers its own handlers, so each WifiManager receives all events
+    ~WifiManagerEsp32Radio() {
+      for (wifi_event_id_t id : eventIds) WiFi.removeEvent(id);
+    }
+
+    void onEvent(wifiRadioEventCb cb) override {
+      callback = cb;
+      if (!eventIds.empty()) return;
+      registerEvent(WIFIMANAGER_EVENT(ARDUINO_EVENT_WIFI_AP_START, SYSTEM_EVENT_AP_START), WIFI_RADIO_EVENT_AP_START);
+      registerEvent(WIFIMANAGER_EVENT(ARDUINO_EVENT_WIFI_AP_STOP, SYSTEM_EVENT_AP_STOP), WIFI_RADIO_EVENT_AP_STOP);
+      registerEvent(WIFIMANAGER_EVENT(ARDUINO_EVENT_WIFI_AP_STACONNECTED, SYSTEM_EVENT_AP_STACONNECTED), WIFI_RADIO_EVENT_AP_CLIENT_CONNECTED);
+      registerEvent(WIFIMANAGER_EVENT(ARDUINO_EVENT_WIFI_AP_STADISCONNECTED, SYSTEM_EVENT_AP_STADISCONNECTED), WIFI_RADIO_EVENT_AP_CLIENT_DISCONNECTED);
+      registerEvent(WIFIMANAGER_EVENT(ARDUINO_EVENT_WIFI_STA_CONNECTED, SYSTEM_EVENT_STA_CONNECTED), WIFI_RADIO_EVENT_STA_CONNECTED);
+      registerEvent(WIFIMANAGER_EVENT(ARDUINO_EVENT_WIFI_STA_DISCONNECTED, SYSTEM_EVENT_STA_DISCONNECTED), WIFI_RADIO_EVENT_STA_DISCONNECTED);
+      registerEvent(WIFIMANAGER_EVENT(ARDUINO_EVENT_WIFI_STA_GOT_IP, SYSTEM_EVENT_STA_GOT_IP), WIFI_RADIO_EVENT_STA_GOT_IP);
+      registerEvent(WIFIMANAGER_EVENT(ARDUINO_EVENT_WIFI_STA_LOST_IP, SYSTEM_EVENT_STA_LOST_IP), WIFI_RADIO_EVENT_STA_LOST_IP);
+    }
+
+    void setMode(wifiRadioMode_t mode) override {
+      WiFi.mode((wifi_mode_t)mode);
+    }
+
+    int16_t scan(bool async) override {
+      return WiFi.scanNetworks(async, true);
+    }
+
+    int16_t scanComplete() override {
+      return WiFi.scanComplete();
+    }
+
+    bool scanRecord(uint16_t index, wifiScanRecord_t & record) override {
+      const wifi_ap_record_t * ap = (const wifi_ap_record_t *)WiFi.getScanInfoByIndex(index);
+      if (ap == NULL) return false;
+      memcpy(record.ssid, ap->ssid, sizeof(record.ssid));
+      record.ssid[sizeof(record.ssid) - 1] = 0;
+      memcpy(record.bssid, ap->bssid, sizeof(record.bssid));
+      record.channel = ap->primary;
+      record.rssi = ap->rssi;
+      record.authmode = ap->authmode;
+      return true;
+    }
+
+    void scanDelete() override {
+      WiFi.scanDelete();
+    }
+
+    void begin(const char * ssid, const char * pass, uint8_t channel, const uint8_t * bssid) override {
+      WiFi.begin(ssid, pass, channel, bssid);
+    }
+
+    void config(uint32_t ip, uint32_t gateway, uint32_t netmask, uint32_t dns) override {
+      WiFi.config(IPAddress(ip), IPAddress(gateway), IPAddress(netmask), IPAddress(dns));
+    }
+
+    wifiLinkStatus_t waitForConnectResult(uint32_t timeoutMs) override {
+      return (wifiLinkStatus_t)WiFi.waitForConnectResult(timeoutMs);
+    }
+
+    wifiLinkStatus_t status() override {
+      return (wifiLinkStatus_t)WiFi.status();
+    }
+
+    void disconnect() override {
+      WiFi.disconnect();
+    }
+
+    bool linkInfo(wifiLinkInfo_t & info) override {
+      memset(&info, 0, sizeof(info));
+      if (!WiFi.isConnected()) return false;
+      strncpy(info.ssid, WiFi.SSID().c_str(), sizeof(info.ssid) - 1);
+      uint8_t * bssid = WiFi.BSSID();
+      if (bssid) memcpy(info.bssid, bssid, sizeof(info.bssid));
+      info.channel = WiFi.channel();
+      info.rssi = WiFi.RSSI();
+      info.ip = WiFi.localIP();
+      info.gateway = WiFi.gatewayIP();
+      info.netmask = WiFi.subnetMask();
+      info.dns = WiFi.dnsIP();
+      return true;
+    }
+
+    const char * hostname() override {
+      return WiFi.getHostname();
+    }
+
+    void setPowerSave(wifiPowerSave_t mode) override {
+      esp_wifi_set_ps((wifi_ps_type_t)mode);
+    }
+
+    int32_t probeGateway(uint32_t gateway, uint32_t timeoutMs) override {
+#if ESP_ARDUINO_VERSION_MAJOR >= 2
+      struct pingResult_t {
+        SemaphoreHandle_t done;
+        int32_t latency;
+      } result = { xSemaphoreCreateBinary(), WIFI_PROBE_FAILED };
+      if (result.done == NULL) return WIFI_PROBE_FAILED;
+
+      esp_ping_config_t config = ESP_PING_DEFAULT_CONFIG();
+      config.target_addr.type = IPADDR_TYPE_V4;
+      config.target_addr.u_addr.ip4.addr = gateway;
+      config.count = 1;
+      config.timeout_ms = timeoutMs;
+
+      esp_ping_callbacks_t callbacks = {};
+      callbacks.cb_args = &result;
+      callbacks.on_ping_success = [](esp_ping_handle_t handle, void * args) {
+        uint32_t elapsed = 0;
+        esp_ping_get_profile(handle, ESP_PING_PROF_TIMEGAP, &elapsed, sizeof(elapsed));
+        ((pingResult_t *)args)->latency = elapsed;
+      };
+      callbacks.on_ping_end = [](esp_ping_handle_t handle, void * args) {
+        xSemaphoreGive(((pingResult_t *)args)->done);
+      };
+
+      esp_ping_handle_t ping;
+      if (esp_ping_new_session(&config, &callbacks, &ping) != ESP_OK) {
+        vSemaphoreDelete(result.done);
+        return WIFI_PROBE_FAILED;
+      }
+      esp_ping_start(ping);
+      xSemaphoreTake(result.done, pdMS_TO_TICKS(timeoutMs + 1000));
+      esp_ping_stop(ping);
+      esp_ping_delete_session(ping);
+      vSemaphoreDelete(result.done);
+      return result.latency;
+#else
+      return WIFI_PROBE_UNSUPPORTED;
+#endif
+    }
+
+#if ESP_ARDUINO_VERSION_MAJOR >= 2
+    // Name resolution of probeDns(), the answer may arrive after the timeout, the side finishing last frees it
+    struct dnsProbe_t {
+      struct tcpip_api_call_data call;  // Must be the first member, passed to tcpip_api_call()
+      const char * host;
+      SemaphoreHandle_t done;
+      std::atomic<uint8_t> refs;
+      bool resolved;
+    };
+
+    static void releaseDnsProbe(dnsProbe_t * probe) {
+      if (--probe->refs > 0) return;
+      vSemaphoreDelete(probe->done);
+      delete probe;
+    }
+#endif
+
+    int32_t probeDns(const char * host, uint32_t timeoutMs) override {
+      int64_t start = esp_timer_get_time();
+#if ESP_ARDUINO_VERSION_MAJOR >= 2
+      // WiFi.hostByName() waits for a fixed time, resolve with lwIP to wait for timeoutMs only
+      dnsProbe_t * probe = new dnsProbe_t();
+      probe->done = xSemaphoreCreateBinary();
+      if (probe->done == NULL) {
+        delete probe;
+        return WIFI_PROBE_FAILED;
+      }
+      probe->host = host;
+      probe->refs = 2;
+      probe->resolved = false;
+
+      // lwIP functions have to run in the tcpip task
+      err_t err = tcpip_api_call([](struct tcpip_api_call_data * call) -> err_t {
+        dnsProbe_t * probe = (dnsProbe_t *)call;
+        ip_addr_t addr;
+        return dns_gethostbyname(probe->host, &addr, [](const char * name, const ip_addr_t * addr, void * arg) {
+          dnsProbe_t * probe = (dnsProbe_t *)arg;
+          probe->resolved = addr != nullptr;
+          xSemaphoreGive(probe->done);
+          releaseDnsProbe(probe);
+        }, probe);
+      }, &probe->call);
+
+      bool resolved = false;
+      if (err == ERR_INPROGRESS) {
+        resolved = xSemaphoreTake(probe->done, pdMS_TO_TICKS(timeoutMs)) == pdTRUE && probe->resolved;
+      } else {
+        resolved = err == ERR_OK;     // answered from the cache, or failed, the callback is not called
+        releaseDnsProbe(probe);
+      }
+      releaseDnsProbe(probe);
+      if (!resolved) return WIFI_PROBE_FAILED;
+#else
+      // the Arduino core uses a fixed timeout for name resolution
+      IPAddress ip;
+      if (WiFi.hostByName(host, ip) != 1) return WIFI_PROBE_FAILED;
+#endif
+      return (esp_timer_get_time() - start) / 1000;
+    }
+
+    int32_t probeHttp(const char * url, uint16_t expectStatus, uint32_t timeoutMs) override {
+      int64_t start = esp_timer_get_time();
+      HTTPClient http;
+      http.setConnectTimeout(timeoutMs);
+      http.setTimeout(timeoutMs);
+      if (!http.begin(url)) return WIFI_PROBE_FAILED;
+      int status = http.GET();
+      http.end();
+      if (status != expectStatus) return WIFI_PROBE_FAILED;
+      return (esp_timer_get_time() - start) / 1000;
+    }
+
+    bool softAP(const char * ssid, const char * pass) override {
+      return WiFi.softAP(ssid, pass);
+    }
+
+    void softAPdisconnect() override {
+      WiFi.softAPdisconnect();
+    }
+
+    uint8_t softAPgetStationNum() override {
+      return WiFi.softAPgetStationNum();
+    }
+
+    uint32_t softAPIP() override {
+      return WiFi.softAPIP();
+    }
+
+    uint64_t deviceId() override {
+      return ESP.getEfuseMac();
+    }
+};
+
+// Zero initialized on power on, kept during deep sleep
+RTC_DATA_ATTR static uint8_t retainedMemory[WIFIMANAGER_RETAINED_SIZE];
+
+/**
+ * @brief Key value store implementation using the Arduino Preferences (NVS) and RTC memory
+ */
+class WifiManagerEsp32Store : public WifiManagerStore {
+  protected:
+    Preferences preferences;
+
+  public:
+    bool begin(const char * ns, bool readOnly) override { return preferences.begin(ns, readOnly); }
+    void end() override { preferences.end(); }
+    bool clear() override { return preferences.clear(); }
+    bool isKey(const char * key) override { return preferences.isKey(key); }
+
+    size_t getString(const char * key, char * value, size_t maxLen) override {
+      if (preferences.getType(key) != PT_STR) return 0;
+      return preferences.getString(key, value, maxLen);
+    }
+    bool putString(const char * key, const char * value) override { return preferences.putString(key, value) > 0 || value[0] == 0; }
+    uint8_t getUChar(const char * key, uint8_t defaultValue) override { return preferences.getUChar(key, defaultValue); }
+    bool putUChar(const char * key, uint8_t value) override { return preferences.putUChar(key, value) > 0; }
+    int8_t getChar(const char * key, int8_t defaultValue) override { return preferences.getChar(key, defaultValue); }
+    bool putChar(const char * key, int8_t value) override { return preferences.putChar(key, value) > 0; }
+
+    bool readRetained(void * data, size_t len) override {
+      if (len > sizeof(retainedMemory)) return false;
+      memcpy(data, retainedMemory, len);
+      return true;
+    }
+    bool writeRetained(const void * data, size_t len) override {
+      if (len > sizeof(retainedMemory)) return false;
+      memcpy(retainedMemory, data, len);
+      return true;
+    }
+};
+
+/**
+ * @brief Clock implementation using the Arduino time functions
+ */
+class WifiManagerEsp32Clock : public WifiManagerClock {
+  public:
+    uint64_t millis() override { return esp_timer_get_time() / 1000ULL; }
+    uint64_t micros() override { return esp_timer_get_time(); }
+    void delay(uint32_t ms) override { ::delay(ms); }
+    void yield() override { ::yield(); }
+};
+
+/**
+ * @brief Task implementation using FreeRTOS tasks
+ */
+class WifiManagerEsp32Tasks : public WifiManagerTasks {
+  public:
+    void * start(void (*fn)(void *), void * param, const char * name, const wifiTaskConfig_t & config) override {
+      TaskHandle_t handle = NULL;
+      BaseType_t taskCreated = xTaskCreatePinnedToCore(fn, name, config.stackSize, param, config.priority, &handle, config.core);
+      return taskCreated == pdPASS ? handle : NULL;
+    }
+
+    void stop(void * handle) override {
+      if (handle) vTaskDelete((TaskHandle_t)handle);
+    }
+
+    bool stats(void * handle, wifiTaskStats_t & stats) override {
+      if (!handle) return false;
+      stats.stackFreeMin = uxTaskGetStackHighWaterMark((TaskHandle_t)handle);
+#if configGENERATE_RUN_TIME_STATS == 1 && configUSE_TRACE_FACILITY == 1
+      // only available if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS is enabled in the sdkconfig
+      TaskStatus_t status;
+      vTaskGetInfo((TaskHandle_t)handle, &status, pdFALSE, eRunning);
+      stats.runTimeValid = true;
+      stats.runTime = status.ulRunTimeCounter;
+      stats.runTimeTotal = portGET_RUN_TIME_COUNTER_VALUE();
+#endif
+      return true;
+    }
+};
+
+/**
+ * @brief Create a HAL for the ESP32 Arduino core
+ * @details Each WifiManager gets its own radio, with its own event handlers, and its own
+ * Preferences. The clock and task implementations are stateless and shared. The RTC memory
+ * of the connection cache exists only once.
+ * @return WifiManagerHal new HAL, release it with wifiManagerDestroyHal()
+ */
+WifiManagerHal wifiManagerCreateHal() {
+  static WifiManagerEsp32Clock clock;
+  static WifiManagerEsp32Tasks tasks;
+  return { new WifiManagerEsp32Radio(), new WifiManagerEsp32Store(), &clock, &tasks };
+}
+
+/**
+ * @brief Release a HAL created by wifiManagerCreateHal()
+ * @param hal HAL to release
+ */
+void wifiManagerDestroyHal(WifiManagerHal & hal) {
+  delete hal.radio;
+  delete hal.store;
+  hal.radio = nullptr;
+  hal.store = nullptr;
+}
+
+#endif
@@ -0,0 +1,538 @@
+/**
+ * Wifi Manager - simulated hardware abstraction layer
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+ *
+ * Portable implementation of the HAL without any hardware dependency.
+ * It provides a scriptable RF environment, an in memory NVS, a clock and a
+ * task stub, so the connection logic can be exercised on a Linux host.
+**/
+#ifndef WIFIMANAGER_HAL_SIM_h
+#define WIFIMANAGER_HAL_SIM_h
+
+#include "wifimanager_hal.h"
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+
+/**
+ * @brief Clock based on the host steady clock
+ */
+class WifiManagerSimClock : public WifiManagerClock {
+  protected:
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+  public:
+    uint64_t millis() override { return micros() / 1000ULL; }
+    uint64_t micros() override {
+      return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+    }
+    void delay(uint32_t ms) override { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+    void yield() override { std::this_thread::yield(); }
+};
+
+/**
+ * @brief Deterministic virtual clock with a cooperative scheduler
+ * @details Time only advances by delay() or advanceTo(). Scheduled callbacks are executed
+ * in order of their due time while the time passes, even within a delay() of the
+ * WifiManager. Together with the simulated radio, hours of connection churn run in
+ * milliseconds and always produce the same result.
+ */
+class WifiManagerVirtualClock : public WifiManagerClock {
+  protected:
+    struct event_t {
+      uint64_t at;                      // Due time in microseconds
+      uint64_t seq;                     // Keeps the order of callbacks due at the same time
+      std::function<void()> fn;
+      bool operator>(const event_t & other) const {
+        return at != other.at ? at > other.at : seq > other.seq;
+      }
+    };
+    uint64_t now = 0;                   // Current virtual time in microseconds
+    uint64_t seq = 0;                   // Number of scheduled callbacks
+    std::vector<event_t> events;        // Min heap of pending callbacks
+
+  public:
+    uint64_t millis() override { return now / 1000ULL; }
+    uint64_t micros() override { return now; }
+    void delay(uint32_t ms) override { advanceTo(now + ms * 1000ULL); }
+    void yield() override {}
+
+    // Run a callback at the given absolute virtual time in milliseconds
+    void at(uint64_t ms, std::function<void()> fn) {
+      events.push_back({ ms * 1000ULL, seq++, fn });
+      std::push_heap(events.begin(), events.end(), std::greater<event_t>());
+    }
+
+    // Run a callback after the given time in milliseconds
+    void after(uint64_t ms, std::function<void()> fn) { at(millis() + ms, fn); }
+
+    // Let the time pass until the given time in microseconds, executing due callbacks
+    void advanceTo(uint64_t us) {
+      while (!events.empty() && events.front().at <= us) {
+        std::pop_heap(events.begin(), events.end(), std::greater<event_t>());
+        event_t event = events.back();
+        events.pop_back();
+        if (event.at > now) now = event.at;
+        event.fn();
+      }
+      if (us > now) now = us;
+    }
+
+    /**
+     * @brief Run a task function periodically, like the background task does
+     * @param task Usually a lambda calling WIFIMANAGER::loop()
+     * @param periodMs Delay between two runs, wifiTask uses 10000 ms
+     * @param durationMs Virtual time to simulate
+     */
+    void runPeriodic(std::function<void()> task, uint32_t periodMs, uint64_t durationMs) {
+      uint64_t end = now + durationMs * 1000ULL;
+      while (now < end) {
+        task();
+        advanceTo(std::min<uint64_t>(end, now + periodMs * 1000ULL));
+      }
+    }
+};
+
+/**
+ * @brief In memory key value store, values survive end() but not the process
+ */
+class WifiManagerSimStore : public WifiManagerStore {
+  public:
+    std::map<std::string, std::map<std::string, std::string>> data;  // namespace -> key -> raw value
+    std::vector<uint8_t> retained = std::vector<uint8_t>(WIFIMANAGER_RETAINED_SIZE, 0); // Deep sleep memory, clear it to simulate a power loss
+
+  protected:
+    std::map<std::string, std::string> * current = nullptr;
+    bool readOnly = true;
+
+    bool put(const char * key, const std::string & value) {
+      if (!current || readOnly) return false;
+      (*current)[key] = value;
+      return true;
+    }
+    const std::string * get(const char * key) {
+      if (!current) return nullptr;
+      auto it = current->find(key);
+      return it == current->end() ? nullptr : &it->second;
+    }
+
+  public:
+    bool begin(const char * ns, bool ro) override {
+      current = &data[ns];
+      readOnly = ro;
+      return true;
+    }
+    void end() override { current = nullptr; }
+    bool clear() override {
+      if (!current || readOnly) return false;
+      current->clear();
+      return true;
+    }
+    bool isKey(const char * key) override { return get(key) != nullptr; }
+
+    size_t getString(const char * key, char * value, size_t maxLen) override {
+      const std::string * v = get(key);
+      if (!v || v->size() + 1 > maxLen) return 0;
+      memcpy(value, v->c_str(), v->size() + 1);
+      return v->size() + 1;
+    }
+    bool putString(const char * key, const char * value) override { return put(key, value); }
+    uint8_t getUChar(const char * key, uint8_t defaultValue) override {
+      const std::string * v = get(key);
+      return v && v->size() == 1 ? (uint8_t)(*v)[0] : defaultValue;
+    }
+    bool putUChar(const char * key, uint8_t value) override { return put(key, std::string(1, (char)value)); }
+    int8_t getChar(const char * key, int8_t defaultValue) override {
+      const std::string * v = get(key);
+      return v && v->size() == 1 ? (int8_t)(*v)[0] : defaultValue;
+    }
+    bool readRetained(void * out, size_t len) override {
+      if (len > retained.size()) return false;
+      memcpy(out, retained.data(), len);
+      return true;
+    }
+    bool writeRetained(const void * in, size_t len) override {
+      if (len > retained.size()) return false;
+      memcpy(retained.data(), in, len);
+      return true;
+    }
+    bool putChar(const char * key, int8_t value) override { return put(key, std::string(1, (char)value)); }
+};
+
+/**
+ * @brief Task stub, the test harness drives WIFIMANAGER::loop() itself and scripts the usage statistics
+ */
+class WifiManagerSimTasks : public WifiManagerTasks {
+  public:
+    void (*fn)(void *) = nullptr;       // Function of the last started task
+    void * param = nullptr;             // Parameter of the last started task
+    bool statsValid = false;            // stats() reports taskStats, like a platform measuring its tasks
+    wifiTaskStats_t taskStats;          // Scripted stack and CPU usage of the task
+
+    void * start(void (*taskFn)(void *), void * taskParam, const char * name, const wifiTaskConfig_t & config) override {
+      fn = taskFn;
+      param = taskParam;
+      return this;
+    }
+    void stop(void * handle) override {
+      fn = nullptr;
+      param = nullptr;
+    }
+    bool stats(void * handle, wifiTaskStats_t & stats) override {
+      if (!statsValid || handle != this) return false;
+      stats = taskStats;
+      return true;
+    }
+};
+
+// A simulated access point
+struct simAccessPoint_t {
+  std::string ssid;                 // Network name
+  uint8_t bssid[6] = { 0 };         // MAC of the AP, used to identify it
+  uint8_t channel = 1;              // Primary channel
+  int8_t rssi = -60;                // Signal strength seen by the device
+  uint8_t authmode = 3;             // wifi_auth_mode_t, 0 is an open network
+  std::string pass;                 // Password required to join
+  bool hidden = false;              // Don't broadcast the SSID in scans
+  bool online = true;               // The AP is powered and reachable
+  uint32_t joinLatencyMs = 300;     // Time from begin() to an established connection
+  uint32_t dhcpLatencyMs = 200;     // Time from the connection to an IP address
+  bool rejectJoin = false;          // Refuse the association (AP full)
+  uint8_t failReason = 0;           // Let every join fail with this disconnect reason, 0 to join normally
+  bool gatewayResponds = true;      // The gateway answers pings
+  uint32_t gateway = 0x0100A8C0;    // Gateway handed out by DHCP, 192.168.0.1
+  bool uplink = true;               // DNS and HTTP probes reach their targets
+  uint32_t probeLatencyMs = 20;     // Round trip time of probes through this AP
+};
+
+/**
+ * @brief Scriptable RF environment
+ * @details Connection attempts resolve after the configured latency of the selected AP,
+ * measured with the given clock. Use it together with a virtual clock to run many hours
+ * of simulated time within seconds.
+ */
+class WifiManagerSimRadio : public WifiManagerRadio {
+  public:
+    std::vector<simAccessPoint_t> accessPoints;  // The RF environment
+    uint32_t scanDurationMs = 2000;     // Duration of a blocking scan
+    uint32_t scans = 0;                 // Number of scans started
+    uint32_t joins = 0;                 // Number of connection attempts
+    uint8_t softApStations = 0;         // Clients connected to the SoftAP
+    uint32_t probes = 0;                // Number of connectivity probes
+    wifiPowerSave_t powerSave = WIFI_POWER_SAVE_MIN_MODEM; // Current modem power save, the driver default
+    uint32_t powerSaveChanges = 0;      // Number of setPowerSave() calls
+    uint32_t beaconIntervalMs = 102;    // Beacon interval of the APs, 100 TU
+    uint8_t dtimPeriod = 1;             // Beacons per DTIM, the wake up period of the min modem sleep
+    uint8_t listenInterval = 3;         // Beacons per wake up of the max modem sleep
+    // Local stand-in server answering HTTP probes with a status code, answers 204 if not set
+    std::function<uint16_t(const std::string & url)> httpServer;
+
+  protected:
+    WifiManagerClock * clock;
+    wifiRadioEventCb callback;
+    wifiRadioMode_t mode = WIFI_RADIO_OFF;
+    std::vector<wifiScanRecord_t> scanResult;
+    bool scanValid = false;
+    uint64_t scanDoneAt = 0;            // Completion time of an async scan
+    uint64_t powerSaveMicros[3] = { 0 }; // Time spent in each modem power save before powerSaveSince
+    uint64_t powerSaveSince = 0;        // Time of the last setPowerSave() call
+
+    int joinedAp = -1;                  // Index of the AP we connect or are connected to
+    uint64_t joinDoneAt = 0;            // Time the association completes
+    uint64_t ipDoneAt = 0;              // Time the DHCP lease is received
+    wifiLinkStatus_t linkStatus = WIFI_LINK_IDLE;
+    uint8_t pendingReason = 0;          // Disconnect reason of a failing attempt
+    uint32_t staticIp[4] = { 0 };       // Static IP, gateway, netmask and DNS, DHCP if the IP is 0
+    bool associated = false;
+    bool softApRunning = false;
+
+    void emit(wifiRadioEventType_t type, uint8_t reason = 0) {
+      if (!callback) return;
+      wifiRadioEvent_t event = { type, reason, joinedAp >= 0 ? accessPoints[joinedAp].rssi : (int8_t)0, {} };
+      joinedLink(event.link);
+      callback(event);
+    }
+
+    void fillScan() {
+      scanResult.clear();
+      for (auto & ap : accessPoints) {
+        if (!ap.online) continue;
+        wifiScanRecord_t record;
+        memset(&record, 0, sizeof(record));
+        if (!ap.hidden) strncpy((char *)record.ssid, ap.ssid.c_str(), sizeof(record.ssid) - 1);
+        memcpy(record.bssid, ap.bssid, sizeof(record.bssid));
+        record.channel = ap.channel;
+        record.rssi = ap.rssi;
+        record.authmode = ap.authmode;
+        scanResult.push_back(record);
+      }
+      scanValid = true;
+    }
+
+    // Advance the link state machine to the current time
+    void update() {
+      uint64_t now = clock->millis();
+      if (scanDoneAt && now >= scanDoneAt) {
+        scanDoneAt = 0;
+        fillScan();
+      }
+      if (linkStatus == WIFI_LINK_DISCONNECTED && joinDoneAt && now >= joinDoneAt) {
+        joinDoneAt = 0;
+        if (pendingReason) {
+          linkStatus = pendingReason == 201 ? WIFI_LINK_NO_SSID_AVAIL : WIFI_LINK_CONNECT_FAILED;
+          emit(WIFI_RADIO_EVENT_STA_DISCONNECTED, pendingReason);
+          joinedAp = -1;
+        } else {
+          associated = true;
+          emit(WIFI_RADIO_EVENT_STA_CONNECTED);
+        }
+      }
+      if (associated && linkStatus != WIFI_LINK_CONNECTED && ipDoneAt && now >= ipDoneAt) {
+        ipDoneAt = 0;
+        linkStatus = WIFI_LINK_CONNECTED;
+        emit(WIFI_RADIO_EVENT_STA_GOT_IP);
+      }
+      if (associated && joinedAp >= 0 && !accessPoints[joinedAp].online) {
+        lose(200);  // beacon timeout
+      }
+    }
+
+    void lose(uint8_t reason) {
+      associated = false;
+      linkStatus = WIFI_LINK_CONNECTION_LOST;
+      emit(WIFI_RADIO_EVENT_STA_DISCONNECTED, reason);
+      joinedAp = -1;
+    }
+
+  public:
+    WifiManagerSimRadio(WifiManagerClock * clock) : clock(clock) {}
+
+    // Add an access point to the RF environment, returns its index
+    size_t addAp(const simAccessPoint_t & ap) {
+      accessPoints.push_back(ap);
+      return accessPoints.size() - 1;
+    }
+
+    // Take an AP on or offline, an established connection to it is lost
+    void setOnline(size_t index, bool online) {
+      accessPoints[index].online = online;
+      update();
+    }
+
+    // Lose an established connection with the given disconnect reason, the AP stays online
+    void dropLink(uint8_t reason) {
+      update();
+      if (associated) lose(reason);
+    }
+
+    void onEvent(wifiRadioEventCb cb) override { callback = cb; }
+
+    void setMode(wifiRadioMode_t newMode) override {
+      if ((mode == WIFI_RADIO_AP || mode == WIFI_RADIO_AP_STA) && newMode != WIFI_RADIO_AP && newMode != WIFI_RADIO_AP_STA) {
+        softAPdisconnect();
+      }
+      mode = newMode;
+    }
+
+    int16_t scan(bool async) override {
+      scans++;
+      scanValid = false;
+      if (async) {
+        scanDoneAt = clock->millis() + scanDurationMs;
+        return WIFI_RADIO_SCAN_RUNNING;
+      }
+      clock->delay(scanDurationMs);
+      fillScan();
+      return scanResult.size();
+    }
+
+    int16_t scanComplete() override {
+      update();
+      if (scanDoneAt) return WIFI_RADIO_SCAN_RUNNING;
+      return scanValid ? (int16_t)scanResult.size() : WIFI_RADIO_SCAN_FAILED;
+    }
+
+    bool scanRecord(uint16_t index, wifiScanRecord_t & record) override {
+      if (!scanValid || index >= scanResult.size()) return false;
+      record = scanResult[index];
+      return true;
+    }
+
+    void scanDelete() override {
+      scanResult.clear();
+      scanValid = false;
+    }
+
+    void begin(const char * ssid, const char * pass, uint8_t channel, const uint8_t * bssid) override {
+      if (associated) lose(8);  // leaving
+      joins++;
+      joinedAp = -1;
+      for (size_t i = 0; i < accessPoints.size(); i++) {
+        simAccessPoint_t & ap = accessPoints[i];
+        if (!ap.online || ap.ssid != ssid) continue;
+        if (bssid && memcmp(bssid, ap.bssid, sizeof(ap.bssid)) != 0) continue;
+        if (joinedAp < 0 || ap.rssi > accessPoints[joinedAp].rssi) joinedAp = i;
+      }
+
+      uint64_t now = clock->millis();
+      linkStatus = WIFI_LINK_DISCONNECTED;
+      associated = false;
+      if (joinedAp < 0) {
+        pendingReason = 201;  // no AP found
+        joinDoneAt = now + (channel ? 100 : scanDurationMs);
+        return;
+      }
+      simAccessPoint_t & ap = accessPoints[joinedAp];
+      if (ap.rejectJoin) pendingReason = 203;  // association failed
+      else if (ap.failReason) pendingReason = ap.failReason;
+      else if (ap.authmode != 0 && ap.pass != (pass ? pass : "")) pendingReason = 15; // 4-way handshake timeout
+      else pendingReason = 0;
+      joinDoneAt = now + ap.joinLatencyMs + (channel ? 0 : scanDurationMs);
+      ipDoneAt = joinDoneAt + (staticIp[0] ? 1 : ap.dhcpLatencyMs);
+    }
+
+    void config(uint32_t ip, uint32_t gateway, uint32_t netmask, uint32_t dns) override {
+      staticIp[0] = ip;
+      staticIp[1] = gateway;
+      staticIp[2] = netmask;
+      staticIp[3] = dns;
+    }
+
+    wifiLinkStatus_t waitForConnectResult(uint32_t timeoutMs) override {
+      uint64_t end = clock->millis() + timeoutMs;
+      update();
+      while (linkStatus == WIFI_LINK_DISCONNECTED && joinDoneAt && clock->millis() < end) {
+        clock->delay(10);
+        update();
+      }
+      while (associated && linkStatus != WIFI_LINK_CONNECTED && clock->millis() < end) {
+        clock->delay(10);
+        update();
+      }
+      return linkStatus;
+    }
+
+    wifiLinkStatus_t status() override {
+      update();
+      return linkStatus;
+    }
+
+    void disconnect() override {
+      update();
+      if (associated) lose(8);
+      linkStatus = WIFI_LINK_DISCONNECTED;
+      joinDoneAt = ipDoneAt = 0;
+    }
+
+    bool linkInfo(wifiLinkInfo_t & info) override {
+      update();
+      memset(&info, 0, sizeof(info));
+      if (linkStatus != WIFI_LINK_CONNECTED || joinedAp < 0) return false;
+      joinedLink(info);
+      return true;
+    }
+
+    // Information about the AP we connect or are connected to
+    void joinedLink(wifiLinkInfo_t & info) {
+      memset(&info, 0, sizeof(info));
+      if (joinedAp < 0) return;
+      const simAccessPoint_t & ap = accessPoints[joinedAp];
+      strncpy(info.ssid, ap.ssid.c_str(), sizeof(info.ssid) - 1);
+      memcpy(info.bssid, ap.bssid, sizeof(info.bssid));
+      info.channel = ap.channel;
+      info.rssi = ap.rssi;
+      info.ip = 0x6400A8C0 + ((uint32_t)joinedAp << 24);  // 192.168.0.100 + AP index
+      info.gateway = ap.gateway;
+      info.netmask = 0x00FFFFFF;        // 255.255.255.0
+      info.dns = info.gateway;
+      if (staticIp[0]) {
+        info.ip = staticIp[0];
+        info.gateway = staticIp[1];
+        info.netmask = staticIp[2];
+        info.dns = staticIp[3];
+      }
+    }
+
+    const char * hostname() override { return "wifimanager-sim"; }
+
+    void setPowerSave(wifiPowerSave_t mode) override {
+      uint64_t now = clock->micros();
+      powerSaveMicros[powerSave] += now - powerSaveSince;
+      powerSaveSince = now;
+      powerSave = mode;
+      powerSaveChanges++;
+    }
+
+    // Time spent in the given modem power save, including the current one
+    uint64_t powerSaveMillis(wifiPowerSave_t mode) {
+      uint64_t us = powerSaveMicros[mode];
+      if (mode == powerSave) us += clock->micros() - powerSaveSince;
+      return us / 1000ULL;
+    }
+
+    // Delay of an inbound packet arriving now, in modem sleep the AP buffers it until the next wake up
+    uint32_t inboundDelayMs() {
+      if (powerSave == WIFI_POWER_SAVE_NONE) return 0;
+      uint64_t period = beaconIntervalMs * 1000ULL * (powerSave == WIFI_POWER_SAVE_MIN_MODEM ? dtimPeriod : listenInterval);
+      return (period - clock->micros() % period) / 1000ULL;
+    }
+
+    int32_t probeGateway(uint32_t gateway, uint32_t timeoutMs) override {
+      // a static configuration of another network can't reach the gateway
+      return probe(timeoutMs, [&](const simAccessPoint_t & ap) {
+        return ap.gatewayResponds && (staticIp[0] == 0 || staticIp[1] == ap.gateway) && gateway == ap.gateway;
+      });
+    }
+
+    int32_t probeDns(const char * host, uint32_t timeoutMs) override {
+      return probe(timeoutMs, [](const simAccessPoint_t & ap) { return ap.uplink; });
+    }
+
+    int32_t probeHttp(const char * url, uint16_t expectStatus, uint32_t timeoutMs) override {
+      return probe(timeoutMs, [&](const simAccessPoint_t & ap) {
+        return ap.uplink && (httpServer ? httpServer(url) : 204) == expectStatus;
+      });
+    }
+
+    // Run a probe through the joined AP, taking its latency or the timeout
+    int32_t probe(uint32_t timeoutMs, std::function<bool(const simAccessPoint_t & ap)> answers) {
+      probes++;
+      update();
+      if (linkStatus == WIFI_LINK_CONNECTED && joinedAp >= 0 && answers(accessPoints[joinedAp])
+          && accessPoints[joinedAp].probeLatencyMs < timeoutMs) {
+        clock->delay(accessPoints[joinedAp].probeLatencyMs);
+        return accessPoints[joinedAp].probeLatencyMs;
+      }
+      clock->delay(timeoutMs);
+      return WIFI_PROBE_FAILED;
+    }
+
+    bool softAP(const char * ssid, const char * pass) override {
+      if (!softApRunning) {
+        softApRunning = true;
+        emit(WIFI_RADIO_EVENT_AP_START);
+      }
+      return true;
+    }
+
+    void softAPdisconnect() override {
+      if (!softApRunning) return;
+      softApRunning = false;
+      softApStations = 0;
+      emit(WIFI_RADIO_EVENT_AP_STOP);
+    }
+
+    uint8_t softAPgetStationNum() override { return softApStations; }
+    uint32_t softAPIP() override { return 0x0104A8C0; }  // 192.168.4.1
+    uint64_t deviceId() override { return 0x123456789ABCULL; }
+};
+
+#endif
@@ -0,0 +1,436 @@
+/**
+ * Wifi Manager - request adapters of the supported webservers
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_HTTP_h
+#define WIFIMANAGER_HTTP_h
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <memory>
+#if IDF_WEBSERVER == true
+  #include <esp_http_server.h>
+#elif ASYNC_WEBSERVER == true
+  #include <ESPAsyncWebServer.h>
+#else
+  #include <WebServer.h>
+#endif
+
+#ifndef WIFIMANAGER_HTTP_MAX_BODY
+#define WIFIMANAGER_HTTP_MAX_BODY 1024  // Max size of a JSON request body, larger requests are rejected
+#endif
+
+#ifndef WIFIMANAGER_HTTP_MAX_PARAM
+#define WIFIMANAGER_HTTP_MAX_PARAM 64   // Max size of a query parameter value with the esp_http_server
+#endif
+
+// WebServer::removeHandler() was added in arduino-esp32 3.1.0, older cores keep a detached handler
+#ifndef WIFIMANAGER_REMOVE_HANDLER
+  #if defined(ESP_ARDUINO_VERSION_VAL)
+    #if ESP_ARDUINO_VERSION >= ESP_ARDUINO_VERSION_VAL(3, 1, 0)
+      #define WIFIMANAGER_REMOVE_HANDLER true
+    #endif
+  #endif
+#endif
+#ifndef WIFIMANAGER_REMOVE_HANDLER
+#define WIFIMANAGER_REMOVE_HANDLER false
+#endif
+
+// Endpoints of the RESTful API, index into wifiApiRoutes
+enum wifiApiRoute_t : uint8_t {
+  WIFI_API_SOFTAP_START = 0,
+  WIFI_API_SOFTAP_STOP,
+  WIFI_API_CLIENT_STOP,
+  WIFI_API_ADD,
+  WIFI_API_DELETE_ID,
+  WIFI_API_DELETE_APNAME,
+  WIFI_API_POWER,
+  WIFI_API_CONFIGLIST,
+  WIFI_API_SCAN,
+  WIFI_API_HISTORY,
+  WIFI_API_TRACE,
+  WIFI_API_STATUS,
+  WIFI_API_METRICS,
+  WIFI_API_ROUTES,
+};
+
+enum wifiHttpMethod_t : uint8_t {
+  WIFI_HTTP_GET = 0,
+  WIFI_HTTP_POST,
+  WIFI_HTTP_DELETE,
+  WIFI_HTTP_OTHER,                  // Not used by the API
+};
+
+struct wifiApiRouteInfo_t {
+  uint8_t length;                   // Length of the path
+  const char * path;                // Path below the API prefix
+  wifiHttpMethod_t method;
+  wifiApiRoute_t route;
+};
+
+#define WIFI_API_ROUTE(path, method, route) { sizeof(path) - 1, path, method, route }
+
+// Ordered by the length of the path, a lookup only compares paths of the same length
+static constexpr wifiApiRouteInfo_t wifiApiRoutes[WIFI_API_ROUTES] = {
+  WIFI_API_ROUTE("/id",           WIFI_HTTP_DELETE, WIFI_API_DELETE_ID),
+  WIFI_API_ROUTE("/add",          WIFI_HTTP_POST,   WIFI_API_ADD),
+  WIFI_API_ROUTE("/scan",         WIFI_HTTP_GET,    WIFI_API_SCAN),
+  WIFI_API_ROUTE("/power",        WIFI_HTTP_POST,   WIFI_API_POWER),
+  WIFI_API_ROUTE("/trace",        WIFI_HTTP_GET,    WIFI_API_TRACE),
+  WIFI_API_ROUTE("/apName",       WIFI_HTTP_DELETE, WIFI_API_DELETE_APNAME),
+  WIFI_API_ROUTE("/status",       WIFI_HTTP_GET,    WIFI_API_STATUS),
+  WIFI_API_ROUTE("/history",      WIFI_HTTP_GET,    WIFI_API_HISTORY),
+  WIFI_API_ROUTE("/metrics",      WIFI_HTTP_GET,    WIFI_API_METRICS),
+  WIFI_API_ROUTE("/configlist",   WIFI_HTTP_GET,    WIFI_API_CONFIGLIST),
+  WIFI_API_ROUTE("/softap/stop",  WIFI_HTTP_POST,   WIFI_API_SOFTAP_STOP),
+  WIFI_API_ROUTE("/client/stop",  WIFI_HTTP_POST,   WIFI_API_CLIENT_STOP),
+  WIFI_API_ROUTE("/softap/start", WIFI_HTTP_POST,   WIFI_API_SOFTAP_START),
+};
+
+constexpr bool wifiApiRoutesOrdered(size_t i = 1) {
+  return i >= WIFI_API_ROUTES || (wifiApiRoutes[i - 1].length <= wifiApiRoutes[i].length && wifiApiRoutesOrdered(i + 1));
+}
+static_assert(wifiApiRoutesOrdered(), "wifiApiRoutes must be ordered by the length of the path");
+
+/**
+ * @brief Find the route of a request
+ * @details Requests outside of the prefix only cost a single compare.
+ * @param prefix Prefix of all API routes
+ * @param uri Path of the request, without query
+ * @param length Length of the path
+ * @param method Method of the request
+ * @return The route or WIFI_API_ROUTES if the request does not belong to the API
+ */
+inline wifiApiRoute_t wifiFindApiRoute(const String & prefix, const char * uri, size_t length, wifiHttpMethod_t method) {
+  size_t prefixLength = prefix.length();
+  if (length <= prefixLength || memcmp(uri, prefix.c_str(), prefixLength) != 0) return WIFI_API_ROUTES;
+  uri += prefixLength;
+  length -= prefixLength;
+  for (const wifiApiRouteInfo_t & entry : wifiApiRoutes) {
+    if (entry.length < length) continue;
+    if (entry.length > length) break;
+    if (entry.method == method && memcmp(entry.path, uri, length) == 0) return entry.route;
+  }
+  return WIFI_API_ROUTES;
+}
+
+/*
+ * The endpoints are written once against the interface below and instantiated for
+ * the adapter of the configured webserver, so there is no virtual dispatch:
+ *
+ *   String param(const char * name)      Query parameter, empty if missing
+ *   const char * body()                  Null terminated request body, nullptr if missing or too large
+ *   void send(int code, const char * type, const char * content)
+ *   void sendChunked(const char * type, std::shared_ptr<S> stream)
+ *                                        Chunked response, S::fill(buffer, maxLen) returns 0 at the end
+ *   void sendJson(const JsonDocument & doc)
+ */
+
+#if IDF_WEBSERVER == true
+// Adapter of an ESP-IDF esp_http_server request, valid while the URI handler runs
+class WifiHttpIdf {
+  protected:
+    httpd_req_t * request;
+    std::unique_ptr<char[]> content;    // Received body
+
+    // Collects the output of serializeJson into chunks
+    class ChunkPrint : public Print {
+      protected:
+        httpd_req_t * request;
+        uint8_t buffer[256];
+        size_t len = 0;
+
+      public:
+        explicit ChunkPrint(httpd_req_t * request) : request(request) {}
+
+        size_t write(uint8_t c) override {
+          if (len == sizeof(buffer)) flush();
+          buffer[len++] = c;
+          return 1;
+        }
+
+        void flush() {
+          if (len > 0) httpd_resp_send_chunk(request, (const char *)buffer, len);
+          len = 0;
+        }
+    };
+
+    static const char * status(int code) {
+      switch (code) {
+        case 200: return "200 OK";
+        case 202: return "202 Accepted";
+        case 400: return "400 Bad Request";
+        case 404: return "404 Not Found";
+        case 422: return "422 Unprocessable Entity";
+        case 503: return "503 Service Unavailable";
+        default:  return "500 Internal Server Error";
+      }
+    }
+
+    static uint8_t hex(char c) {
+      return c >= 'a' ? c - 'a' + 10 : c >= 'A' ? c - 'A' + 10 : c - '0';
+    }
+
+  public:
+    explicit WifiHttpIdf(httpd_req_t * request) : request(request) {}
+
+    static httpd_method_t method(wifiHttpMethod_t method) {
+      return method == WIFI_HTTP_POST ? HTTP_POST : method == WIFI_HTTP_DELETE ? HTTP_DELETE : HTTP_GET;
+    }
+
+    // The esp_http_server does not decode the query, e.g. the commas of /scan?fields=ssid,rssi are sent as %2C
+    String param(const char * name) {
+      size_t len = httpd_req_get_url_query_len(request);
+      if (len == 0) return String();
+      std::unique_ptr<char[]> query(new char[len + 1]);
+      char value[WIFIMANAGER_HTTP_MAX_PARAM];
+      if (httpd_req_get_url_query_str(request, query.get(), len + 1) != ESP_OK
+          || httpd_query_key_value(query.get(), name, value, sizeof(value)) != ESP_OK) {
+        return String();
+      }
+      char * out = value;
+      for (const char * in = value; *in; in++) {
+        if (*in == '%' && isxdigit(in[1]) && isxdigit(in[2])) {
+          *out++ = (char)(hex(in[1]) << 4 | hex(in[2]));
+          in += 2;
+        } else *out++ = *in == '+' ? ' ' : *in;
+      }
+      *out = 0;
+      return String(value);
+    }
+
+    const char * body() {
+      if (content) return content.get();
+      size_t len = request->content_len;
+      if (len == 0 || len > WIFIMANAGER_HTTP_MAX_BODY) return nullptr;
+      content.reset(new char[len + 1]);
+      size_t received = 0;
+      while (received < len) {
+        int ret = httpd_req_recv(request, content.get() + received, len - received);
+        if (ret == HTTPD_SOCK_ERR_TIMEOUT) continue;
+        if (ret <= 0) {
+          content.reset();
+          return nullptr;
+        }
+        received += ret;
+      }
+      content[len] = 0;
+      return content.get();
+    }
+
+    void send(int code, const char * type, const char * content) {
+      httpd_resp_set_status(request, status(code));
+      httpd_resp_set_type(request, type);
+      httpd_resp_send(request, content, HTTPD_RESP_USE_STRLEN);
+    }
+
+    // Blocks the server task until the stream is sent
+    template<typename S> void sendChunked(const char * type, std::shared_ptr<S> stream) {
+      httpd_resp_set_type(request, type);
+      char chunk[512];
+      size_t len;
+      while ((len = stream->fill((uint8_t *)chunk, sizeof(chunk))) > 0) {
+        if (httpd_resp_send_chunk(request, chunk, len) != ESP_OK) return;
+      }
+      httpd_resp_send_chunk(request, nullptr, 0);
+    }
+
+    // Streamed in chunks, the document is never serialized into a single buffer
+    void sendJson(const JsonDocument & doc) {
+      httpd_resp_set_type(request, "application/json");
+      ChunkPrint out(request);
+      serializeJson(doc, out);
+      out.flush();
+      httpd_resp_send_chunk(request, nullptr, 0);
+    }
+};
+#elif ASYNC_WEBSERVER == true
+// Adapter of an ESPAsyncWebServer request
+class WifiHttpAsync {
+  protected:
+    AsyncWebServerRequest * request;
+
+  public:
+    explicit WifiHttpAsync(AsyncWebServerRequest * request) : request(request) {}
+
+    static wifiHttpMethod_t method(WebRequestMethodComposite method) {
+      return method == HTTP_GET ? WIFI_HTTP_GET : method == HTTP_POST ? WIFI_HTTP_POST
+        : method == HTTP_DELETE ? WIFI_HTTP_DELETE : WIFI_HTTP_OTHER;
+    }
+
+    // Collect a body arriving in several chunks, the request is handled once it is complete
+    static void collectBody(AsyncWebServerRequest * request, uint8_t * data, size_t len, size_t index, size_t total) {
+      if (total > WIFIMANAGER_HTTP_MAX_BODY) return;
+      if (index == 0 && request->_tempObject == nullptr) {
+        // released by the AsyncWebServerRequest
+        request->_tempObject = calloc(total + 1, 1);
+      }
+      if (request->_tempObject == nullptr || index + len > total) return;
+      memcpy((uint8_t *)request->_tempObject + index, data, len);
+    }
+
+    String param(const char * name) {
+      return request->hasParam(name) ? request->getParam(name)->value() : String();
+    }
+
+    const char * body() {
+      return (const char *)request->_tempObject;
+    }
+
+    void send(int code, const char * type, const char * content) {
+      request->send(code, type, content);
+    }
+
+    template<typename S> void sendChunked(const char * type, std::shared_ptr<S> stream) {
+      request->send(request->beginChunkedResponse(type, [stream](uint8_t * buffer, size_t maxLen, size_t index) -> size_t {
+        return stream->fill(buffer, maxLen);
+      }));
+    }
+
+    void sendJson(const JsonDocument & doc) {
+      AsyncResponseStream * response = request->beginResponseStream("application/json");
+      serializeJson(doc, *response);
+      response->setCode(200);
+      response->setContentLength(measureJson(doc));
+      request->send(response);
+    }
+};
+
+// Single handler of all API routes, M is the class implementing handleApi()
+template<typename M> class WifiApiHandler : public AsyncWebHandler {
+  protected:
+    M & manager;
+    const String prefix;
+
+    wifiApiRoute_t find(AsyncWebServerRequest * request) {
+      const String & url = request->url();
+      return wifiFindApiRoute(prefix, url.c_str(), url.length(), WifiHttpAsync::method(request->method()));
+    }
+
+  public:
+    WifiApiHandler(M & manager, const String & prefix) : manager(manager), prefix(prefix) {}
+
+    bool canHandle(AsyncWebServerRequest * request) override {
+      return find(request) != WIFI_API_ROUTES;
+    }
+
+    void handleBody(AsyncWebServerRequest * request, uint8_t * data, size_t len, size_t index, size_t total) override {
+      WifiHttpAsync::collectBody(request, data, len, index, total);
+    }
+
+    void handleRequest(AsyncWebServerRequest * request) override {
+      WifiHttpAsync http(request);
+      manager.handleApi(find(request), http);
+    }
+
+    // The request has a body to collect
+    bool isRequestHandlerTrivial() override { return false; }
+};
+#else
+// Adapter of the Arduino WebServer, valid while it handles the current client
+class WifiHttpSync {
+  protected:
+    WebServer * server;
+    String content;                     // Copy of the body
+
+    // Collects the output of serializeJson into chunks
+    class ChunkPrint : public Print {
+      protected:
+        WebServer * server;
+        uint8_t buffer[256];
+        size_t len = 0;
+
+      public:
+        explicit ChunkPrint(WebServer * server) : server(server) {}
+
+        size_t write(uint8_t c) override {
+          if (len == sizeof(buffer)) flush();
+          buffer[len++] = c;
+          return 1;
+        }
+
+        void flush() {
+          if (len > 0) server->sendContent((const char *)buffer, len);
+          len = 0;
+        }
+    };
+
+  public:
+    explicit WifiHttpSync(WebServer * server) : server(server) {}
+
+    static wifiHttpMethod_t method(HTTPMethod method) {
+      return method == HTTP_GET ? WIFI_HTTP_GET : method == HTTP_POST ? WIFI_HTTP_POST
+        : method == HTTP_DELETE ? WIFI_HTTP_DELETE : WIFI_HTTP_OTHER;
+    }
+
+    String param(const char * name) {
+      return server->arg(name);
+    }
+
+    // The WebServer passes a JSON body as the single argument "plain"
+    const char * body() {
+      if (server->args() != 1) return nullptr;
+      content = server->arg(0);
+      if (content.length() > WIFIMANAGER_HTTP_MAX_BODY) return nullptr;
+      return content.c_str();
+    }
+
+    void send(int code, const char * type, const char * content) {
+      server->send(code, type, content);
+    }
+
+    // Blocks until the stream is sent
+    template<typename S> void sendChunked(const char * type, std::shared_ptr<S> stream) {
+      server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+      server->send(200, type, "");
+      uint8_t chunk[512];
+      size_t len;
+      while ((len = stream->fill(chunk, sizeof(chunk))) > 0) {
+        server->sendContent((const char *)chunk, len);
+      }
+      server->sendContent("", 0); // terminate the chunked transfer
+    }
+
+    // Streamed in chunks, the document is never serialized into a single buffer
+    void sendJson(const JsonDocument & doc) {
+      server->setContentLength(CONTENT_LENGTH_UNKNOWN);
+      server->send(200, "application/json", "");
+      ChunkPrint out(server);
+      serializeJson(doc, out);
+      out.flush();
+      server->sendContent("", 0); // terminate the chunked transfer
+    }
+};
+
+// Single handler of all API routes, M is the class implementing handleApi()
+// Without removeHandler() it stays in the WebServer after detach(), but no longer claims any request.
+template<typename M> class WifiApiHandler : public RequestHandler {
+  protected:
+    M * manager;
+    const String prefix;
+
+  public:
+    WifiApiHandler(M & manager, const String & prefix) : manager(&manager), prefix(prefix) {}
+
+    void detach() { manager = nullptr; }
+
+    bool canHandle(HTTPMethod method, const String & uri) override {
+      if (manager == nullptr) return false;
+      return wifiFindApiRoute(prefix, uri.c_str(), uri.length(), WifiHttpSync::method(method)) != WIFI_API_ROUTES;
+    }
+
+    bool handle(WebServer & server, HTTPMethod method, const String & uri) override {
+      if (manager == nullptr) return false;
+      wifiApiRoute_t route = wifiFindApiRoute(prefix, uri.c_str(), uri.length(), WifiHttpSync::method(method));
+      if (route == WIFI_API_ROUTES) return false;
+      WifiHttpSync http(&server);
+      manager->handleApi(route, http);
+      return true;
+    }
+};
+#endif
+
+#endif
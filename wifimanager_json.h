@@ -0,0 +1,163 @@
+/**
+ * Wifi Manager - streaming JSON output
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_JSON_h
+#define WIFIMANAGER_JSON_h
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <functional>
+
+#ifndef WIFIMANAGER_JSON_ITEM_SIZE
+#define WIFIMANAGER_JSON_ITEM_SIZE 320  // Max size of a single array element, a fully escaped SSID needs 192 bytes
+#endif
+
+/**
+ * @brief Minimal JSON writer into a fixed buffer
+ * @details Takes care of separators and string escaping. If the buffer is too small,
+ * the output is cut and overflow() returns true.
+ */
+class WifiJsonWriter {
+  protected:
+    char * buf;                         // Output buffer
+    size_t size;                        // Size of the output buffer
+    size_t len = 0;                     // Bytes written to the buffer
+    bool needComma = false;             // A value was written on the current nesting level
+    bool overflowed = false;            // The buffer was too small
+
+    void raw(const char * data, size_t n) {
+      if (len + n > size) {
+        n = size - len;
+        overflowed = true;
+      }
+      memcpy(buf + len, data, n);
+      len += n;
+    }
+    void raw(char c) { raw(&c, 1); }
+    void separator() {
+      if (needComma) raw(',');
+      needComma = true;
+    }
+
+  public:
+    WifiJsonWriter(char * buf, size_t size) : buf(buf), size(size) {}
+
+    void beginObject() { separator(); raw('{'); needComma = false; }
+    void endObject() { raw('}'); needComma = true; }
+    void beginArray() { separator(); raw('['); needComma = false; }
+    void endArray() { raw(']'); needComma = true; }
+
+    // Write the key of the next object member
+    void key(const char * name) {
+      separator();
+      string(name, strlen(name));
+      raw(':');
+      needComma = false;
+    }
+
+    void value(int32_t v) {
+      char tmp[12];
+      separator();
+      raw(tmp, snprintf(tmp, sizeof(tmp), "%ld", (long)v));
+    }
+    void value(bool v) {
+      separator();
+      if (v) raw("true", 4);
+      else raw("false", 5);
+    }
+    void value(const char * v) { value(v, strlen(v)); }
+    void value(const char * v, size_t n) { separator(); string(v, n); }
+
+    // Write an escaped string without separator handling
+    void string(const char * v, size_t n) {
+      raw('"');
+      for(size_t i = 0; i < n; i++) {
+        uint8_t c = v[i];
+        if (c == '"' || c == '\\') {
+          raw('\\');
+          raw(c);
+        } else if (c < 0x20) {
+          char tmp[7];
+          raw(tmp, snprintf(tmp, sizeof(tmp), "\\u%04x", c));
+        } else raw(c);
+      }
+      raw('"');
+    }
+
+    size_t length() const { return len; }
+    bool overflow() const { return overflowed; }
+};
+
+/**
+ * @brief Produces a JSON array element by element into consecutive output chunks
+ * @details Only a single element is rendered at a time, so the memory required does not
+ * depend on the number of elements. Works with chunked responses of both webservers.
+ */
+class WifiJsonArrayStream {
+  public:
+    // Write the element with the given index, writing nothing skips the element
+    typedef std::function<void(WifiJsonWriter & json, uint16_t index)> RowWriter;
+
+  protected:
+    uint16_t count;                     // Number of elements to generate
+    uint16_t next = 0;                  // Index of the next element to generate
+    RowWriter row;                      // Callback to render a single element
+    std::function<void()> onDone;       // Called once the stream is destroyed
+    char item[WIFIMANAGER_JSON_ITEM_SIZE + 1]; // Current element, prefixed with a separator
+    size_t itemPos = 0;                 // Bytes of the current element already written
+    size_t itemLen = 0;                 // Size of the current element
+    uint8_t stage = 0;                  // 0 = open, 1 = elements, 2 = closed
+    bool emptyArray = true;             // No element was written yet
+
+    // Render the next piece of output into item, returns false at the end of the array
+    bool produce() {
+      itemPos = itemLen = 0;
+      if (stage == 0) {
+        item[itemLen++] = '[';
+        stage = 1;
+        return true;
+      }
+      while (stage == 1 && next < count) {
+        item[0] = ',';
+        WifiJsonWriter json(item + 1, WIFIMANAGER_JSON_ITEM_SIZE);
+        row(json, next++);
+        if (json.length() == 0 || json.overflow()) continue;
+        itemPos = emptyArray ? 1 : 0;
+        itemLen = json.length() + 1;
+        emptyArray = false;
+        return true;
+      }
+      if (stage == 1) {
+        item[itemLen++] = ']';
+        stage = 2;
+        return true;
+      }
+      return false;
+    }
+
+  public:
+    WifiJsonArrayStream(uint16_t count, RowWriter row, std::function<void()> onDone = nullptr)
+      : count(count), row(row), onDone(onDone) {}
+    ~WifiJsonArrayStream() { if (onDone) onDone(); }
+
+    // Fill the output buffer with the next bytes of the array, returns 0 when finished
+    size_t fill(uint8_t * out, size_t maxLen) {
+      size_t written = 0;
+      while (written < maxLen) {
+        if (itemPos >= itemLen && !produce()) break;
+        size_t n = itemLen - itemPos;
+        if (n > maxLen - written) n = maxLen - written;
+        memcpy(out + written, item + itemPos, n);
+        itemPos += n;
+        written += n;
+      }
+      return written;
+    }
+};
+
+#endif
@@ -0,0 +1,131 @@
+/**
+ * Wifi Manager - link quality tracking
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_LINKQUALITY_h
+#define WIFIMANAGER_LINKQUALITY_h
+
+#include <stdint.h>
+#include <string.h>
+
+#ifndef WIFIMANAGER_LINK_HISTORY
+#define WIFIMANAGER_LINK_HISTORY 64         // Number of link samples kept, valid range is uint16_t
+#endif
+
+// A single sample of the station link
+struct wifiLinkSample_t {
+  uint32_t millis;                  // Time of the sample, lower 32 bits of the clock
+  int8_t rssi;                      // Measured signal strength
+  int8_t smoothed;                  // Smoothed signal strength including this sample
+  uint8_t channel;                  // Primary channel
+};
+
+// Aggregate of consecutive samples, used to downsample the history
+struct wifiLinkBucket_t {
+  uint32_t millis;                  // Time of the newest sample in the bucket
+  int8_t rssi;                      // Average signal strength
+  int8_t minRssi;                   // Weakest sample
+  int8_t maxRssi;                   // Strongest sample
+  int8_t smoothed;                  // Smoothed signal strength at the newest sample
+  uint8_t channel;                  // Channel of the newest sample
+  uint16_t samples;                 // Number of samples in the bucket
+};
+
+/**
+ * @brief Ring buffer of link samples with an exponentially weighted moving average
+ * @details Decisions based on the signal strength should use smoothed(), a single
+ * RSSI reading easily varies by 10 dB. The history starts over when the BSSID changes.
+ */
+class WifiLinkQuality {
+  protected:
+    wifiLinkSample_t samples[WIFIMANAGER_LINK_HISTORY]; // Ring buffer
+    uint16_t count = 0;                 // Number of valid samples
+    uint16_t next = 0;                  // Position of the next sample
+    int32_t ewma = 0;                   // Smoothed RSSI in 1/16 dBm
+    uint8_t bssid[6] = { 0 };           // AP the samples belong to
+
+  public:
+    uint8_t alphaPercent = 20;          // Weight of a new sample for the moving average
+
+    // Drop all samples
+    void reset() {
+      count = next = 0;
+      ewma = 0;
+      memset(bssid, 0, sizeof(bssid));
+    }
+
+    // Add a sample of the given AP, a different AP restarts the history
+    void add(uint32_t now, const uint8_t * apBssid, int8_t rssi, uint8_t channel) {
+      if (count > 0 && memcmp(bssid, apBssid, sizeof(bssid)) != 0) reset();
+      memcpy(bssid, apBssid, sizeof(bssid));
+
+      if (count == 0) ewma = (int32_t)rssi * 16;
+      else ewma += ((int32_t)rssi * 16 - ewma) * alphaPercent / 100;
+
+      samples[next] = { now, rssi, smoothed(), channel };
+      next = (next + 1) % WIFIMANAGER_LINK_HISTORY;
+      if (count < WIFIMANAGER_LINK_HISTORY) count++;
+    }
+
+    uint16_t size() const { return count; }
+
+    // Sample by age, 0 is the oldest one
+    const wifiLinkSample_t & at(uint16_t index) const {
+      return samples[(next + WIFIMANAGER_LINK_HISTORY - count + index) % WIFIMANAGER_LINK_HISTORY];
+    }
+
+    // Smoothed signal strength, INT8_MIN without samples
+    int8_t smoothed() const {
+      if (count == 0) return INT8_MIN;
+      return (int8_t)((ewma + (ewma < 0 ? -8 : 8)) / 16);
+    }
+
+    // Weakest and strongest sample within the history
+    int8_t minRssi() const {
+      int8_t value = INT8_MAX;
+      for (uint16_t i = 0; i < count; i++) if (samples[i].rssi < value) value = samples[i].rssi;
+      return count ? value : INT8_MIN;
+    }
+    int8_t maxRssi() const {
+      int8_t value = INT8_MIN;
+      for (uint16_t i = 0; i < count; i++) if (samples[i].rssi > value) value = samples[i].rssi;
+      return value;
+    }
+
+    // Number of buckets when downsampling the history to at most points entries
+    uint16_t buckets(uint16_t points) const {
+      return count < points ? count : points;
+    }
+
+    // Aggregate the samples of a bucket, buckets are ordered oldest first
+    void bucket(uint16_t index, uint16_t points, wifiLinkBucket_t & out) const {
+      uint16_t n = buckets(points);
+      if (index >= n) {
+        // no samples or no such bucket
+        out = wifiLinkBucket_t();
+        return;
+      }
+      uint16_t first = (uint32_t)index * count / n;
+      uint16_t last = (uint32_t)(index + 1) * count / n;
+      int32_t sum = 0;
+      out.minRssi = INT8_MAX;
+      out.maxRssi = INT8_MIN;
+      for (uint16_t i = first; i < last; i++) {
+        const wifiLinkSample_t & sample = at(i);
+        sum += sample.rssi;
+        if (sample.rssi < out.minRssi) out.minRssi = sample.rssi;
+        if (sample.rssi > out.maxRssi) out.maxRssi = sample.rssi;
+      }
+      const wifiLinkSample_t & newest = at(last - 1);
+      out.samples = last - first;
+      out.rssi = sum / out.samples;
+      out.millis = newest.millis;
+      out.smoothed = newest.smoothed;
+      out.channel = newest.channel;
+    }
+};
+
+#endif
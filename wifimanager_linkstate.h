@@ -0,0 +1,88 @@
+/**
+ * Wifi Manager - snapshot of the link state
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_LINKSTATE_h
+#define WIFIMANAGER_LINKSTATE_h
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+#include <mutex>
+
+// State of the station and SoftAP, kept up to date by the radio events
+struct wifiLinkState_t {
+  uint64_t lastDisconnectMillis = 0; // Time of the last STA disconnect, 0 if none
+  uint32_t ip = 0;                  // IPv4 addresses in network byte order as used by IPAddress, 0 without lease
+  uint32_t gateway = 0;
+  uint32_t netmask = 0;
+  uint32_t dns = 0;
+  char ssid[33] = { 0 };            // Null terminated SSID of the AP, empty if not connected
+  uint8_t bssid[6] = { 0 };         // MAC of the AP
+  uint8_t channel = 0;              // Primary channel
+  int8_t rssi = 0;                  // Last known signal strength
+  bool connected = false;           // Station associated to an AP
+  bool gotIp = false;               // Station has an IP address
+  bool softApRunning = false;       // SoftAP started
+  uint8_t lastDisconnectReason = 0; // 802.11 reason of the last STA disconnect
+};
+
+/**
+ * @brief Publishes a wifiLinkState_t to readers of any task without locking them
+ * @details The state is stored as atomic words guarded by a sequence number, odd while an
+ * update is written. A reader copies the words and retries if the sequence number changed
+ * meanwhile, so it always gets a consistent snapshot. Writers are serialized by a mutex,
+ * they are only the event handler and the owner of the radio. A reader that keeps colliding
+ * with a writer, e.g. one it preempted on the same core, waits for the mutex instead.
+ */
+class WifiLinkStateStore {
+  protected:
+    static constexpr size_t WORDS = (sizeof(wifiLinkState_t) + 3) / 4;
+
+    std::atomic<uint32_t> seq{0};       // Sequence number, odd while written
+    std::atomic<uint32_t> words[WORDS];
+    mutable std::mutex writer;          // Serializes the updates
+    wifiLinkState_t current;            // Latest state, only accessed by the writer
+
+  public:
+    WifiLinkStateStore() {
+      uint32_t raw[WORDS] = { 0 };
+      memcpy(raw, &current, sizeof(current));
+      for (size_t i = 0; i < WORDS; i++) words[i].store(raw[i], std::memory_order_relaxed);
+    }
+
+    // Change the state by the given function and publish the result
+    template<typename F> void update(F change) {
+      std::lock_guard<std::mutex> lock(writer);
+      change(current);
+      uint32_t raw[WORDS] = { 0 };
+      memcpy(raw, &current, sizeof(current));
+      uint32_t s = seq.load(std::memory_order_relaxed);
+      seq.store(s + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (size_t i = 0; i < WORDS; i++) words[i].store(raw[i], std::memory_order_relaxed);
+      seq.store(s + 2, std::memory_order_release);
+    }
+
+    // Get a consistent copy of the state
+    wifiLinkState_t read() const {
+      uint32_t raw[WORDS];
+      wifiLinkState_t state;
+      for (uint8_t attempt = 0; attempt < 3; attempt++) {
+        uint32_t before = seq.load(std::memory_order_acquire);
+        for (size_t i = 0; i < WORDS; i++) raw[i] = words[i].load(std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if ((before & 1) == 0 && seq.load(std::memory_order_relaxed) == before) {
+          memcpy(&state, raw, sizeof(state));
+          return state;
+        }
+      }
+      std::lock_guard<std::mutex> lock(writer);
+      return current;
+    }
+};
+
+#endif
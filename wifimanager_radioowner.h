@@ -0,0 +1,117 @@
+/**
+ * Wifi Manager - serialized access to the radio
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_RADIOOWNER_h
+#define WIFIMANAGER_RADIOOWNER_h
+
+#include <stdint.h>
+#include <atomic>
+#include <mutex>
+
+// Priority of a radio operation, a waiting operation cancels running ones of a lower priority
+enum wifiRadioPriority_t : uint8_t {
+  WIFI_RADIO_PRIORITY_BACKGROUND = 0, // Supervision by loop() and tick()
+  WIFI_RADIO_PRIORITY_APPLICATION,    // Explicit requests like tryConnect(), burst() or a scan
+  WIFI_RADIO_PRIORITY_CONTROL,        // SoftAP and stop requests, always win
+  WIFI_RADIO_PRIORITY_COUNT,
+};
+
+// Kind of a radio operation, only changes of the radio state void an attempt of tick()
+enum wifiRadioAccess_t : uint8_t {
+  WIFI_RADIO_CHANGE = 0,              // Scans, connection attempts and SoftAP changes
+  WIFI_RADIO_READ,                    // Configuration and power save changes, reading the state or scan results
+};
+
+/**
+ * @brief Single owner of the radio
+ * @details Every operation changing the radio state acquires the owner first, so scans,
+ * connection attempts and SoftAP changes of different tasks never interleave. The owner
+ * may be acquired again by the same task, nested operations keep the priority of the
+ * outermost one. Long running operations poll cancelled() and give up if an operation
+ * of a higher priority is waiting. sequence() only counts the operations that changed the
+ * radio state, an operation with read access calls markChanged() before it changes it.
+ */
+class WifiRadioOwner {
+  protected:
+    std::recursive_mutex mutex;
+    std::atomic<uint8_t> waiting[WIFI_RADIO_PRIORITY_COUNT]; // Number of tasks waiting per priority
+    uint8_t depth = 0;                  // Nesting of the current owner, only changed while holding the mutex
+    uint32_t operations = 0;            // Number of outermost acquisitions that changed the radio state
+    bool changed = false;               // The current owner changed the radio state
+    wifiRadioPriority_t priority = WIFI_RADIO_PRIORITY_BACKGROUND; // Priority of the outermost operation
+
+    void owned(wifiRadioPriority_t requested, wifiRadioAccess_t access) {
+      if (depth++ == 0) {
+        priority = requested;
+        changed = false;
+      }
+      if (access == WIFI_RADIO_CHANGE) markChanged();
+    }
+
+  public:
+    WifiRadioOwner() {
+      for (auto & count : waiting) count.store(0);
+    }
+
+    // Block until the radio is owned by the calling task
+    void acquire(wifiRadioPriority_t requested, wifiRadioAccess_t access = WIFI_RADIO_CHANGE) {
+      waiting[requested].fetch_add(1);
+      mutex.lock();
+      waiting[requested].fetch_sub(1);
+      owned(requested, access);
+    }
+
+    // Own the radio only if no other task does, for callers that must not block
+    bool tryAcquire(wifiRadioPriority_t requested, wifiRadioAccess_t access = WIFI_RADIO_CHANGE) {
+      if (!mutex.try_lock()) return false;
+      owned(requested, access);
+      return true;
+    }
+
+    // Called by the owner before it changes the radio state, counted once per ownership
+    void markChanged() {
+      if (changed) return;
+      changed = true;
+      operations++;
+    }
+
+    void release() {
+      depth--;
+      mutex.unlock();
+    }
+
+    // Called by the owner: true if an operation of a higher priority is waiting
+    bool cancelled() const {
+      for (uint8_t p = priority + 1; p < WIFI_RADIO_PRIORITY_COUNT; p++) {
+        if (waiting[p].load() > 0) return true;
+      }
+      return false;
+    }
+
+    // Called by the owner: number of changes so far, skips a value if another task changed the radio in between
+    uint32_t sequence() const { return operations; }
+};
+
+// Owns the radio for the lifetime of the guard
+class WifiRadioGuard {
+  protected:
+    WifiRadioOwner & owner;
+    bool owned;
+
+  public:
+    WifiRadioGuard(WifiRadioOwner & owner, wifiRadioPriority_t priority, wifiRadioAccess_t access = WIFI_RADIO_CHANGE)
+      : owner(owner), owned(true) { owner.acquire(priority, access); }
+    // Doesn't wait, check owns() before using the radio
+    WifiRadioGuard(WifiRadioOwner & owner, wifiRadioPriority_t priority, std::try_to_lock_t, wifiRadioAccess_t access = WIFI_RADIO_CHANGE)
+      : owner(owner), owned(owner.tryAcquire(priority, access)) {}
+    ~WifiRadioGuard() { if (owned) owner.release(); }
+    bool owns() const { return owned; }
+    WifiRadioGuard(const WifiRadioGuard &) = delete;
+    WifiRadioGuard & operator=(const WifiRadioGuard &) = delete;
+};
+
+#endif
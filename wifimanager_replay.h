@@ -0,0 +1,341 @@
+/**
+ * Wifi Manager - replay of recorded device traces
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_REPLAY_h
+#define WIFIMANAGER_REPLAY_h
+
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include "wifimanager.h"
+#include "wifimanager_hal_sim.h"
+
+// A decision of the WifiManager found in a trace
+struct wifiReplayDecision_t {
+  uint64_t millis;                  // Time since the start of the trace
+  uint8_t type;                     // WIFI_TRACE_CONNECT, _BLOCK, _ROAM or _SOFTAP
+  uint8_t a;                        // apId, or the SoftAP state
+  uint32_t bssid;                   // BSSID bytes 2-5 of connection attempts, 0 if unknown
+};
+
+// Comparison of the recorded and the replayed decisions
+struct wifiReplayReport_t {
+  std::vector<wifiReplayDecision_t> recorded;
+  std::vector<wifiReplayDecision_t> replayed;
+  size_t matching = 0;              // Number of leading decisions that are equal
+  bool diverged = false;            // The decision at index matching differs or is missing
+  uint64_t recordedOfflineMillis = 0; // Time without a connection on the device
+  uint64_t replayedOfflineMillis = 0; // Time without a connection in the replay
+  uint32_t recordedAttempts = 0;    // Connection attempts on the device
+  uint32_t replayedAttempts = 0;    // Connection attempts in the replay
+  bool overran = false;             // The start of the replay already took longer than the trace
+};
+
+/**
+ * @brief Replays a trace captured with /trace against the WifiManager logic on the host
+ * @details The RF environment is reconstructed from the trace: scan records define which
+ * APs of the stored networks are visible with which RSSI, connection results define how
+ * joins to an AP end and how long they take, disconnects of an established connection
+ * and failed health checks are injected at their recorded time. A fresh WIFIMANAGER runs
+ * in virtual time against this environment and its decisions are compared to the recorded ones.
+ * Change the policy in the setup callback to see how it would have behaved on the recording.
+ */
+class WifiManagerReplay {
+  public:
+    WifiManagerVirtualClock clock;
+    WifiManagerSimStore store;
+    WifiManagerSimTasks tasks;
+    WifiManagerSimRadio radio{&clock};
+    WifiManagerHal hal = { &radio, &store, &clock, &tasks };
+    uint32_t loopMillis = 10000;        // Period of loop(), like the background task
+    std::function<void(const char * msg)> log; // Receives the log of the replayed WifiManager, quiet if not set
+
+  protected:
+    struct network_t {
+      std::string ssid;
+      std::string pass;
+      uint32_t hash;
+    };
+    struct event_t {
+      uint64_t millis;                  // Time since the first record
+      wifiTraceRecord_t record;
+    };
+    // WifiManager with the log redirected
+    class replayManager_t : public WIFIMANAGER {
+      public:
+        std::function<void(const char * msg)> & log;
+        replayManager_t(WifiManagerHal * hal, std::function<void(const char * msg)> & log) : WIFIMANAGER("replay", hal), log(log) {}
+        void logMessage(String msg) override { if (log) log(msg.c_str()); }
+    };
+
+    std::vector<network_t> networks;    // Stored networks in the order of their apId
+    std::vector<event_t> events;        // Recorded trace
+
+    // Index of the simulated AP with the given SSID and BSSID bytes, created if missing
+    size_t apIndex(uint8_t apId, uint32_t bssid, uint8_t channel) {
+      const network_t & network = networks[apId];
+      for (size_t i = 0; i < radio.accessPoints.size(); i++) {
+        if (radio.accessPoints[i].ssid == network.ssid && wifiTraceBssid(radio.accessPoints[i].bssid) == bssid) return i;
+      }
+      simAccessPoint_t ap;
+      ap.ssid = network.ssid;
+      ap.pass = network.pass;
+      ap.authmode = network.pass.length() ? 3 : 0;
+      ap.bssid[2] = bssid >> 24;
+      ap.bssid[3] = bssid >> 16;
+      ap.bssid[4] = bssid >> 8;
+      ap.bssid[5] = bssid;
+      if (channel) ap.channel = channel;
+      ap.online = false;
+      return radio.addAp(ap);
+    }
+
+    // apId of a stored network by the SSID hash, -1 if unknown
+    int networkByHash(uint32_t hash) {
+      for (size_t i = 0; i < networks.size(); i++) if (networks[i].hash == hash) return i;
+      return -1;
+    }
+
+    // Apply the outcome of a recorded connection attempt to the AP
+    void setOutcome(simAccessPoint_t & ap, const wifiTraceRecord_t & result, bool scanned) {
+      ap.online = result.a != WIFI_LINK_NO_SSID_AVAIL;
+      ap.failReason = result.a == WIFI_LINK_CONNECTED ? 0 : (result.b ? result.b : 2);
+      uint32_t duration = result.arg1;
+      if (!scanned) duration = duration > radio.scanDurationMs ? duration - radio.scanDurationMs : 1;
+      if (result.a == WIFI_LINK_CONNECTED) duration = duration > ap.dhcpLatencyMs ? duration - ap.dhcpLatencyMs : 1;
+      ap.joinLatencyMs = duration;
+    }
+
+    // Schedule the recorded RF environment on the virtual clock
+    void scheduleEnvironment() {
+      std::vector<bool> configured;     // Initial state of the AP is known
+      int connectAp = -1;               // AP of the running connection attempt
+      bool connectScanned = false;
+      std::string connectedSsid;        // Network of the established connection
+
+      for (size_t e = 0; e < events.size(); e++) {
+        const event_t & event = events[e];
+        const wifiTraceRecord_t & record = event.record;
+        switch (record.type) {
+          case WIFI_TRACE_SCAN_AP: {
+            int apId = networkByHash(record.arg1);
+            if (apId < 0) break;
+            size_t index = apIndex(apId, record.arg2, record.a);
+            configured.resize(radio.accessPoints.size());
+            configured[index] = true;
+            // visible from the start of the scan on, so a replayed scan at the same time sees it
+            int8_t rssi = (int8_t)(record.b & 0xff);
+            uint8_t channel = record.a;
+            uint64_t at = event.millis > radio.scanDurationMs ? event.millis - radio.scanDurationMs : 0;
+            clock.at(at, [this, index, rssi, channel]() {
+              radio.accessPoints[index].online = true;
+              radio.accessPoints[index].rssi = rssi;
+              radio.accessPoints[index].channel = channel;
+            });
+            break;
+          }
+          case WIFI_TRACE_SCAN:
+            // APs missing in the previous scan went offline, the scan records follow this record
+            if (e + 1 < events.size()) {
+              std::vector<size_t> seen;
+              for (size_t n = e + 1; n < events.size() && events[n].record.type == WIFI_TRACE_SCAN_AP; n++) {
+                int apId = networkByHash(events[n].record.arg1);
+                if (apId >= 0) seen.push_back(apIndex(apId, events[n].record.arg2, events[n].record.a));
+              }
+              uint64_t at = event.millis > radio.scanDurationMs ? event.millis - radio.scanDurationMs : 0;
+              clock.at(at, [this, seen]() {
+                for (size_t i = 0; i < radio.accessPoints.size(); i++) {
+                  bool found = false;
+                  for (size_t index : seen) found |= index == i;
+                  if (!found) radio.setOnline(i, false);
+                }
+              });
+            }
+            break;
+          case WIFI_TRACE_CONNECT:
+            if (record.a >= networks.size()) break;
+            connectAp = apIndex(record.a, record.arg1, record.b);
+            connectScanned = record.b != 0;
+            break;
+          case WIFI_TRACE_CONNECT_RESULT: {
+            if (connectAp < 0) break;
+            size_t index = connectAp;
+            wifiTraceRecord_t result = record;
+            bool scanned = connectScanned;
+            // the outcome is valid from the start of the attempt on
+            uint64_t at = event.millis > record.arg1 ? event.millis - record.arg1 : 0;
+            clock.at(at, [this, index, result, scanned]() { setOutcome(radio.accessPoints[index], result, scanned); });
+            // APs not scanned before, e.g. with a single stored network, start with their first outcome
+            configured.resize(radio.accessPoints.size());
+            if (!configured[index]) setOutcome(radio.accessPoints[index], result, scanned);
+            configured[index] = true;
+            connectedSsid = record.a == WIFI_LINK_CONNECTED ? radio.accessPoints[index].ssid : std::string();
+            connectAp = -1;
+            break;
+          }
+          case WIFI_TRACE_DISCONNECTED: {
+            // only a lost connection, failed attempts are part of their result
+            if (connectAp >= 0 || connectedSsid.empty()) break;
+            std::string ssid = connectedSsid;
+            uint8_t reason = record.a;
+            // 1 ms later, the recorded connection was established before
+            clock.at(event.millis + 1, [this, ssid, reason]() {
+              wifiLinkInfo_t link;
+              if (radio.linkInfo(link) && ssid == link.ssid) radio.dropLink(reason);
+            });
+            connectedSsid.clear();
+            break;
+          }
+          case WIFI_TRACE_HEALTH: {
+            bool healthy = record.a != 0;
+            clock.at(event.millis, [this, healthy]() {
+              for (auto & ap : radio.accessPoints) ap.uplink = ap.gatewayResponds = healthy;
+            });
+            break;
+          }
+          default:
+            break;
+        }
+      }
+    }
+
+  public:
+    // Read an export of /trace, returns false if it is not a valid trace
+    bool load(const uint8_t * data, size_t len) {
+      events.clear();
+      if (len < WIFIMANAGER_TRACE_HEADER_SIZE || memcmp(data, "WMTR", 4) != 0 || data[4] != WIFIMANAGER_TRACE_VERSION) return false;
+      uint8_t recordSize = data[5];
+      if (recordSize < WIFIMANAGER_TRACE_RECORD_SIZE) return false;
+
+      uint64_t millis = 0;
+      uint32_t lastMicros = 0;
+      for (size_t pos = WIFIMANAGER_TRACE_HEADER_SIZE; pos + recordSize <= len; pos += recordSize) {
+        const uint8_t * p = data + pos;
+        event_t event;
+        event.record.seq = get32(p);
+        event.record.micros = get32(p + 4);
+        event.record.type = p[8];
+        event.record.a = p[9];
+        event.record.b = p[10] | p[11] << 8;
+        event.record.arg1 = get32(p + 12);
+        event.record.arg2 = get32(p + 16);
+        // the 32 bit clock wraps after 71 minutes, unwrap it using the distance to the previous record
+        if (!events.empty()) millis += (uint32_t)(event.record.micros - lastMicros) / 1000;
+        lastMicros = event.record.micros;
+        event.millis = millis;
+        events.push_back(event);
+      }
+      return !events.empty();
+    }
+
+    // Add a stored network of the device, in the order of their IDs (see /configlist)
+    void addNetwork(const char * ssid, const char * pass) {
+      networks.push_back({ ssid, pass, WIFIMANAGER::hashSsid((const uint8_t *)ssid, strlen(ssid)) });
+    }
+
+  protected:
+    static uint32_t get32(const uint8_t * p) {
+      return p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+    }
+
+    // Extract the decisions of a trace
+    static void decisions(const std::vector<event_t> & trace, std::vector<wifiReplayDecision_t> & out) {
+      for (const event_t & event : trace) {
+        const wifiTraceRecord_t & record = event.record;
+        if (record.type == WIFI_TRACE_CONNECT) out.push_back({ event.millis, record.type, record.a, record.b ? record.arg1 : 0 });
+        else if (record.type == WIFI_TRACE_BLOCK || record.type == WIFI_TRACE_ROAM || record.type == WIFI_TRACE_SOFTAP) {
+          out.push_back({ event.millis, record.type, record.a, 0 });
+        }
+      }
+    }
+
+    // Time without a connection and number of attempts of a trace
+    static void offline(const std::vector<event_t> & trace, uint64_t endMillis, uint64_t & offlineMillis, uint32_t & attempts) {
+      bool connected = false;
+      uint64_t since = 0;
+      bool inAttempt = false;
+      for (const event_t & event : trace) {
+        const wifiTraceRecord_t & record = event.record;
+        if (record.type == WIFI_TRACE_CONNECT) {
+          attempts++;
+          inAttempt = true;
+        } else if (record.type == WIFI_TRACE_CONNECT_RESULT) {
+          inAttempt = false;
+          if (record.a == WIFI_LINK_CONNECTED && !connected) {
+            offlineMillis += event.millis - since;
+            connected = true;
+          }
+        } else if (record.type == WIFI_TRACE_DISCONNECTED && connected && !inAttempt) {
+          connected = false;
+          since = event.millis;
+        }
+      }
+      if (!connected) offlineMillis += endMillis - since;
+    }
+
+  public:
+    /**
+     * @brief Run the WifiManager against the recorded environment
+     * @param setup Called with the new WifiManager after the networks are added, change the policy here
+     * @return wifiReplayReport_t recorded and replayed decisions and where they diverge
+     */
+    wifiReplayReport_t run(std::function<void(WIFIMANAGER & wifi)> setup = nullptr) {
+      wifiReplayReport_t report;
+      if (events.empty()) return report;
+      uint64_t endMillis = events.back().millis;
+      scheduleEnvironment();
+
+      replayManager_t wifi(&hal, log);
+      for (const network_t & network : networks) wifi.addWifi(network.ssid.c_str(), network.pass.c_str());
+      if (setup) setup(wifi);
+
+      // collect the trace of the replay while it runs, the ring buffer only keeps the recent records
+      std::vector<event_t> replayed;
+      uint32_t nextSeq = 1;
+      uint64_t millis = 0;
+      uint32_t lastMicros = 0;
+      auto collect = [&]() {
+        const WifiTrace & trace = wifi.getTrace();
+        for (; nextSeq <= trace.newest(); nextSeq++) {
+          event_t event;
+          if (!trace.read(nextSeq, event.record)) continue;
+          millis += (uint32_t)(event.record.micros - lastMicros) / 1000;
+          lastMicros = event.record.micros;
+          event.millis = millis;
+          replayed.push_back(event);
+        }
+      };
+      // the phase of loop() is not recorded, one more period catches an attempt due at the end of the trace
+      wifi.startBackgroundTask();
+      uint64_t stopMillis = endMillis + loopMillis;
+      if (clock.millis() < stopMillis) {
+        clock.runPeriodic([&]() { wifi.loop(); collect(); }, loopMillis, stopMillis - clock.millis());
+      } else {
+        // e.g. a connection timeout at the start of a short trace, there is nothing left to compare
+        report.overran = true;
+      }
+      collect();
+
+      decisions(events, report.recorded);
+      decisions(replayed, report.replayed);
+      offline(events, endMillis, report.recordedOfflineMillis, report.recordedAttempts);
+      offline(replayed, endMillis, report.replayedOfflineMillis, report.replayedAttempts);
+
+      while (report.matching < report.recorded.size() && report.matching < report.replayed.size()) {
+        const wifiReplayDecision_t & a = report.recorded[report.matching];
+        const wifiReplayDecision_t & b = report.replayed[report.matching];
+        if (a.type != b.type || a.a != b.a || a.bssid != b.bssid) break;
+        report.matching++;
+      }
+      report.diverged = report.overran || report.matching < report.recorded.size() || report.matching < report.replayed.size();
+      return report;
+    }
+};
+
+#endif
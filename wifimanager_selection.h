@@ -0,0 +1,225 @@
+/**
+ * Wifi Manager - network selection strategies
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_SELECTION_h
+#define WIFIMANAGER_SELECTION_h
+
+#include <stdint.h>
+
+#ifndef WIFIMANAGER_DEFAULT_PRIORITY
+#define WIFIMANAGER_DEFAULT_PRIORITY 0      // Priority of networks added without an explicit priority
+#endif
+
+#ifndef WIFIMANAGER_NO_RSSI_FLOOR
+#define WIFIMANAGER_NO_RSSI_FLOOR -128      // RSSI floor that accepts any signal strength
+#endif
+
+#ifndef WIFIMANAGER_MAX_CANDIDATES
+#define WIFIMANAGER_MAX_CANDIDATES 16       // Max number of matching BSSIDs kept from a scan, valid range is uint8_t
+#endif
+
+#ifndef WIFIMANAGER_BLACKLIST_MAX_MILLIS
+#define WIFIMANAGER_BLACKLIST_MAX_MILLIS 3600000UL // Upper limit of a temporary blacklisting
+#endif
+
+// Classified cause of a failed connection, derived from the 802.11 disconnect reason
+enum wifiFailureClass_t : uint8_t {
+  WIFI_FAILURE_NONE = 0,
+  WIFI_FAILURE_AUTH,                // Authentication rejected or security mismatch, usually a wrong password
+  WIFI_FAILURE_HANDSHAKE_TIMEOUT,   // 4-way handshake timed out, a wrong WPA2-PSK password on most APs
+  WIFI_FAILURE_NOT_FOUND,           // The AP did not answer
+  WIFI_FAILURE_ASSOC_REFUSED,       // The AP refused the association, e.g. too many stations
+  WIFI_FAILURE_LINK_LOST,           // Beacon loss or the AP dropped an established connection
+  WIFI_FAILURE_NO_UPLINK,           // Connected, but the health checks failed
+  WIFI_FAILURE_OTHER,
+  WIFI_FAILURE_WEAK_SIGNAL,         // Left an AP whose smoothed RSSI dropped below the minimum of the network
+};
+
+/**
+ * @brief Classify an 802.11 or ESP-IDF (200+) disconnect reason code
+ * @param reason Reason code of the disconnect event
+ * @return wifiFailureClass_t classification
+ */
+inline wifiFailureClass_t wifiClassifyReason(uint8_t reason) {
+  switch(reason) {
+    case 0:
+      return WIFI_FAILURE_NONE;
+    case 2: case 6: case 9: case 14: case 18: case 19: case 20: case 21: case 22: case 23: case 24: case 202:
+      return WIFI_FAILURE_AUTH;
+    case 15: case 16: case 204:
+      return WIFI_FAILURE_HANDSHAKE_TIMEOUT;
+    case 201: case 210: case 211: case 212:
+      return WIFI_FAILURE_NOT_FOUND;
+    case 4: case 5: case 7: case 10: case 11: case 203: case 208:
+      return WIFI_FAILURE_ASSOC_REFUSED;
+    case 3: case 8: case 200: case 206: case 209:
+      return WIFI_FAILURE_LINK_LOST;
+    default:
+      return WIFI_FAILURE_OTHER;
+  }
+}
+
+// Name of a failure class as used by the API
+inline const char * wifiFailureName(wifiFailureClass_t failure) {
+  switch(failure) {
+    case WIFI_FAILURE_NONE: return "none";
+    case WIFI_FAILURE_AUTH: return "auth";
+    case WIFI_FAILURE_HANDSHAKE_TIMEOUT: return "handshakeTimeout";
+    case WIFI_FAILURE_NOT_FOUND: return "notFound";
+    case WIFI_FAILURE_ASSOC_REFUSED: return "assocRefused";
+    case WIFI_FAILURE_LINK_LOST: return "linkLost";
+    case WIFI_FAILURE_NO_UPLINK: return "noUplink";
+    case WIFI_FAILURE_WEAK_SIGNAL: return "weakSignal";
+    default: return "other";
+  }
+}
+
+// Initial blacklist duration of a failure class, 0 if it does not block further attempts
+inline uint32_t wifiFailureBlockMillis(wifiFailureClass_t failure) {
+  switch(failure) {
+    case WIFI_FAILURE_AUTH: return 300000;
+    case WIFI_FAILURE_NO_UPLINK: return 300000;
+    case WIFI_FAILURE_HANDSHAKE_TIMEOUT: return 120000;
+    case WIFI_FAILURE_ASSOC_REFUSED: return 60000;
+    case WIFI_FAILURE_WEAK_SIGNAL: return 60000;
+    case WIFI_FAILURE_NOT_FOUND: return 30000;
+    default: return 0;
+  }
+}
+
+/**
+ * @brief Temporary blacklisting of a network or BSSID after failed connections
+ * @details Each failure doubles the blocking time up to WIFIMANAGER_BLACKLIST_MAX_MILLIS.
+ * One strike is forgotten per initial blocking time passed without a failure.
+ */
+struct wifiBlock_t {
+  wifiFailureClass_t failure = WIFI_FAILURE_NONE; // Cause of the last failure
+  uint8_t strikes = 0;              // Recent failures causing a block
+  uint64_t blockedUntilMillis = 0;  // No connection attempts before this time
+
+  bool blocked(uint64_t now) const { return now < blockedUntilMillis; }
+
+  // Record a failure and extend the block according to its class
+  void strike(wifiFailureClass_t cause, uint64_t now) {
+    failure = cause;
+    uint32_t base = wifiFailureBlockMillis(cause);
+    if (base == 0) return;
+    if (strikes > 0 && now > blockedUntilMillis) {
+      uint64_t forgotten = (now - blockedUntilMillis) / base;
+      strikes = forgotten >= strikes ? 0 : strikes - forgotten;
+    }
+    if (strikes < UINT8_MAX) strikes++;
+    uint64_t duration = (uint64_t)base << (strikes < 8 ? strikes - 1 : 7);
+    if (duration > WIFIMANAGER_BLACKLIST_MAX_MILLIS) duration = WIFIMANAGER_BLACKLIST_MAX_MILLIS;
+    blockedUntilMillis = now + duration;
+  }
+};
+
+// Metadata of a stored network, used to rank the scan results
+struct wifiNetworkInfo_t {
+  uint8_t apPriority = WIFIMANAGER_DEFAULT_PRIORITY;  // Higher priority networks are preferred regardless of the RSSI
+  int8_t apMinRssi = WIFIMANAGER_NO_RSSI_FLOOR;       // Ignore the network if the signal is weaker than this
+  uint8_t connectAttempts = 0;      // Recent connection attempts, decays and is not stored in NVS
+  uint8_t connectSuccess = 0;       // Recent successful connections, decays and is not stored in NVS
+};
+
+// A scanned network (BSSID) that matches a stored SSID
+struct wifiCandidate_t {
+  uint8_t apId;                     // ID of the stored network within the apList
+  int8_t rssi;                      // Signal strength of the scanned BSSID
+  uint8_t channel;                  // Primary channel of the scanned BSSID
+  uint8_t bssid[6];                 // MAC of the scanned AP
+  wifiNetworkInfo_t network;        // Copy of the stored network metadata
+};
+
+// Orders the matching scan results, best candidate first
+class WifiSelectionStrategy {
+  public:
+    virtual ~WifiSelectionStrategy() {}
+
+    // Sort the candidates in place and return how many of them may be used
+    virtual uint8_t rank(wifiCandidate_t * candidates, uint8_t count) = 0;
+};
+
+/**
+ * @brief Strategy ranking the candidates by a score calculated by the Scorer policy
+ * @details The Scorer is a functor `int32_t operator()(const wifiCandidate_t &) const`,
+ * returning a higher value for better candidates or INT32_MIN to exclude one.
+ * It is inlined into the sort, so custom policies cost no virtual call per candidate.
+ * Candidates with the same score are ordered by RSSI.
+ */
+template<class Scorer>
+class WifiScoredSelection : public WifiSelectionStrategy {
+  public:
+    Scorer scorer;
+
+    WifiScoredSelection(Scorer scorer = Scorer()) : scorer(scorer) {}
+
+    uint8_t rank(wifiCandidate_t * candidates, uint8_t count) override {
+      int32_t scores[WIFIMANAGER_MAX_CANDIDATES];
+      if (count > WIFIMANAGER_MAX_CANDIDATES) count = WIFIMANAGER_MAX_CANDIDATES;
+      uint8_t usable = 0;
+      for (uint8_t i = 0; i < count; i++) {
+        int32_t score = scorer(candidates[i]);
+        if (score == INT32_MIN) continue;
+        // insertion sort, the candidate list is short
+        wifiCandidate_t current = candidates[i];
+        uint8_t pos = usable;
+        while (pos > 0 && (scores[pos-1] < score || (scores[pos-1] == score && candidates[pos-1].rssi < current.rssi))) {
+          candidates[pos] = candidates[pos-1];
+          scores[pos] = scores[pos-1];
+          pos--;
+        }
+        candidates[pos] = current;
+        scores[pos] = score;
+        usable++;
+      }
+      return usable;
+    }
+};
+
+// Rates the candidates by the signal strength only
+struct WifiRssiScorer {
+  int32_t operator()(const wifiCandidate_t & c) const {
+    return c.rssi;
+  }
+};
+
+// Rates the candidates by priority, then RSSI within a band, then recent success rate
+struct WifiPriorityScorer {
+  uint8_t rssiBandDb = 10;          // Networks with the same priority and RSSI within this band are considered equal
+
+  int32_t operator()(const wifiCandidate_t & c) const {
+    if (c.rssi < c.network.apMinRssi) return INT32_MIN;
+
+    int32_t band = ((int32_t)c.rssi + 128) / (rssiBandDb ? rssiBandDb : 1);
+    if (band > 255) band = 255;
+
+    int32_t successRate = 50;       // unknown networks are rated average
+    if (c.network.connectAttempts > 0) {
+      successRate = (100 * c.network.connectSuccess) / c.network.connectAttempts;
+    }
+    return ((int32_t)c.network.apPriority << 16) | (band << 8) | successRate;
+  }
+};
+
+// Rates the candidates by the learned success rate, then by RSSI
+struct WifiSuccessRateScorer {
+  int32_t operator()(const wifiCandidate_t & c) const {
+    if (c.rssi < c.network.apMinRssi) return INT32_MIN;
+
+    // Laplace smoothing gives untested networks a chance
+    int32_t successRate = (1000 * (c.network.connectSuccess + 1)) / (c.network.connectAttempts + 2);
+    return (successRate << 8) | (uint8_t)((int32_t)c.rssi + 128);
+  }
+};
+
+typedef WifiScoredSelection<WifiRssiScorer> WifiRssiSelection;
+typedef WifiScoredSelection<WifiPriorityScorer> WifiPrioritySelection;
+typedef WifiScoredSelection<WifiSuccessRateScorer> WifiSuccessRateSelection;
+
+#endif
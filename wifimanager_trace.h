@@ -0,0 +1,184 @@
+/**
+ * Wifi Manager - binary event trace
+ * (c) 2022-2024 Martin Verges
+ *
+ * Licensed under CC BY-NC-SA 4.0
+ * (Attribution-NonCommercial-ShareAlike 4.0 International)
+**/
+#ifndef WIFIMANAGER_TRACE_h
+#define WIFIMANAGER_TRACE_h
+
+#include <stdint.h>
+#include <string.h>
+#include <atomic>
+
+#ifndef WIFIMANAGER_TRACE_SIZE
+#define WIFIMANAGER_TRACE_SIZE 128          // Number of trace records kept, must be a power of 2
+#endif
+
+#define WIFIMANAGER_TRACE_VERSION 1         // Version of the export format, see tools/trace_decode.py
+#define WIFIMANAGER_TRACE_RECORD_SIZE 20    // Bytes of a single exported record
+#define WIFIMANAGER_TRACE_HEADER_SIZE 16    // Bytes of the export header
+
+// Type of a trace record, the meaning of the arguments is given as a, b, arg1, arg2
+enum wifiTraceType_t : uint8_t {
+  WIFI_TRACE_START = 1,             // Background task started: a = configured SSIDs
+  WIFI_TRACE_SCAN,                  // Scan finished: b = networks found, arg1 = duration in ms
+  WIFI_TRACE_SCAN_AP,               // Scan record: a = channel, b = rssi | authmode << 8, arg1 = SSID hash, arg2 = BSSID bytes 2-5
+  WIFI_TRACE_CONNECT,               // Connection attempt: a = apId, b = channel, arg1 = BSSID bytes 2-5, arg2 = wifiIpMode_t
+  WIFI_TRACE_CONNECT_RESULT,        // Attempt finished: a = wifiLinkStatus_t, b = reason, arg1 = duration in ms, arg2 = wifiFailureClass_t
+  WIFI_TRACE_DISCONNECTED,          // Station disconnect event: a = reason, b = rssi
+  WIFI_TRACE_GOT_IP,                // Station got an IP address
+  WIFI_TRACE_LOST_IP,               // Station lost its IP address
+  WIFI_TRACE_BACKOFF,               // Next attempt delayed: arg1 = delay in ms
+  WIFI_TRACE_BLOCK,                 // Network blocked: a = apId, b = wifiFailureClass_t, arg1 = duration in ms, arg2 = BSSID bytes 2-5 or 0 for the SSID
+  WIFI_TRACE_ROAM,                  // Leaving a weak AP: a = apId, b = smoothed rssi
+  WIFI_TRACE_HEALTH,                // Health check: a = healthy, b = consecutive failures, arg1 = wifiHealthAction_t taken
+  WIFI_TRACE_SOFTAP,                // SoftAP: a = 1 started, 0 stopped
+};
+
+// Bytes 2-5 of a BSSID as used in the trace arguments
+inline uint32_t wifiTraceBssid(const uint8_t * bssid) {
+  return (uint32_t)bssid[2] << 24 | (uint32_t)bssid[3] << 16 | (uint32_t)bssid[4] << 8 | bssid[5];
+}
+
+// A single decoded trace record
+struct wifiTraceRecord_t {
+  uint32_t seq;                     // Sequence number, starts at 1, gaps mark lost records
+  uint32_t micros;                  // Time of the event, lower 32 bits of the clock
+  uint8_t type;                     // wifiTraceType_t
+  uint8_t a;                        // Small arguments, see wifiTraceType_t
+  uint16_t b;
+  uint32_t arg1;
+  uint32_t arg2;
+};
+
+/**
+ * @brief Fixed size ring buffer of binary trace records
+ * @details Recording is lock-free and does not allocate, so it can be used from the
+ * background task and the WiFi event task at the same time. Each slot is guarded by its
+ * sequence number: it is cleared before and set after the payload is written, a reader
+ * discards records whose sequence number changed while copying them.
+ */
+class WifiTrace {
+  protected:
+    static_assert((WIFIMANAGER_TRACE_SIZE & (WIFIMANAGER_TRACE_SIZE - 1)) == 0, "WIFIMANAGER_TRACE_SIZE must be a power of 2");
+
+    struct slot_t {
+      std::atomic<uint32_t> seq{0};     // Sequence number of the record, 0 while written
+      std::atomic<uint32_t> micros{0};
+      std::atomic<uint32_t> head{0};    // type | a << 8 | b << 16
+      std::atomic<uint32_t> arg1{0};
+      std::atomic<uint32_t> arg2{0};
+    };
+    slot_t slots[WIFIMANAGER_TRACE_SIZE];
+    std::atomic<uint32_t> last{0};      // Sequence number of the newest record
+
+  public:
+    // Add a record, overwriting the oldest one if the buffer is full
+    void record(uint32_t micros, wifiTraceType_t type, uint8_t a = 0, uint16_t b = 0, uint32_t arg1 = 0, uint32_t arg2 = 0) {
+      uint32_t seq = last.fetch_add(1, std::memory_order_relaxed) + 1;
+      slot_t & slot = slots[(seq - 1) & (WIFIMANAGER_TRACE_SIZE - 1)];
+      slot.seq.store(0, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      slot.micros.store(micros, std::memory_order_relaxed);
+      slot.head.store(type | (uint32_t)a << 8 | (uint32_t)b << 16, std::memory_order_relaxed);
+      slot.arg1.store(arg1, std::memory_order_relaxed);
+      slot.arg2.store(arg2, std::memory_order_relaxed);
+      slot.seq.store(seq, std::memory_order_release);
+    }
+
+    // Sequence number of the newest record, 0 if nothing was recorded
+    uint32_t newest() const { return last.load(std::memory_order_acquire); }
+
+    // Sequence number of the oldest record still in the buffer
+    uint32_t oldest() const {
+      uint32_t seq = newest();
+      return seq > WIFIMANAGER_TRACE_SIZE ? seq - WIFIMANAGER_TRACE_SIZE + 1 : 1;
+    }
+
+    // Copy a record, returns false if it was overwritten or is still being written
+    bool read(uint32_t seq, wifiTraceRecord_t & out) const {
+      const slot_t & slot = slots[(seq - 1) & (WIFIMANAGER_TRACE_SIZE - 1)];
+      if (seq == 0 || slot.seq.load(std::memory_order_acquire) != seq) return false;
+      out.seq = seq;
+      out.micros = slot.micros.load(std::memory_order_relaxed);
+      uint32_t head = slot.head.load(std::memory_order_relaxed);
+      out.arg1 = slot.arg1.load(std::memory_order_relaxed);
+      out.arg2 = slot.arg2.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (slot.seq.load(std::memory_order_relaxed) != seq) return false;
+      out.type = head & 0xff;
+      out.a = (head >> 8) & 0xff;
+      out.b = head >> 16;
+      return true;
+    }
+};
+
+/**
+ * @brief Serializes the trace records into consecutive output chunks
+ * @details Output is a WIFIMANAGER_TRACE_HEADER_SIZE byte header ("WMTR", version,
+ * record size, capacity, sequence number of the first record, current time in us)
+ * followed by the records, all values little endian. Records added while exporting are
+ * not included, records overwritten while exporting are skipped.
+ */
+class WifiTraceStream {
+  protected:
+    const WifiTrace & trace;
+    uint32_t next;                      // Sequence number of the next record to export
+    uint32_t last;                      // Sequence number of the last record to export
+    uint8_t item[WIFIMANAGER_TRACE_RECORD_SIZE]; // Current header or record
+    size_t itemPos = 0;                 // Bytes of the current item already written
+    size_t itemLen = 0;                 // Size of the current item
+
+    static uint8_t * put16(uint8_t * p, uint16_t v) { p[0] = v; p[1] = v >> 8; return p + 2; }
+    static uint8_t * put32(uint8_t * p, uint32_t v) { p = put16(p, v); return put16(p, v >> 16); }
+
+    // Render the next header or record into item, returns false at the end
+    bool produce() {
+      itemPos = itemLen = 0;
+      wifiTraceRecord_t record;
+      while (next <= last) {
+        if (!trace.read(next++, record)) continue;
+        uint8_t * p = put32(item, record.seq);
+        p = put32(p, record.micros);
+        *p++ = record.type;
+        *p++ = record.a;
+        p = put16(p, record.b);
+        p = put32(p, record.arg1);
+        put32(p, record.arg2);
+        itemLen = WIFIMANAGER_TRACE_RECORD_SIZE;
+        return true;
+      }
+      return false;
+    }
+
+  public:
+    WifiTraceStream(const WifiTrace & trace, uint32_t nowMicros) : trace(trace) {
+      last = trace.newest();
+      next = trace.oldest();
+      memcpy(item, "WMTR", 4);
+      item[4] = WIFIMANAGER_TRACE_VERSION;
+      item[5] = WIFIMANAGER_TRACE_RECORD_SIZE;
+      uint8_t * p = put16(item + 6, WIFIMANAGER_TRACE_SIZE);
+      p = put32(p, next);
+      put32(p, nowMicros);
+      itemLen = WIFIMANAGER_TRACE_HEADER_SIZE;
+    }
+
+    // Fill the output buffer with the next bytes, returns 0 when finished
+    size_t fill(uint8_t * out, size_t maxLen) {
+      size_t written = 0;
+      while (written < maxLen) {
+        if (itemPos >= itemLen && !produce()) break;
+        size_t n = itemLen - itemPos;
+        if (n > maxLen - written) n = maxLen - written;
+        memcpy(out + written, item + itemPos, n);
+        itemPos += n;
+        written += n;
+      }
+      return written;
+    }
+};
+
+#endif